@@ -206,7 +206,10 @@ bool CActiveMasternode::SendMasternodePing(std::string& errorMessage) {
         //mnodeman.mapSeenMasternodeBroadcast.lastPing is probably outdated, so we'll update it
         CMasternodeBroadcast mnb(*pmn);
         uint256 hash = mnb.GetHash();
-        if(mnodeman.mapSeenMasternodeBroadcast.count(hash)) mnodeman.mapSeenMasternodeBroadcast[hash].lastPing = mnp;
+        if(mnodeman.mapSeenMasternodeBroadcast.count(hash)) {
+            mnodeman.mapSeenMasternodeBroadcast[hash].lastPing = mnp;
+            relayCache.Erase(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
+        }
 
         mnp.Relay();
 
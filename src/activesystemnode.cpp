@@ -207,7 +207,10 @@ bool CActiveSystemnode::SendSystemnodePing(std::string& errorMessage) {
         //snodeman.mapSeenSystemnodeBroadcast.lastPing is probably outdated, so we'll update it
         CSystemnodeBroadcast mnb(*pmn);
         uint256 hash = mnb.GetHash();
-        if(snodeman.mapSeenSystemnodeBroadcast.count(hash)) snodeman.mapSeenSystemnodeBroadcast[hash].lastPing = mnp;
+        if(snodeman.mapSeenSystemnodeBroadcast.count(hash)) {
+            snodeman.mapSeenSystemnodeBroadcast[hash].lastPing = mnp;
+            relayCache.Erase(CInv(MSG_SYSTEMNODE_ANNOUNCE, hash));
+        }
 
         mnp.Relay();
 
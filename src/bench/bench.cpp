@@ -0,0 +1,81 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <iostream>
+
+#include <boost/foreach.hpp>
+#include <sys/time.h>
+
+using namespace benchmark;
+
+static double GetTimeDouble()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 0.000001;
+}
+
+BenchRunner::BenchmarkMap& BenchRunner::Benchmarks()
+{
+    // Function local, benchmarks register themselves during static initialization
+    static BenchmarkMap benchmarks;
+    return benchmarks;
+}
+
+BenchRunner::BenchRunner(const std::string& name, BenchFunction func)
+{
+    Benchmarks().insert(std::make_pair(name, func));
+}
+
+void BenchRunner::RunAll(const std::string& strFilter, double dMaxElapsed)
+{
+    std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << "\n";
+
+    BOOST_FOREACH(const BenchmarkMap::value_type& p, Benchmarks()) {
+        if (!strFilter.empty() && p.first.find(strFilter) == std::string::npos)
+            continue;
+        State state(p.first, dMaxElapsed);
+        p.second(state);
+    }
+}
+
+void BenchRunner::List()
+{
+    BOOST_FOREACH(const BenchmarkMap::value_type& p, Benchmarks())
+        std::cout << p.first << "\n";
+}
+
+bool State::KeepRunning()
+{
+    double dNow;
+    if (nCount == 0) {
+        dBeginTime = dNow = GetTimeDouble();
+    } else {
+        if ((nCount + 1) % nTimeCheckCount != 0) {
+            ++nCount;
+            return true;
+        }
+        dNow = GetTimeDouble();
+        double dElapsedOne = (dNow - dLastTime) / nTimeCheckCount;
+        if (dElapsedOne < dMinTime) dMinTime = dElapsedOne;
+        if (dElapsedOne > dMaxTime) dMaxTime = dElapsedOne;
+        // Read the clock less often while a batch of iterations takes under 1/16 of the budget
+        if (dElapsedOne * nTimeCheckCount < dMaxElapsed / 16) nTimeCheckCount *= 2;
+    }
+    dLastTime = dNow;
+    ++nCount;
+
+    if (dNow - dBeginTime < dMaxElapsed)
+        return true;
+
+    // The last call doesn't run the body
+    --nCount;
+
+    double dAverage = (dNow - dBeginTime) / nCount;
+    std::cout << name << "," << nCount << "," << dMinTime << "," << dMaxTime << "," << dAverage << "\n";
+
+    return false;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CROWN_BENCH_BENCH_H
+#define CROWN_BENCH_BENCH_H
+
+#include <limits>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+/*
+ * Micro-benchmarks for bench_crown. A benchmark does its setup, then times
+ * the body of a KeepRunning() loop, then cleans up:
+
+static void CodeToTime(benchmark::State& state)
+{
+    ... setup ...
+    while (state.KeepRunning()) {
+        ... code to time ...
+    }
+    ... cleanup ...
+}
+
+BENCHMARK(CodeToTime);
+
+ * The loop runs until the benchmark has used its time budget (-maxtime),
+ * after which min, max and average time per iteration are printed.
+ */
+
+namespace benchmark {
+
+class State
+{
+private:
+    std::string name;
+    double dMaxElapsed;
+    double dBeginTime;
+    double dLastTime;
+    double dMinTime;
+    double dMaxTime;
+    int64_t nCount;
+    //! Only read the clock every nTimeCheckCount iterations, so very fast benchmarks aren't dominated by it
+    int64_t nTimeCheckCount;
+
+public:
+    State(const std::string& nameIn, double dMaxElapsedIn) :
+        name(nameIn), dMaxElapsed(dMaxElapsedIn), dBeginTime(0), dLastTime(0),
+        dMinTime(std::numeric_limits<double>::max()), dMaxTime(0), nCount(0), nTimeCheckCount(1) {}
+
+    bool KeepRunning();
+};
+
+typedef boost::function<void(State&)> BenchFunction;
+
+class BenchRunner
+{
+private:
+    typedef std::map<std::string, BenchFunction> BenchmarkMap;
+    static BenchmarkMap& Benchmarks();
+
+public:
+    BenchRunner(const std::string& name, BenchFunction func);
+
+    /** Run every benchmark whose name contains strFilter for about dMaxElapsed seconds each */
+    static void RunAll(const std::string& strFilter, double dMaxElapsed);
+    static void List();
+};
+
+}
+
+// BENCHMARK(foo) expands to: benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // CROWN_BENCH_BENCH_H
@@ -0,0 +1,59 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "main.h"
+#include "script/sigcache.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        printf("Usage: bench_crown [options]\n\n"
+               "Options:\n"
+               "  -filter=<name>    Only run benchmarks whose name contains <name>\n"
+               "  -list             List the benchmarks and exit\n"
+               "  -maxtime=<n>      Run each benchmark for about <n> seconds (default: 1)\n"
+               "  -par=<n>          Number of script verification threads (default: %d)\n",
+               DEFAULT_SCRIPTCHECK_THREADS);
+        return 0;
+    }
+    if (GetBoolArg("-list", false)) {
+        benchmark::BenchRunner::List();
+        return 0;
+    }
+
+    printf("Using the '%s' SHA256 implementation\n", SHA256AutoDetect().c_str());
+    ECC_Start();
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::UNITTEST);
+    InitSignatureCache();
+
+    boost::thread_group threadGroup;
+    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread(&ThreadScriptCheck);
+
+    double dMaxElapsed = atof(GetArg("-maxtime", "1").c_str());
+    benchmark::BenchRunner::RunAll(GetArg("-filter", ""), dMaxElapsed > 0 ? dMaxElapsed : 1);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    ECC_Stop();
+    return 0;
+}
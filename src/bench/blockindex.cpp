@@ -0,0 +1,108 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+namespace
+{
+    const int nBenchIndexEntries = 20000;
+
+    /** A synthetic header chain stored in an in-memory block tree database, loaded like at startup */
+    struct BenchBlockIndex
+    {
+        boost::filesystem::path pathTemp;
+        CBlockTreeDB* pblocktreeOld;
+        CCoinsViewCache* pcoinsTipOld;
+        CCoinsView viewDummy;
+        CCoinsViewCache viewCoins;
+
+        BenchBlockIndex()
+            : pblocktreeOld(pblocktree)
+            , pcoinsTipOld(pcoinsTip)
+            , viewCoins(&viewDummy)
+        {
+            pathTemp = GetTempPath() / strprintf("bench_crown_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+            boost::filesystem::create_directories(pathTemp / "blocks");
+            mapArgs["-datadir"] = pathTemp.string();
+            ClearDatadirCache();
+            pblocktree = new CBlockTreeDB(1 << 20, true);
+            pcoinsTip = &viewCoins;
+
+            LOCK(cs_main);
+            CBlockHeader header;
+            header.nBits = Params().GenesisBlock().nBits;
+            for (int i = 0; i < nBenchIndexEntries; ++i) {
+                header.nTime = Params().GenesisBlock().nTime + i * 60;
+                header.nNonce = i;
+                CBlockIndex* pindex = InsertBlockIndex(header.GetHash(), false);
+                pindex->pprev = i ? mapBlockIndex[header.hashPrevBlock] : NULL;
+                pindex->nHeight = i;
+                pindex->nVersion = header.nVersion;
+                pindex->hashMerkleRoot = header.hashMerkleRoot;
+                pindex->nTime = header.nTime;
+                pindex->nBits = header.nBits;
+                pindex->nNonce = header.nNonce;
+                pindex->nStatus = BLOCK_VALID_TREE;
+                pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex));
+                header.hashPrevBlock = pindex->GetBlockHash();
+            }
+            viewCoins.SetBestBlock(header.hashPrevBlock);
+            UnloadBlockIndex();
+        }
+
+        ~BenchBlockIndex()
+        {
+            LOCK(cs_main);
+            UnloadBlockIndex();
+            delete pblocktree;
+            pblocktree = pblocktreeOld;
+            pcoinsTip = pcoinsTipOld;
+            boost::filesystem::remove_all(pathTemp);
+            mapArgs.erase("-datadir");
+            ClearDatadirCache();
+        }
+    };
+}
+
+// Startup block index load walking every entry in the block tree database
+static void LoadBlockIndexFromDB(benchmark::State& state)
+{
+    BenchBlockIndex index;
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        UnloadBlockIndex();
+        assert(LoadBlockIndex());
+    }
+}
+
+// Startup block index load from the snapshot written at shutdown.
+// The load consumes the snapshot, so each round puts a copy back first.
+static void LoadBlockIndexFromSnapshot(benchmark::State& state)
+{
+    BenchBlockIndex index;
+    LOCK(cs_main);
+    assert(LoadBlockIndex());
+    assert(WriteBlockIndexSnapshot());
+    boost::filesystem::path pathSnapshot = GetDataDir() / "blocks" / "index.snapshot";
+    boost::filesystem::path pathCopy = index.pathTemp / "index.snapshot.copy";
+    boost::filesystem::copy_file(pathSnapshot, pathCopy);
+    while (state.KeepRunning()) {
+        boost::filesystem::copy_file(pathCopy, pathSnapshot, boost::filesystem::copy_option::overwrite_if_exists);
+        UnloadBlockIndex();
+        assert(LoadBlockIndex());
+        assert(!boost::filesystem::exists(pathSnapshot));
+    }
+}
+
+BENCHMARK(LoadBlockIndexFromDB);
+BENCHMARK(LoadBlockIndexFromSnapshot);
@@ -0,0 +1,99 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "coins.h"
+#include "keystore.h"
+#include "main.h"
+#include "script/sign.h"
+
+namespace
+{
+    // Far above the last checkpoint, so ConnectBlock verifies every script
+    const int nBenchHeight = 5000000;
+    const int nBenchSpends = 1000;
+
+    /**
+     * A block spending nBenchSpends signed pay-to-pubkey-hash outputs, on top of
+     * a synthetic previous block whose coins view holds the funding outputs.
+     */
+    struct BenchBlock
+    {
+        CBasicKeyStore keystore;
+        CBlock block;
+        uint256 hashPrev;
+        uint256 hashBlock;
+        CBlockIndex indexPrev;
+        CBlockIndex index;
+        CCoinsView viewDummy;
+        CCoinsViewCache viewBase;
+
+        BenchBlock() : viewBase(&viewDummy)
+        {
+            CKey key;
+            key.MakeNewKey(true);
+            keystore.AddKey(key);
+            CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+            CMutableTransaction txCoinbase;
+            txCoinbase.vin.resize(1);
+            txCoinbase.vin[0].scriptSig = CScript() << nBenchHeight << OP_0;
+            txCoinbase.vout.push_back(CTxOut(0, scriptPubKey));
+            block.vtx.push_back(txCoinbase);
+
+            for (int i = 0; i < nBenchSpends; ++i) {
+                CMutableTransaction txFund;
+                txFund.vin.resize(1);
+                txFund.vin[0].prevout = COutPoint(ArithToUint256(i + 1), 0);
+                txFund.vout.push_back(CTxOut(COIN, scriptPubKey));
+                CCoinsModifier coins = viewBase.ModifyCoins(txFund.GetHash());
+                coins->FromTx(txFund, nBenchHeight - 100);
+
+                CMutableTransaction txSpend;
+                txSpend.vin.resize(1);
+                txSpend.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+                txSpend.vout.push_back(CTxOut(COIN - 1000, scriptPubKey));
+                SignSignature(keystore, txFund, txSpend, 0);
+                block.vtx.push_back(txSpend);
+            }
+            block.hashMerkleRoot = block.BuildMerkleTree();
+
+            hashPrev = ArithToUint256(nBenchHeight - 1);
+            indexPrev.nHeight = nBenchHeight - 1;
+            indexPrev.phashBlock = &hashPrev;
+            block.hashPrevBlock = hashPrev;
+            hashBlock = block.GetHash();
+            index.nHeight = nBenchHeight;
+            index.pprev = &indexPrev;
+            index.phashBlock = &hashBlock;
+            viewBase.SetBestBlock(hashPrev);
+        }
+    };
+}
+
+static void CheckBlockSpends(benchmark::State& state)
+{
+    BenchBlock bench;
+    CValidationState validationState;
+    while (state.KeepRunning()) {
+        // Without the proof of work check CheckBlock doesn't remember the result
+        assert(CheckBlock(bench.block, validationState, false, true));
+    }
+}
+
+static void ConnectBlockSpends(benchmark::State& state)
+{
+    BenchBlock bench;
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&bench.viewBase);
+        CValidationState validationState;
+        assert(ConnectBlock(bench.block, validationState, &bench.index, view, true));
+    }
+}
+
+BENCHMARK(CheckBlockSpends);
+BENCHMARK(ConnectBlockSpends);
@@ -0,0 +1,64 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "coins.h"
+
+namespace
+{
+    const int nBenchCoins = 10000;
+
+    uint256 CoinsHash(int n)
+    {
+        return ArithToUint256(n + 1);
+    }
+
+    void FillCoins(CCoinsViewCache& view)
+    {
+        for (int i = 0; i < nBenchCoins; ++i) {
+            CCoinsModifier coins = view.ModifyNewCoins(CoinsHash(i));
+            coins->nVersion = 1;
+            coins->nHeight = i;
+            coins->vout.resize(2, CTxOut(COIN, CScript() << OP_TRUE));
+        }
+        view.SetBestBlock(ArithToUint256(1));
+    }
+}
+
+// Lookups that go through an empty cache down to the base view
+static void CoinsCacheFetch(benchmark::State& state)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache viewBase(&viewDummy);
+    FillCoins(viewBase);
+    int n = 0;
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&viewBase);
+        for (int i = 0; i < 100; ++i, n = (n + 7919) % nBenchCoins)
+            assert(view.AccessCoins(CoinsHash(n)) != NULL);
+    }
+}
+
+// Spending outputs in a cache layered over the base view, then flushing it
+static void CoinsCacheModifyFlush(benchmark::State& state)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache viewBase(&viewDummy);
+    FillCoins(viewBase);
+    int n = 0;
+    while (state.KeepRunning()) {
+        CCoinsViewCache viewMid(&viewBase);
+        CCoinsViewCache view(&viewMid);
+        for (int i = 0; i < 100; ++i, n = (n + 7919) % nBenchCoins) {
+            CCoinsModifier coins = view.ModifyCoins(CoinsHash(n));
+            coins->Spend(i % 2);
+        }
+        view.Flush();
+    }
+}
+
+BENCHMARK(CoinsCacheFetch);
+BENCHMARK(CoinsCacheModifyFlush);
@@ -0,0 +1,55 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+
+#include <vector>
+
+#define BUFFER_SIZE (1000 * 1000)
+
+static void SHA256_1MB(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(hash);
+}
+
+// Double SHA256 of 64 bytes, the shape of every merkle tree node
+static void DoubleSHA256_64(benchmark::State& state)
+{
+    uint256 left, right, result;
+    while (state.KeepRunning()) {
+        result = Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+        left = result;
+    }
+}
+
+// Double SHA256 of 32 bytes, the shape of every txid and block hash of a small object
+static void SHA256_32b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32, 0);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++)
+            CSHA256().Write(in.data(), in.size()).Finalize(in.data());
+    }
+}
+
+// A merkle tree level of 1024 nodes, hashed as a batch over the available lanes
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning())
+        SHA256D64(in.data(), in.data(), 1024);
+}
+
+BENCHMARK(SHA256_1MB);
+BENCHMARK(DoubleSHA256_64);
+BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
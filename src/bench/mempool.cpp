@@ -0,0 +1,45 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "amount.h"
+#include "arith_uint256.h"
+#include "txmempool.h"
+
+#include <list>
+
+#include <boost/foreach.hpp>
+
+// Filling a pool with chains of two transactions and mining them all in one block
+static void MempoolAddRemove(benchmark::State& state)
+{
+    std::vector<CTransaction> vtx;
+    for (int i = 0; i < 1000; ++i) {
+        CMutableTransaction txParent;
+        txParent.vin.resize(1);
+        txParent.vin[0].prevout = COutPoint(ArithToUint256(i + 1), 0);
+        txParent.vin[0].scriptSig = CScript() << OP_1;
+        txParent.vout.push_back(CTxOut(10 * COIN, CScript() << OP_TRUE));
+        vtx.push_back(txParent);
+
+        CMutableTransaction txChild;
+        txChild.vin.resize(1);
+        txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+        txChild.vin[0].scriptSig = CScript() << OP_1;
+        txChild.vout.push_back(CTxOut(10 * COIN - 1000, CScript() << OP_TRUE));
+        vtx.push_back(txChild);
+    }
+
+    CTxMemPool pool(CFeeRate(1000));
+    while (state.KeepRunning()) {
+        BOOST_FOREACH(const CTransaction& tx, vtx)
+            pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 10.0, 1));
+        std::list<CTransaction> conflicts;
+        pool.removeForBlock(vtx, 2, conflicts);
+        assert(pool.size() == 0);
+    }
+}
+
+BENCHMARK(MempoolAddRemove);
@@ -0,0 +1,101 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main.h"
+#include "masternode-payments.h"
+
+namespace
+{
+    const int nBenchMasternodes = 5000;
+    const int nBenchChainLength = 7000;
+
+    CScript GetPayee(int n)
+    {
+        return GetScriptForDestination(CKeyID(Hash160(BEGIN(n), END(n))));
+    }
+
+    CMasternodePaymentWinner CreateWinner(int nBlockHeight, const CScript& payee, int nVoter)
+    {
+        CMasternodePaymentWinner winner(CTxIn(COutPoint(ArithToUint256(nVoter + 1), 0)));
+        winner.nBlockHeight = nBlockHeight;
+        winner.AddPayee(payee);
+        return winner;
+    }
+
+    /** A synthetic chain where every height paid the next masternode in turn */
+    struct BenchLastPaid
+    {
+        std::vector<uint256> hashes;
+        std::vector<CBlockIndex> blocks;
+        std::vector<CScript> payees;
+
+        BenchLastPaid()
+            : hashes(nBenchChainLength)
+            , blocks(nBenchChainLength)
+        {
+            for (int i = 0; i < nBenchChainLength; ++i) {
+                hashes[i] = ArithToUint256(i);
+                blocks[i].nHeight = i;
+                blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+                blocks[i].phashBlock = &hashes[i];
+                blocks[i].BuildSkip();
+            }
+            chainActive.SetTip(&blocks.back());
+            mapCacheBlockHashes.clear();
+            masternodePayments.Clear();
+
+            for (int i = 0; i < nBenchMasternodes; ++i)
+                payees.push_back(GetPayee(i));
+            for (int h = 101; h < nBenchChainLength; ++h) {
+                for (int nVoter = 0; nVoter < MNPAYMENTS_PAID_VOTES_REQUIRED; ++nVoter) {
+                    CMasternodePaymentWinner winner = CreateWinner(h, payees[h % nBenchMasternodes], nVoter);
+                    assert(masternodePayments.AddWinningMasternode(winner));
+                }
+            }
+        }
+
+        ~BenchLastPaid()
+        {
+            masternodePayments.Clear();
+            mapCacheBlockHashes.clear();
+            chainActive = CChain();
+        }
+    };
+}
+
+// Last paid height found by walking back from the tip, as before the index
+static void MasternodeLastPaidChainWalk(benchmark::State& state)
+{
+    BenchLastPaid bench;
+    const int nMaxBlocksAgo = nBenchMasternodes * 1.25;
+    int n = 0;
+    while (state.KeepRunning()) {
+        const CScript& payee = bench.payees[n];
+        const CBlockIndex* pindex = chainActive.Tip();
+        for (int i = 0; pindex && pindex->nHeight > 0 && i < nMaxBlocksAgo; ++i, pindex = pindex->pprev) {
+            if (masternodePayments.mapMasternodeBlocks.count(pindex->nHeight) &&
+                masternodePayments.mapMasternodeBlocks[pindex->nHeight].HasPayeeWithVotes(payee, MNPAYMENTS_PAID_VOTES_REQUIRED))
+                break;
+        }
+        n = (n + 1) % nBenchMasternodes;
+    }
+}
+
+// Last paid height looked up in the paid height index
+static void MasternodeLastPaidIndex(benchmark::State& state)
+{
+    BenchLastPaid bench;
+    const int nMaxBlocksAgo = nBenchMasternodes * 1.25;
+    const int nTip = chainActive.Height();
+    int n = 0;
+    while (state.KeepRunning()) {
+        masternodePayments.GetLastPaidHeight(bench.payees[n], nTip, nTip - nMaxBlocksAgo + 1);
+        n = (n + 1) % nBenchMasternodes;
+    }
+}
+
+BENCHMARK(MasternodeLastPaidChainWalk);
+BENCHMARK(MasternodeLastPaidIndex);
@@ -0,0 +1,89 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "coins.h"
+#include "main.h"
+#include "masternode.h"
+#include "masternodeman.h"
+
+namespace
+{
+    const int nBenchMasternodes = 2000;
+    const int nBenchChainLength = 1000;
+
+    /** A synthetic chain and masternode list whose collateral confirmed in the first block */
+    struct BenchMasternodes
+    {
+        std::vector<uint256> hashes;
+        std::vector<CBlockIndex> blocks;
+        CCoinsView viewDummy;
+        CCoinsViewCache* pcoinsTipOld;
+        CCoinsViewCache viewCoins;
+
+        BenchMasternodes()
+            : hashes(nBenchChainLength)
+            , blocks(nBenchChainLength)
+            , pcoinsTipOld(pcoinsTip)
+            , viewCoins(&viewDummy)
+        {
+            for (int i = 0; i < nBenchChainLength; ++i) {
+                hashes[i] = ArithToUint256(i);
+                blocks[i].nHeight = i;
+                blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+                blocks[i].phashBlock = &hashes[i];
+                blocks[i].BuildSkip();
+            }
+            chainActive.SetTip(&blocks.back());
+            pcoinsTip = &viewCoins;
+
+            for (int i = 0; i < nBenchMasternodes; ++i) {
+                CMutableTransaction txCollateral;
+                txCollateral.vin.resize(1);
+                txCollateral.vin[0].prevout = COutPoint(ArithToUint256(i + 1), 0);
+                txCollateral.vout.push_back(CTxOut(10000 * COIN, CScript() << OP_TRUE));
+                CCoinsModifier coins = viewCoins.ModifyCoins(txCollateral.GetHash());
+                coins->FromTx(txCollateral, 1);
+
+                CMasternode mn;
+                mn.vin = CTxIn(COutPoint(txCollateral.GetHash(), 0));
+                mn.activeState = CMasternode::MASTERNODE_ENABLED;
+                mnodeman.Add(mn);
+            }
+        }
+
+        ~BenchMasternodes()
+        {
+            mnodeman.Clear();
+            pcoinsTip = pcoinsTipOld;
+            chainActive = CChain();
+        }
+    };
+}
+
+// Ranking at the same height over and over, answered from the score cache
+static void MasternodeRankCached(benchmark::State& state)
+{
+    BenchMasternodes bench;
+    CTxIn vin = CTxIn(COutPoint(ArithToUint256(1), 0));
+    while (state.KeepRunning())
+        mnodeman.GetMasternodeRank(vin, nBenchChainLength - 1, 0, false);
+}
+
+// The tip moves between two blocks before every ranking, which empties the score
+// cache, so every ranking scores the whole list as after a new block
+static void MasternodeRankScores(benchmark::State& state)
+{
+    BenchMasternodes bench;
+    CTxIn vin = CTxIn(COutPoint(ArithToUint256(1), 0));
+    int n = 0;
+    while (state.KeepRunning()) {
+        chainActive.SetTip(&bench.blocks[nBenchChainLength - 1 - (n++ & 1)]);
+        mnodeman.GetMasternodeRank(vin, nBenchChainLength - 2, 0, false);
+    }
+}
+
+BENCHMARK(MasternodeRankCached);
+BENCHMARK(MasternodeRankScores);
@@ -0,0 +1,81 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "streams.h"
+
+namespace
+{
+    CMutableTransaction CreateTransaction(int n)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(2);
+        for (unsigned int i = 0; i < tx.vin.size(); ++i) {
+            tx.vin[i].prevout = COutPoint(ArithToUint256(n * 2 + i + 1), i);
+            // Roughly the size of a signature and a compressed pubkey
+            tx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+        }
+        tx.vout.resize(2, CTxOut(COIN, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, n) << OP_EQUALVERIFY << OP_CHECKSIG));
+        return tx;
+    }
+
+    CBlock CreateBlock()
+    {
+        CBlock block;
+        for (int i = 0; i < 2000; ++i)
+            block.vtx.push_back(CreateTransaction(i));
+        block.hashMerkleRoot = block.BuildMerkleTree();
+        return block;
+    }
+}
+
+static void SerializeBlock(benchmark::State& state)
+{
+    CBlock block = CreateBlock();
+    while (state.KeepRunning()) {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << block;
+    }
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CreateBlock();
+    while (state.KeepRunning()) {
+        CDataStream copy(stream);
+        CBlock block;
+        copy >> block;
+    }
+}
+
+static void SerializeTransaction(benchmark::State& state)
+{
+    CTransaction tx(CreateTransaction(1));
+    while (state.KeepRunning()) {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << tx;
+    }
+}
+
+// Deserializing a transaction includes hashing it for its txid
+static void DeserializeTransaction(benchmark::State& state)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CTransaction(CreateTransaction(1));
+    while (state.KeepRunning()) {
+        CDataStream copy(stream);
+        CTransaction tx;
+        copy >> tx;
+    }
+}
+
+BENCHMARK(SerializeBlock);
+BENCHMARK(DeserializeBlock);
+BENCHMARK(SerializeTransaction);
+BENCHMARK(DeserializeTransaction);
@@ -0,0 +1,132 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/sha256.h"
+#include "key.h"
+#include "main.h"
+#include "memusage.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
+
+namespace
+{
+    const int nBenchSignatures = 256;
+    const int nBenchLookups = 2000;
+
+    struct SignedHash
+    {
+        uint256 hash;
+        CPubKey pubkey;
+        std::vector<unsigned char> vchSig;
+    };
+
+    struct CheapHasher
+    {
+        size_t operator()(const uint256& key) const
+        {
+            return key.GetCheapHash();
+        }
+    };
+
+    /** The signature cache before the cuckoo cache: one unordered set behind one lock */
+    class SetSignatureChecker : public TransactionSignatureChecker
+    {
+    private:
+        static uint256 nonce;
+        static boost::unordered_set<uint256, CheapHasher> setValid;
+        static boost::shared_mutex cs_sigcache;
+
+    public:
+        SetSignatureChecker() : TransactionSignatureChecker(NULL, 0) {}
+
+        bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+        {
+            uint256 entry;
+            CSHA256().Write(nonce.begin(), 32).Write(sighash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
+            {
+                boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+                if (setValid.count(entry))
+                    return true;
+            }
+
+            if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+                return false;
+
+            size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+            boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+            while (memusage::DynamicUsage(setValid) > nMaxCacheSize) {
+                size_t s = GetRand(setValid.bucket_count());
+                boost::unordered_set<uint256, CheapHasher>::local_iterator it = setValid.begin(s);
+                if (it != setValid.end(s))
+                    setValid.erase(*it);
+            }
+            setValid.insert(entry);
+            return true;
+        }
+    };
+
+    uint256 SetSignatureChecker::nonce = GetRandHash();
+    boost::unordered_set<uint256, CheapHasher> SetSignatureChecker::setValid;
+    boost::shared_mutex SetSignatureChecker::cs_sigcache;
+
+    std::vector<SignedHash> CreateSignedHashes()
+    {
+        std::vector<SignedHash> vSigned(nBenchSignatures);
+        CKey key;
+        for (unsigned int i = 0; i < vSigned.size(); i++) {
+            if (i % 16 == 0)
+                key.MakeNewKey(true);
+            vSigned[i].hash = GetRandHash();
+            vSigned[i].pubkey = key.GetPubKey();
+            key.Sign(vSigned[i].hash, vSigned[i].vchSig);
+        }
+        return vSigned;
+    }
+
+    template <typename Checker>
+    void LookupSignatures(const Checker& checker, const std::vector<SignedHash>& vSigned, int nLookups)
+    {
+        for (int i = 0; i < nLookups; i++) {
+            const SignedHash& sig = vSigned[i % vSigned.size()];
+            assert(checker.VerifySignature(sig.vchSig, sig.pubkey, sig.hash));
+        }
+    }
+
+    // Cached lookups from as many threads as connecting a block uses
+    template <typename Checker>
+    void RunCachedLookups(benchmark::State& state, const Checker& checker)
+    {
+        std::vector<SignedHash> vSigned = CreateSignedHashes();
+        LookupSignatures(checker, vSigned, vSigned.size());
+        int nThreads = std::max(1, nScriptCheckThreads);
+        while (state.KeepRunning()) {
+            boost::thread_group threads;
+            for (int i = 0; i < nThreads; i++)
+                threads.create_thread(boost::bind(&LookupSignatures<Checker>, boost::cref(checker), boost::cref(vSigned), nBenchLookups));
+            threads.join_all();
+        }
+    }
+}
+
+// The cuckoo cache shards, as used by script checks
+static void SigCacheLookups(benchmark::State& state)
+{
+    RunCachedLookups(state, CachingTransactionSignatureChecker(NULL, 0));
+}
+
+// The single locked set it replaced
+static void SigCacheLookupsUnorderedSet(benchmark::State& state)
+{
+    RunCachedLookups(state, SetSignatureChecker());
+}
+
+BENCHMARK(SigCacheLookups);
+BENCHMARK(SigCacheLookupsUnorderedSet);
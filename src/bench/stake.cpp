@@ -0,0 +1,36 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "amount.h"
+#include "arith_uint256.h"
+#include "mn-pos/kernel.h"
+#include "uint256.h"
+
+// One kernel hash per candidate timestamp, the inner loop of the stake miner
+static void StakeKernelHash(benchmark::State& state)
+{
+    Kernel kernel(std::make_pair(ArithToUint256(1), 0u), 10000 * COIN, ArithToUint256(2), 1500000000, 1500000000);
+    uint64_t nTime = 1500000000;
+    while (state.KeepRunning()) {
+        kernel.SetStakeTime(++nTime);
+        kernel.GetStakeHash();
+    }
+}
+
+// The same candidates hashed a batch at a time, as SearchTimeSpan does
+static void StakeKernelHashBatch(benchmark::State& state)
+{
+    Kernel kernel(std::make_pair(ArithToUint256(1), 0u), 10000 * COIN, ArithToUint256(2), 1500000000, 1500000000);
+    uint64_t nTime = 1500000000;
+    uint256 vHashes[Kernel::HASH_BATCH_SIZE];
+    while (state.KeepRunning()) {
+        kernel.GetStakeHashes(nTime, Kernel::HASH_BATCH_SIZE, vHashes);
+        nTime += Kernel::HASH_BATCH_SIZE;
+    }
+}
+
+BENCHMARK(StakeKernelHash);
+BENCHMARK(StakeKernelHashBatch);
@@ -6,6 +6,9 @@
 #include "chain.h"
 
 #include "main.h"
+#include "memusage.h"
+
+#include <new>
 
 using namespace std;
 
@@ -34,6 +37,50 @@ CBlockHeader CBlockIndex::GetBlockHeader() const
     return block;
 }
 
+/**
+ * CBlockIndexArena implementation
+ */
+CBlockIndexArena blockIndexArena;
+
+CBlockIndexArena::CBlockIndexArena() : nSlabUsed(ENTRIES_PER_SLAB), nEntries(0)
+{
+}
+
+CBlockIndexArena::~CBlockIndexArena()
+{
+    Clear();
+}
+
+CBlockIndex* CBlockIndexArena::Allocate(const CBlockIndex& entry)
+{
+    if (nSlabUsed == ENTRIES_PER_SLAB) {
+        vSlabs.push_back(static_cast<CBlockIndex*>(::operator new(sizeof(CBlockIndex) * ENTRIES_PER_SLAB)));
+        nSlabUsed = 0;
+    }
+    CBlockIndex* pindex = new (vSlabs.back() + nSlabUsed) CBlockIndex(entry);
+    nSlabUsed++;
+    nEntries++;
+    return pindex;
+}
+
+void CBlockIndexArena::Clear()
+{
+    for (size_t i = 0; i < vSlabs.size(); i++) {
+        size_t nUsed = (i + 1 == vSlabs.size()) ? nSlabUsed : ENTRIES_PER_SLAB;
+        for (size_t j = 0; j < nUsed; j++)
+            vSlabs[i][j].~CBlockIndex();
+        ::operator delete(vSlabs[i]);
+    }
+    std::vector<CBlockIndex*>().swap(vSlabs);
+    nSlabUsed = ENTRIES_PER_SLAB;
+    nEntries = 0;
+}
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const
+{
+    return memusage::MallocUsage(sizeof(CBlockIndex) * ENTRIES_PER_SLAB) * vSlabs.size() + memusage::DynamicUsage(vSlabs);
+}
+
 /**
  * CChain implementation
  */
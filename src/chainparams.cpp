@@ -235,6 +235,7 @@ public:
         nPoSChainId = 22;
         nStakePointerValidityPeriod = 4320; //Stake pointers are valid to stake with for the next 3 day worth of blocks
         nMaxReorgDepth = 100;
+        nPruneAfterHeight = 100000;
         nKernelModifierOffset = 100; //Number blocks before the stake pointer is the kernel modifier from
         nChainStallDuration = 60*60; //Spacing between blocks that will consider the chain as "stalled"
 
@@ -449,6 +450,7 @@ public:
         nStartMasternodePayments = 1420837558; //Fri, 09 Jan 2015 21:05:58 GMT
 
         nStakePointerValidityPeriod = 3000;
+        nPruneAfterHeight = 1000;
     }
     const Checkpoints::CCheckpointData& Checkpoints() const 
     {
@@ -540,6 +542,7 @@ public:
         nPoSChainId = 22;
         nStakePointerValidityPeriod = 10080; // Valid for 7 days, to make sure they are valid after downtime
         nMaxReorgDepth = 100;
+        nPruneAfterHeight = 1000;
         nKernelModifierOffset = 10;
         nChainStallDuration = 60*60;
 
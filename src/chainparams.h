@@ -108,6 +108,8 @@ public:
     int PoSStartHeight() const { return nBlockPoSStart; }
     int ValidStakePointerDuration() const { return nStakePointerValidityPeriod; }
     int MaxReorganizationDepth() const { return nMaxReorgDepth; }
+    //! Height below which -prune never deletes block files
+    int PruneAfterHeight() const { return nPruneAfterHeight; }
     int KernelModifierOffset() const { return nKernelModifierOffset; }
     int ChainStallDuration() const { return nChainStallDuration; }
     /* Return start height of auxpow and the retarget interval change.  */
@@ -160,6 +162,7 @@ protected:
     int nBlockPoSStart;
     int nStakePointerValidityPeriod;
     int nMaxReorgDepth;
+    int nPruneAfterHeight;
     int nKernelModifierOffset;
     int nChainStallDuration;
 };
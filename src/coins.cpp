@@ -6,6 +6,8 @@
 
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
+#include "version.h"
 
 #include <assert.h>
 
@@ -41,10 +43,90 @@ bool CCoins::Spend(uint32_t nPos)
     return true;
 }
 
+size_t CCoinsCacheEntry::SetBaseUnspent()
+{
+    if ((flags & (DIRTY | FRESH)) != 0)
+        return 0;
+    vBaseUnspent.resize(coins.vout.size());
+    for (unsigned int i = 0; i < coins.vout.size(); i++)
+        vBaseUnspent[i] = !coins.vout[i].IsNull();
+    return memusage::DynamicUsage(vBaseUnspent);
+}
+
+namespace {
+
+/** The output as it is hashed into the MuHash of the set */
+CDataStream SerializeCoinsStatsOutput(const uint256 &txid, uint32_t n, const CCoins &coins)
+{
+    CDataStream ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << txid << n << (uint32_t)(coins.nHeight * 2 + (coins.fBlockReward ? 1 : 0)) << coins.vout[n];
+    return ss;
+}
+
+}
+
+void CCoinsStats::AddOutput(const uint256 &txid, uint32_t n, const CCoins &coins)
+{
+    CDataStream ss = SerializeCoinsStatsOutput(txid, n, coins);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    nTransactionOutputs++;
+    nSerializedSize += ss.size();
+    nTotalAmount += coins.vout[n].nValue;
+}
+
+void CCoinsStats::RemoveOutput(const uint256 &txid, uint32_t n, const CCoins &coins)
+{
+    CDataStream ss = SerializeCoinsStatsOutput(txid, n, coins);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+    nTransactionOutputs--;
+    nSerializedSize -= ss.size();
+    nTotalAmount -= coins.vout[n].nValue;
+}
+
+void CCoinsStats::AddCoins(const uint256 &txid, const CCoins &coins)
+{
+    if (coins.IsPruned())
+        return;
+    nTransactions++;
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            AddOutput(txid, i, coins);
+    }
+}
+
+void CCoinsStats::RemoveCoins(const uint256 &txid, const CCoins &coins)
+{
+    if (coins.IsPruned())
+        return;
+    nTransactions--;
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            RemoveOutput(txid, i, coins);
+    }
+}
+
+CCoinsStats& CCoinsStats::operator+=(const CCoinsStats &delta)
+{
+    nTransactions += delta.nTransactions;
+    nTransactionOutputs += delta.nTransactionOutputs;
+    nSerializedSize += delta.nSerializedSize;
+    nTotalAmount += delta.nTotalAmount;
+    muhash *= delta.muhash;
+    return *this;
+}
+
+uint256 CCoinsStats::GetHash() const
+{
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
 bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta) { return false; }
+bool CCoinsView::BatchWriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta) { return BatchWrite(mapCoins, hashBlock, statsDelta); }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
 
 
@@ -53,7 +135,8 @@ bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { retu
 bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta) { return base->BatchWrite(mapCoins, hashBlock, statsDelta); }
+bool CCoinsViewBacked::BatchWriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta) { return base->BatchWriteInBackground(mapCoins, hashBlock, statsDelta); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
@@ -112,6 +195,7 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     } else {
         cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
+    cachedCoinsUsage += ret.first->second.SetBaseUnspent();
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
@@ -154,7 +238,7 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, const CCoinsStats &statsDeltaIn) {
     assert(!hasModifier);
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
@@ -180,6 +264,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    cachedCoinsUsage += itUs->second.SetBaseUnspent();
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
@@ -191,16 +276,93 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         mapCoins.erase(itOld);
     }
     hashBlock = hashBlockIn;
+    statsDelta += statsDeltaIn;
+    return true;
+}
+
+bool CCoinsViewCache::GetStats(CCoinsStats &stats) const {
+    if (!base->GetStats(stats))
+        return false;
+    stats += statsDelta;
+    stats.hashBlock = GetBestBlock();
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, statsDelta);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    statsDelta = CCoinsStats();
     return fOk;
 }
 
+bool CCoinsViewCache::Sync() {
+    assert(!hasModifier);
+    CCoinsMap mapDirty;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        CCoinsCacheEntry& entry = it->second;
+        if (!(entry.flags & CCoinsCacheEntry::DIRTY)) {
+            it++;
+            continue;
+        }
+        bool fFresh = entry.flags & CCoinsCacheEntry::FRESH;
+        if (!fFresh || !entry.coins.IsPruned())
+            mapDirty[it->first] = entry;
+        if (entry.coins.IsPruned()) {
+            // Nothing left to read, the base knows it is gone
+            cachedCoinsUsage -= entry.coins.DynamicMemoryUsage() + memusage::DynamicUsage(entry.vBaseUnspent);
+            cacheCoins.erase(it++);
+        } else {
+            // The base has this version now
+            cachedCoinsUsage -= memusage::DynamicUsage(entry.vBaseUnspent);
+            std::vector<bool>().swap(entry.vBaseUnspent);
+            entry.flags = 0;
+            it++;
+        }
+    }
+    bool fOk = base->BatchWriteInBackground(mapDirty, hashBlock, statsDelta);
+    statsDelta = CCoinsStats();
+    return fOk;
+}
+
+void CCoinsViewCache::Trim(size_t nMaxUsage) {
+    assert(!hasModifier);
+    size_t nUsage = DynamicMemoryUsage();
+    if (nUsage <= nMaxUsage)
+        return;
+
+    // Find the height up to which unmodified entries have to go, pruned ones count as the oldest
+    const size_t nEntryUsage = memusage::MallocUsage(sizeof(CCoinsMap::value_type));
+    std::map<int, size_t> mapHeightUsage;
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            continue;
+        int nHeight = it->second.coins.IsPruned() ? -1 : it->second.coins.nHeight;
+        mapHeightUsage[nHeight] += it->second.coins.DynamicMemoryUsage() + nEntryUsage;
+    }
+    if (mapHeightUsage.empty())
+        return;
+    int nMaxHeight = mapHeightUsage.begin()->first;
+    size_t nFreed = 0;
+    for (std::map<int, size_t>::const_iterator it = mapHeightUsage.begin(); it != mapHeightUsage.end(); it++) {
+        nMaxHeight = it->first;
+        nFreed += it->second;
+        if (nUsage - nFreed <= nMaxUsage)
+            break;
+    }
+
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        const CCoinsCacheEntry& entry = it->second;
+        int nHeight = entry.coins.IsPruned() ? -1 : entry.coins.nHeight;
+        if (!(entry.flags & CCoinsCacheEntry::DIRTY) && nHeight <= nMaxHeight) {
+            cachedCoinsUsage -= entry.coins.DynamicMemoryUsage() + memusage::DynamicUsage(entry.vBaseUnspent);
+            cacheCoins.erase(it++);
+        } else {
+            it++;
+        }
+    }
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -8,6 +8,7 @@
 
 #include "compressor.h"
 #include "core_memusage.h"
+#include "crypto/muhash.h"
 #include "memusage.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -286,6 +287,9 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    //! Which outputs were unspent in the parent view before this entry was first modified. Only
+    //! kept for entries that are DIRTY but not FRESH, it lets the parent write just the outputs that changed.
+    std::vector<bool> vBaseUnspent;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -293,21 +297,65 @@ struct CCoinsCacheEntry
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    //! Remember the unspent outputs of the parent's version before the first modification
+    size_t SetBaseUnspent();
 };
 
 typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
 
+/**
+ * Statistics about the unspent transaction output set, kept up to date as
+ * outputs are added and removed. The same structure holds the change a cache
+ * makes to its base, where the counters wrap around if more is removed than
+ * added.
+ *
+ * Every unspent output is hashed as txid, VOUT index, nHeight * 2 + fBlockReward
+ * and the output itself into a MuHash3072, which doesn't depend on the order
+ * the outputs were added in.
+ */
 struct CCoinsStats
 {
     int nHeight;
     uint256 hashBlock;
     uint64_t nTransactions;
     uint64_t nTransactionOutputs;
+    //! Size of the unspent outputs as they are hashed
     uint64_t nSerializedSize;
-    uint256 hashSerialized;
     CAmount nTotalAmount;
+    MuHash3072 muhash;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    //! Count unspent output n of coins, coins being the transaction while the output is unspent
+    void AddOutput(const uint256 &txid, uint32_t n, const CCoins &coins);
+    void RemoveOutput(const uint256 &txid, uint32_t n, const CCoins &coins);
+
+    //! Count every unspent output of coins, and the transaction if any are left
+    void AddCoins(const uint256 &txid, const CCoins &coins);
+    void RemoveCoins(const uint256 &txid, const CCoins &coins);
+
+    //! Apply the change made by a cache
+    CCoinsStats& operator+=(const CCoinsStats &delta);
+
+    //! The MuHash of the unspent outputs
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        unsigned char state[MuHash3072::STATE_SIZE];
+        if (!ser_action.ForRead())
+            muhash.GetState(state);
+        READWRITE(FLATDATA(state));
+        if (ser_action.ForRead())
+            muhash.SetState(state);
+    }
 };
 
 
@@ -326,10 +374,15 @@ public:
     virtual uint256 GetBestBlock() const;
 
     //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. statsDelta is the change the
+    //! modification makes to the statistics of the unspent output set.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta);
 
-    //! Calculate statistics about the unspent transaction output set
+    //! Like BatchWrite, but the view may return before the modification is
+    //! stored, as long as reads see it from then on.
+    virtual bool BatchWriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta);
+
+    //! Statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
     //! As we use CCoinsViews polymorphically, have a virtual destructor
@@ -349,7 +402,8 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta);
+    bool BatchWriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta);
     bool GetStats(CCoinsStats &stats) const;
 };
 
@@ -394,6 +448,9 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Change made to the statistics of the base since the last flush. */
+    CCoinsStats statsDelta;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -403,7 +460,15 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta);
+    bool GetStats(CCoinsStats &stats) const;
+
+    /**
+     * The statistics change, to be updated by whoever adds or removes
+     * outputs through ModifyCoins and ModifyNewCoins. It is passed on to
+     * the base together with the coins on Flush.
+     */
+    CCoinsStats& GetStatsDelta() { return statsDelta; }
 
     /**
      * Return a pointer to CCoins in the cache, or NULL if not found. This is
@@ -437,6 +502,20 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush, but
+     * keep the entries, which stay usable as unmodified ones. The base is
+     * written with BatchWriteInBackground.
+     */
+    bool Sync();
+
+    /**
+     * Drop unmodified entries until the cache uses at most nMaxUsage bytes,
+     * the ones of the oldest transactions first, as those are the least
+     * likely to be spent soon.
+     */
+    void Trim(size_t nMaxUsage);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
@@ -91,6 +91,11 @@ typedef u_int SOCKET;
 
 size_t strnlen_int( const char *start, size_t max_len);
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+// The socket handler can wait on epoll instead of select(), see -socketevents
+#define USE_EPOLL 1
+#endif
+
 bool static inline IsSelectableSocket(SOCKET s) {
 #ifdef WIN32
     return true;
@@ -0,0 +1,168 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace
+{
+const int LIMB_BYTES = Num3072::LIMB_SIZE / 8;
+const Num3072::limb_t LIMB_MAX = ~(Num3072::limb_t)0;
+}
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = 0;
+        for (int j = LIMB_BYTES - 1; j >= 0; --j)
+            limbs[i] = (limbs[i] << 8) | data[i * LIMB_BYTES + j];
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i)
+        limbs[i] = 0;
+}
+
+void Num3072::ToBytes(unsigned char data[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        for (int j = 0; j < LIMB_BYTES; ++j)
+            data[i * LIMB_BYTES + j] = (unsigned char)(limbs[i] >> (8 * j));
+    }
+}
+
+bool Num3072::IsOverflow() const
+{
+    // Only numbers from the prime up to 2^3072 - 1 have all the upper limbs set
+    if (limbs[0] <= LIMB_MAX - MAX_PRIME_DIFF)
+        return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != LIMB_MAX)
+            return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting the prime is adding MAX_PRIME_DIFF and dropping bit 3072
+    limb_t carry = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS && carry; ++i) {
+        limbs[i] += carry;
+        carry = limbs[i] < carry;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    limb_t product[2 * LIMBS];
+    memset(product, 0, sizeof(product));
+    for (int i = 0; i < LIMBS; ++i) {
+        double_limb_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            carry += (double_limb_t)limbs[i] * a.limbs[j] + product[i + j];
+            product[i + j] = (limb_t)carry;
+            carry >>= LIMB_SIZE;
+        }
+        product[i + LIMBS] = (limb_t)carry;
+    }
+
+    // 2^3072 is MAX_PRIME_DIFF modulo the prime, so the upper half folds onto the lower one
+    double_limb_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        carry += (double_limb_t)product[LIMBS + i] * MAX_PRIME_DIFF + product[i];
+        limbs[i] = (limb_t)carry;
+        carry >>= LIMB_SIZE;
+    }
+    while (carry) {
+        double_limb_t fold = carry * MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && fold; ++i) {
+            fold += limbs[i];
+            limbs[i] = (limb_t)fold;
+            fold >>= LIMB_SIZE;
+        }
+        carry = fold;
+    }
+
+    if (IsOverflow())
+        FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat: a^(p - 2), where every bit of p - 2 above the lowest limb is set
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        limb_t exponent = i == 0 ? LIMB_MAX - MAX_PRIME_DIFF - 1 : LIMB_MAX;
+        for (int bit = LIMB_SIZE - 1; bit >= 0; --bit) {
+            result.Multiply(result);
+            if ((exponent >> bit) & 1)
+                result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    // Stretch the SHA256 of the element to 3072 bits by hashing it with a counter
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    for (uint32_t i = 0; i < Num3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; ++i) {
+        unsigned char counter[4];
+        WriteLE32(counter, i);
+        CSHA256().Write(key, sizeof(key)).Write(counter, sizeof(counter)).Finalize(bytes + i * CSHA256::OUTPUT_SIZE);
+    }
+    return Num3072(bytes);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE]) const
+{
+    Num3072 result = numerator;
+    result.Multiply(denominator.GetInverse());
+
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    result.ToBytes(bytes);
+    CSHA256().Write(bytes, sizeof(bytes)).Finalize(hash);
+}
+
+void MuHash3072::GetState(unsigned char state[STATE_SIZE]) const
+{
+    numerator.ToBytes(state);
+    denominator.ToBytes(state + Num3072::BYTE_SIZE);
+}
+
+void MuHash3072::SetState(const unsigned char state[STATE_SIZE])
+{
+    numerator = Num3072(state);
+    denominator = Num3072(state + Num3072::BYTE_SIZE);
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717. */
+class Num3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static const int LIMBS = 48;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static const int LIMBS = 96;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const size_t BYTE_SIZE = 384;
+    //! 2^3072 minus the prime
+    static const limb_t MAX_PRIME_DIFF = 1103717;
+
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    //! Read a little endian number, which may be up to 2^3072 - 1
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    void SetToOne();
+    //! Multiply by a modulo the prime
+    void Multiply(const Num3072& a);
+    //! The number that multiplies with this one to 1
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char data[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * Hash of a set of byte strings that can be updated as elements are added and
+ * removed, in any order. Every element is hashed onto a number modulo a 3072
+ * bit prime; the set hash is the product of the numbers of its elements.
+ * Removals are multiplied into a separate denominator, so the expensive
+ * division only happens in Finalize().
+ *
+ * Sets can be combined with *=, which gives the hash of the union as long as
+ * the removals of one only refer to elements in the other.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    static const size_t STATE_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+    MuHash3072& operator*=(const MuHash3072& mul);
+
+    void Finalize(unsigned char hash[OUTPUT_SIZE]) const;
+
+    //! Numerator and denominator, to store the hash without finalizing it
+    void GetState(unsigned char state[STATE_SIZE]) const;
+    void SetState(const unsigned char state[STATE_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -6,8 +6,38 @@
 
 #include "crypto/common.h"
 
+#include <algorithm>
 #include <string.h>
 
+#if (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && !defined(BUILD_BITCOIN_INTERNAL)
+#if defined(ENABLE_SSE41) || defined(ENABLE_AVX2) || defined(ENABLE_SHANI)
+#include <cpuid.h>
+#define USE_SHA256_CPUID 1
+#endif
+#endif
+
+// The vectorized implementations live in their own files, built with the instruction sets they need
+#if defined(USE_SHA256_CPUID) && defined(ENABLE_SSE41)
+namespace sha256_sse41
+{
+void Transform_4way(uint32_t* s, const unsigned char* chunks);
+}
+#endif
+
+#if defined(USE_SHA256_CPUID) && defined(ENABLE_AVX2)
+namespace sha256_avx2
+{
+void Transform_8way(uint32_t* s, const unsigned char* chunks);
+}
+#endif
+
+#if defined(USE_SHA256_CPUID) && defined(ENABLE_SHANI)
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -127,6 +157,65 @@ void Transform(uint32_t* s, const unsigned char* chunk)
     s[7] += h;
 }
 
+/** Perform a number of SHA-256 transformations on consecutive 64-byte chunks. */
+void TransformBlocks(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    while (blocks--) {
+        Transform(s, chunk);
+        chunk += 64;
+    }
+}
+
+typedef void (*TransformType)(uint32_t* s, const unsigned char* chunk, size_t blocks);
+typedef void (*TransformLanesType)(uint32_t* s, const unsigned char* chunks);
+
+//! Transformation of a single stream, replaced by SHA256AutoDetect() with the fastest one available
+TransformType TransformStream = TransformBlocks;
+//! Transformations of 4 and 8 independent streams at once, NULL if not available
+TransformLanesType Transform4Way = NULL;
+TransformLanesType Transform8Way = NULL;
+
+//! Most streams hashed together by the batch functions
+static const size_t MAX_LANES = 8;
+
+/** One transformation for each of lanes streams, s holds their states one after the other */
+void TransformLanes(uint32_t* s, const unsigned char* chunks, size_t lanes)
+{
+    if (Transform8Way) {
+        for (; lanes >= 8; lanes -= 8, s += 64, chunks += 512)
+            Transform8Way(s, chunks);
+    }
+    if (Transform4Way) {
+        for (; lanes >= 4; lanes -= 4, s += 32, chunks += 256)
+            Transform4Way(s, chunks);
+    }
+    for (; lanes > 0; --lanes, s += 8, chunks += 64)
+        TransformStream(s, chunks, 1);
+}
+
+/** Write the SHA-256 state as a big endian hash. */
+void inline Write(unsigned char* hash, const uint32_t* s)
+{
+    for (int i = 0; i < 8; i++)
+        WriteBE32(hash + 4 * i, s[i]);
+}
+
+/** Hash the 32-byte hashes in the states of lanes streams once more, for double SHA-256 */
+void FinalizeDouble(uint32_t* s, size_t lanes, unsigned char* out)
+{
+    unsigned char chunks[64 * MAX_LANES] = {0};
+    for (size_t i = 0; i < lanes; ++i) {
+        unsigned char* chunk = chunks + 64 * i;
+        Write(chunk, s + 8 * i);
+        chunk[32] = 0x80;
+        chunk[62] = 0x01; // 256 bits
+        Initialize(s + 8 * i);
+    }
+    TransformLanes(s, chunks, lanes);
+    for (size_t i = 0; i < lanes; ++i)
+        Write(out + 32 * i, s + 8 * i);
+}
+
 } // namespace sha256
 } // namespace
 
@@ -147,14 +236,15 @@ CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
         memcpy(buf + bufsize, data, 64 - bufsize);
         bytes += 64 - bufsize;
         data += 64 - bufsize;
-        sha256::Transform(s, buf);
+        sha256::TransformStream(s, buf, 1);
         bufsize = 0;
     }
-    while (end >= data + 64) {
+    if (end >= data + 64) {
         // Process full chunks directly from the source.
-        sha256::Transform(s, data);
-        bytes += 64;
-        data += 64;
+        size_t blocks = (end - data) / 64;
+        sha256::TransformStream(s, data, blocks);
+        bytes += 64 * blocks;
+        data += 64 * blocks;
     }
     if (end > data) {
         // Fill the buffer with what remains.
@@ -187,3 +277,125 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void CSHA256::FinalizeDoubleTails(const unsigned char* tails, size_t len, size_t count, unsigned char* hashes) const
+{
+    size_t bufsize = bytes % 64;
+    if (bufsize + len + 9 > 64) {
+        // The tails and the padding do not fit in one last chunk, hash them one by one
+        for (size_t i = 0; i < count; ++i) {
+            unsigned char hash[OUTPUT_SIZE];
+            CSHA256(*this).Write(tails + len * i, len).Finalize(hash);
+            CSHA256().Write(hash, OUTPUT_SIZE).Finalize(hashes + OUTPUT_SIZE * i);
+        }
+        return;
+    }
+
+    unsigned char sizedesc[8];
+    WriteBE64(sizedesc, (bytes + len) << 3);
+    uint32_t states[8 * sha256::MAX_LANES];
+    unsigned char chunks[64 * sha256::MAX_LANES];
+    while (count > 0) {
+        size_t lanes = std::min(count, sha256::MAX_LANES);
+        for (size_t i = 0; i < lanes; ++i) {
+            unsigned char* chunk = chunks + 64 * i;
+            memcpy(states + 8 * i, s, sizeof(s));
+            memcpy(chunk, buf, bufsize);
+            memcpy(chunk + bufsize, tails, len);
+            memset(chunk + bufsize + len, 0, 56 - bufsize - len);
+            chunk[bufsize + len] = 0x80;
+            memcpy(chunk + 56, sizedesc, 8);
+            tails += len;
+        }
+        sha256::TransformLanes(states, chunks, lanes);
+        sha256::FinalizeDouble(states, lanes, hashes);
+        hashes += OUTPUT_SIZE * lanes;
+        count -= lanes;
+    }
+}
+
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks)
+{
+    // Second chunk of each first hash: padding for a 512 bit message
+    static const unsigned char padding[64] = {
+        0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00
+    };
+    uint32_t states[8 * sha256::MAX_LANES];
+    unsigned char chunks[64 * sha256::MAX_LANES];
+    while (blocks > 0) {
+        size_t lanes = std::min(blocks, sha256::MAX_LANES);
+        for (size_t i = 0; i < lanes; ++i) {
+            sha256::Initialize(states + 8 * i);
+            memcpy(chunks + 64 * i, padding, 64);
+        }
+        sha256::TransformLanes(states, input, lanes);
+        sha256::TransformLanes(states, chunks, lanes);
+        sha256::FinalizeDouble(states, lanes, output);
+        input += 64 * lanes;
+        output += 32 * lanes;
+        blocks -= lanes;
+    }
+}
+
+#if defined(USE_SHA256_CPUID)
+namespace
+{
+/** Whether the OS saves the SSE and AVX registers on context switches */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+} // namespace
+#endif
+
+std::string SHA256AutoDetect()
+{
+    sha256::TransformStream = sha256::TransformBlocks;
+    sha256::Transform4Way = NULL;
+    sha256::Transform8Way = NULL;
+    std::string ret = "standard";
+
+#if defined(USE_SHA256_CPUID)
+    uint32_t eax, ebx, ecx, edx;
+    bool fSSE41 = false, fAVX2 = false, fSHANI = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        fSSE41 = (ecx >> 19) & 1;
+        bool fAVX = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabled();
+        if (__get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            fAVX2 = fAVX && ((ebx >> 5) & 1);
+            fSHANI = fSSE41 && ((ebx >> 29) & 1);
+        }
+    }
+    (void)fSSE41; (void)fAVX2; (void)fSHANI;
+
+#if defined(ENABLE_SHANI)
+    if (fSHANI) {
+        // One stream with the SHA instructions beats eight lanes of AVX2, so the lanes are left out
+        sha256::TransformStream = sha256_shani::Transform;
+        fSSE41 = false;
+        fAVX2 = false;
+        ret = "shani(1way)";
+    }
+#endif
+#if defined(ENABLE_SSE41)
+    if (fSSE41) {
+        sha256::Transform4Way = sha256_sse41::Transform_4way;
+        ret += ",sse41(4way)";
+    }
+#endif
+#if defined(ENABLE_AVX2)
+    if (fAVX2) {
+        sha256::Transform8Way = sha256_avx2::Transform_8way;
+        ret += ",avx2(8way)";
+    }
+#endif
+#endif
+
+    return ret;
+}
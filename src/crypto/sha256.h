@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -23,6 +24,22 @@ public:
     CSHA256& Write(const unsigned char* data, size_t len);
     void Finalize(unsigned char hash[OUTPUT_SIZE]);
     CSHA256& Reset();
+
+    /** Double SHA-256 of the data written so far followed by each of count tails of len bytes, into
+     *  count * 32 bytes of hashes. Several tails are hashed at once where the CPU allows it, the hasher
+     *  itself is left as it is.
+     */
+    void FinalizeDoubleTails(const unsigned char* tails, size_t len, size_t count, unsigned char* hashes) const;
 };
 
+/** Select the fastest SHA-256 implementations the CPU supports and return their names.
+ *  Until this is called the portable implementation is used.
+ */
+std::string SHA256AutoDetect();
+
+/** Compute the double SHA-256 of blocks 64-byte inputs, as used for the inner nodes of merkle trees.
+ *  output: blocks * 32 bytes, input: blocks * 64 bytes.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
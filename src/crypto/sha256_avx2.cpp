@@ -0,0 +1,94 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Eight independent SHA-256 transformations at once, one per 32 bit lane of an AVX2 register.
+// This file is built with -mavx -mavx2 and only called when the CPU and OS support it.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace sha256_avx2 {
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+__m256i inline And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+__m256i inline ShR(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+__m256i inline Rot(__m256i x, int n) { return Or(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n)); }
+
+__m256i inline Ch(__m256i x, __m256i y, __m256i z) { return Xor(z, And(x, Xor(y, z))); }
+__m256i inline Maj(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m256i inline Sigma0(__m256i x) { return Xor(Xor(Rot(x, 2), Rot(x, 13)), Rot(x, 22)); }
+__m256i inline Sigma1(__m256i x) { return Xor(Xor(Rot(x, 6), Rot(x, 11)), Rot(x, 25)); }
+__m256i inline sigma0(__m256i x) { return Xor(Xor(Rot(x, 7), Rot(x, 18)), ShR(x, 3)); }
+__m256i inline sigma1(__m256i x) { return Xor(Xor(Rot(x, 17), Rot(x, 19)), ShR(x, 10)); }
+
+/** Word i of the state or chunk of each lane, lanes are stride words apart */
+__m256i inline Gather(const uint32_t* p, int stride)
+{
+    return _mm256_set_epi32(p[7 * stride], p[6 * stride], p[5 * stride], p[4 * stride],
+                            p[3 * stride], p[2 * stride], p[stride], p[0]);
+}
+
+__m256i inline GatherBE(const unsigned char* p)
+{
+    return _mm256_set_epi32(ReadBE32(p + 448), ReadBE32(p + 384), ReadBE32(p + 320), ReadBE32(p + 256),
+                            ReadBE32(p + 192), ReadBE32(p + 128), ReadBE32(p + 64), ReadBE32(p));
+}
+
+} // namespace
+
+/** s holds the 8 word states of 8 lanes one after the other, chunks their 64 byte chunks */
+void Transform_8way(uint32_t* s, const unsigned char* chunks)
+{
+    __m256i a = Gather(s + 0, 8), b = Gather(s + 1, 8), c = Gather(s + 2, 8), d = Gather(s + 3, 8);
+    __m256i e = Gather(s + 4, 8), f = Gather(s + 5, 8), g = Gather(s + 6, 8), h = Gather(s + 7, 8);
+    __m256i w[16];
+
+    for (int i = 0; i < 16; ++i)
+        w[i] = GatherBE(chunks + 4 * i);
+
+    for (int i = 0; i < 64; ++i) {
+        if (i >= 16)
+            w[i & 15] = Add(Add(Add(w[i & 15], sigma1(w[(i + 14) & 15])), w[(i + 9) & 15]), sigma0(w[(i + 1) & 15]));
+        __m256i t1 = Add(Add(Add(Add(h, Sigma1(e)), Ch(e, f, g)), _mm256_set1_epi32(K[i])), w[i & 15]);
+        __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(t1, t2);
+    }
+
+    __m256i out[8] = {a, b, c, d, e, f, g, h};
+    for (int i = 0; i < 8; ++i) {
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, out[i]);
+        for (int j = 0; j < 8; ++j)
+            s[8 * j + i] += lanes[j];
+    }
+}
+
+} // namespace sha256_avx2
+
+#endif
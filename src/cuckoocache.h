@@ -0,0 +1,221 @@
+// Copyright (c) 2016 Jeremy Rubin
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Fixed size cache for elements that are already uniformly distributed hashes,
+ * such as the salted entries of the signature cache.
+ *
+ * Every element has eight candidate slots, picked by the eight hash functions
+ * of Hash. Lookups read at most those eight slots. Inserts take a free slot if
+ * one of the candidates is free and otherwise move existing elements to their
+ * other slots, giving up after log2(size) moves, so inserting never loops over
+ * the table the way evicting from a hash set does.
+ *
+ * Slots become free when contains() is asked to erase them, or when they are
+ * older than the previous generation. A generation ends once roughly 45% of the
+ * table has been filled since the last one.
+ *
+ * contains() may run concurrently with other contains() calls, including ones
+ * that erase, because erasing only sets an atomic flag. insert() and setup()
+ * need exclusive access.
+ */
+namespace CuckooCache
+{
+/** Bit array of atomically updated flags, all set after setup */
+class bit_packed_atomic_flags
+{
+    std::unique_ptr<std::atomic<uint8_t>[]> mem;
+
+public:
+    bit_packed_atomic_flags() = delete;
+
+    explicit bit_packed_atomic_flags(uint32_t size)
+    {
+        size = (size + 7) / 8;
+        mem.reset(new std::atomic<uint8_t>[size]);
+        for (uint32_t i = 0; i < size; ++i)
+            mem[i].store(0xFF);
+    }
+
+    void setup(uint32_t b)
+    {
+        bit_packed_atomic_flags d(b);
+        std::swap(mem, d.mem);
+    }
+
+    inline void bit_set(uint32_t s)
+    {
+        mem[s >> 3].fetch_or(1 << (s & 7), std::memory_order_relaxed);
+    }
+
+    inline void bit_unset(uint32_t s)
+    {
+        mem[s >> 3].fetch_and(~(1 << (s & 7)), std::memory_order_relaxed);
+    }
+
+    inline bool bit_is_set(uint32_t s) const
+    {
+        return (1 << (s & 7)) & mem[s >> 3].load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Hash must provide template <uint8_t n> uint32_t operator()(const Element&) const
+ * for n in 0..7, each returning independent, uniformly distributed bits.
+ */
+template <typename Element, typename Hash>
+class cache
+{
+private:
+    std::vector<Element> table;
+    uint32_t size;
+    //! Set for slots that may be overwritten
+    mutable bit_packed_atomic_flags collection_flags;
+    //! Set for slots written during the current generation
+    std::vector<bool> epoch_flags;
+    //! Inserts left until the generation is checked again
+    uint32_t epoch_heuristic_counter;
+    uint32_t epoch_size;
+    //! Maximum number of elements moved by one insert
+    uint8_t depth_limit;
+    const Hash hash_function;
+
+    inline std::array<uint32_t, 8> compute_hashes(const Element& e) const
+    {
+        // Map each 32 bit hash onto [0, size) without a modulo
+        return {{(uint32_t)(((uint64_t)hash_function.template operator()<0>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<1>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<2>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<3>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<4>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<5>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<6>(e) * (uint64_t)size) >> 32),
+                 (uint32_t)(((uint64_t)hash_function.template operator()<7>(e) * (uint64_t)size) >> 32)}};
+    }
+
+    static inline uint32_t invalid() { return ~(uint32_t)0; }
+
+    inline void allow_erase(uint32_t n) const { collection_flags.bit_set(n); }
+
+    inline void please_keep(uint32_t n) const { collection_flags.bit_unset(n); }
+
+    /** Start a new generation once enough of the table was written in the current one */
+    void epoch_check()
+    {
+        if (epoch_heuristic_counter != 0) {
+            --epoch_heuristic_counter;
+            return;
+        }
+
+        uint32_t epoch_unused_count = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            epoch_unused_count += epoch_flags[i] && !collection_flags.bit_is_set(i);
+
+        if (epoch_unused_count >= epoch_size) {
+            // Everything from the previous generation may go, the current one becomes the previous one
+            for (uint32_t i = 0; i < size; ++i) {
+                if (epoch_flags[i])
+                    epoch_flags[i] = false;
+                else
+                    allow_erase(i);
+            }
+            epoch_heuristic_counter = epoch_size;
+        } else {
+            // Check again after about as many inserts as are missing from a full generation
+            epoch_heuristic_counter = std::max(1u, std::max(epoch_size / 16, epoch_size - std::min(epoch_size, epoch_unused_count)));
+        }
+    }
+
+public:
+    cache() : table(), size(), collection_flags(0), epoch_flags(), epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function()
+    {
+    }
+
+    /** Resize to new_size elements (at least 2) and drop everything. Returns the new size. */
+    uint32_t setup(uint32_t new_size)
+    {
+        size = std::max<uint32_t>(2, new_size);
+        depth_limit = static_cast<uint8_t>(std::log2(static_cast<float>(size)));
+        table.assign(size, Element());
+        collection_flags.setup(size);
+        epoch_flags.assign(size, false);
+        epoch_size = std::max<uint32_t>(1, (45 * size) / 100);
+        epoch_heuristic_counter = epoch_size;
+        return size;
+    }
+
+    /** Resize to as many elements as fit in bytes. Returns the new size in elements. */
+    uint32_t setup_bytes(size_t bytes)
+    {
+        return setup(static_cast<uint32_t>(std::min<size_t>(bytes / sizeof(Element), ~(uint32_t)0 >> 1)));
+    }
+
+    void insert(Element e)
+    {
+        epoch_check();
+        uint32_t last_loc = invalid();
+        bool last_epoch = true;
+        std::array<uint32_t, 8> locs = compute_hashes(e);
+
+        // Refresh an element that is already present
+        for (uint32_t loc : locs) {
+            if (table[loc] == e) {
+                please_keep(loc);
+                epoch_flags[loc] = last_epoch;
+                return;
+            }
+        }
+
+        for (uint8_t depth = 0; depth < depth_limit; ++depth) {
+            for (uint32_t loc : locs) {
+                if (!collection_flags.bit_is_set(loc))
+                    continue;
+                table[loc] = std::move(e);
+                please_keep(loc);
+                epoch_flags[loc] = last_epoch;
+                return;
+            }
+
+            // No free candidate, displace the one after the slot we came from
+            last_loc = locs[(1 + (std::find(locs.begin(), locs.end(), last_loc) - locs.begin())) & 7];
+            std::swap(table[last_loc], e);
+            bool epoch = last_epoch;
+            last_epoch = epoch_flags[last_loc];
+            epoch_flags[last_loc] = epoch;
+
+            locs = compute_hashes(e);
+        }
+        // Out of moves, the element left over in e is dropped
+    }
+
+    /** Whether e is present, optionally allowing its slot to be reused */
+    bool contains(const Element& e, const bool erase) const
+    {
+        std::array<uint32_t, 8> locs = compute_hashes(e);
+        for (uint32_t loc : locs) {
+            if (table[loc] == e) {
+                if (erase)
+                    allow_erase(loc);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+} // namespace CuckooCache
+
+#endif // BITCOIN_CUCKOOCACHE_H
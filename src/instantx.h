@@ -96,6 +96,7 @@ public:
     { }
     uint256 GetHash() const;
     bool SignatureValid() const;
+    std::string GetStrMessage() const;
     bool Sign();
 
     ADD_SERIALIZE_METHODS;
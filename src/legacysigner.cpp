@@ -5,9 +5,13 @@
 
 #include "legacysigner.h"
 #include "main.h"
+#include "checkqueue.h"
 #include "init.h"
 #include "util.h"
 #include "masternodeman.h"
+#include "masternode-budget.h"
+#include "memusage.h"
+#include "random.h"
 #include "script/sign.h"
 #include "instantx.h"
 #include "ui_interface.h"
@@ -17,7 +21,10 @@
 #include <boost/lexical_cast.hpp>
 
 #include <algorithm>
+#include <atomic>
 #include <boost/assign/list_of.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_set.hpp>
 #include <openssl/rand.h>
 
 using namespace std;
@@ -53,6 +60,15 @@ bool CLegacySigner::IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey, int v
             }
         }
     }
+    else if (fHavePruned) {
+        // The collateral may be in a pruned block, but as long as it is unspent the coin database has it
+        LOCK(cs_main);
+        const CCoins* coins = pcoinsTip->AccessCoins(vin.prevout.hash);
+        if (coins && coins->IsAvailable(vin.prevout.n)) {
+            const CTxOut& out = coins->vout[vin.prevout.n];
+            if (out.nValue == value*COIN && out.scriptPubKey == payee2) return true;
+        }
+    }
 
     return false;
 }
@@ -86,14 +102,122 @@ bool CLegacySigner::SignMessage(std::string strMessage, std::string& errorMessag
     return true;
 }
 
-bool CLegacySigner::VerifyMessage(CPubKey pubkey, const vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
+namespace {
+
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ */
+class CLegacySignatureCacheHasher
+{
+public:
+    size_t operator()(const uint256& key) const {
+        return key.GetCheapHash();
+    }
+};
+
+/**
+ * Valid legacy signature cache. Broadcasts and votes arrive from several peers,
+ * are checked again by CheckAndRemove and after loading mncache.dat or
+ * budget-v2.dat, and every check recovers the signing key from the signature.
+ */
+class CLegacySignatureCache
+{
+private:
+    //! Entries are SHA256(nonce || signed hash || key id || signature):
+    uint256 nonce;
+    typedef boost::unordered_set<uint256, CLegacySignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_sigcache;
+    //! Read from -maxlegacysigcachesize on the first insert
+    int64_t nMaxCacheSize;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+public:
+    CLegacySignatureCache() : nMaxCacheSize(-1), nHits(0), nMisses(0)
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const uint256& hash, const CKeyID& keyID, const std::vector<unsigned char>& vchSig)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(keyID.begin(), keyID.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        if (setValid.count(entry)) {
+            nHits++;
+            return true;
+        }
+        nMisses++;
+        return false;
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        if (nMaxCacheSize < 0)
+            nMaxCacheSize = GetArg("-maxlegacysigcachesize", DEFAULT_MAX_LEGACY_SIG_CACHE_SIZE) * ((int64_t) 1 << 20);
+        if (nMaxCacheSize <= 0) return;
+
+        while (memusage::DynamicUsage(setValid) > (size_t)nMaxCacheSize)
+        {
+            map_type::size_type s = GetRand(setValid.bucket_count());
+            map_type::local_iterator it = setValid.begin(s);
+            if (it != setValid.end(s)) {
+                setValid.erase(*it);
+            }
+        }
+
+        setValid.insert(entry);
+    }
+
+    CLegacySignatureCacheStats GetStats()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        CLegacySignatureCacheStats stats;
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        stats.nEntries = setValid.size();
+        stats.nUsage = memusage::DynamicUsage(setValid);
+        return stats;
+    }
+};
+
+CLegacySignatureCache legacySignatureCache;
+
+}
+
+CLegacySignatureCacheStats GetLegacySignatureCacheStats()
+{
+    return legacySignatureCache.GetStats();
+}
+
+static uint256 GetMessageHash(const std::string& strMessage)
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    return ss.GetHash();
+}
+
+bool CLegacySigner::VerifyMessage(CPubKey pubkey, const vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
+{
+    uint256 hashMessage = GetMessageHash(strMessage);
+
+    uint256 entry;
+    legacySignatureCache.ComputeEntry(entry, hashMessage, pubkey.GetID(), vchSig);
+    if (legacySignatureCache.Get(entry))
+        return true;
 
     CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    if (!pubkey2.RecoverCompact(hashMessage, vchSig)) {
         errorMessage = _("Error recovering public key.");
         return false;
     }
@@ -105,9 +229,118 @@ bool CLegacySigner::VerifyMessage(CPubKey pubkey, const vector<unsigned char>& v
         return false;
     }
 
+    legacySignatureCache.Set(entry);
+    return true;
+}
+
+bool CLegacySignatureCheck::operator()()
+{
+    std::string strError;
+    CHashSigner::VerifyHash(GetMessageHash(strMessage), pubkey, vchSig, strError);
+    // invalid signatures are reported when their message is processed
     return true;
 }
 
+static CCheckQueue<CLegacySignatureCheck> legacysigcheckqueue(128);
+
+void ThreadLegacySignatureCheck()
+{
+    RenameThread("crown-sigcheck");
+    legacysigcheckqueue.Thread();
+}
+
+static bool GetMasternodePubKey(const CTxIn& vin, CPubKey& pubkeyRet)
+{
+    CMasternode* pmn = mnodeman.Find(vin);
+    if (pmn == NULL)
+        return false;
+    pubkeyRet = pmn->pubkey2;
+    return true;
+}
+
+static void AddPingChecks(const CMasternodePing& mnp, const CPubKey& pubkey, std::vector<CLegacySignatureCheck>& vChecks)
+{
+    vChecks.push_back(CLegacySignatureCheck(pubkey, mnp.vchSig, mnp.GetStrMessage()));
+    if (mnp.nVersion > 1) {
+        uint256 hash = Hash(mnp.vPrevBlockHash.begin(), mnp.vPrevBlockHash.end());
+        vChecks.push_back(CLegacySignatureCheck(pubkey, mnp.vchSigPrevBlocks, hash.GetHex()));
+    }
+}
+
+// Deserializes a copy of the message, the original is left for ProcessMessage
+static void AddMessageChecks(const std::string& strCommand, CDataStream vRecv, std::vector<CLegacySignatureCheck>& vChecks)
+{
+    CPubKey pubkey;
+
+    if (strCommand == "mnb" || strCommand == "mnb_new") {
+        CMasternodeBroadcast mnb;
+        mnb.lastPing.nVersion = strCommand == "mnb" ? 1 : 2;
+        vRecv >> mnb;
+        vChecks.push_back(CLegacySignatureCheck(mnb.pubkey, mnb.sig, mnb.GetStrMessage()));
+        AddPingChecks(mnb.lastPing, GetMasternodePubKey(mnb.vin, pubkey) ? pubkey : mnb.pubkey2, vChecks);
+    } else if (strCommand == "mnp" || strCommand == "mnp_new") {
+        CMasternodePing mnp;
+        if (strCommand == "mnp")
+            mnp.nVersion = 1;
+        vRecv >> mnp;
+        if (GetMasternodePubKey(mnp.vin, pubkey))
+            AddPingChecks(mnp, pubkey, vChecks);
+    } else if (strCommand == "mnw") {
+        CMasternodePaymentWinner winner;
+        vRecv >> winner;
+        if (GetMasternodePubKey(winner.vinMasternode, pubkey))
+            vChecks.push_back(CLegacySignatureCheck(pubkey, winner.vchSig, winner.GetStrMessage()));
+    } else if (strCommand == "mvote") {
+        CBudgetVote vote;
+        vRecv >> vote;
+        if (GetMasternodePubKey(vote.vin, pubkey))
+            vChecks.push_back(CLegacySignatureCheck(pubkey, vote.vchSig, vote.GetStrMessage()));
+    } else if (strCommand == "fbvote") {
+        BudgetDraftVote vote;
+        vRecv >> vote;
+        if (GetMasternodePubKey(vote.vin, pubkey))
+            vChecks.push_back(CLegacySignatureCheck(pubkey, vote.vchSig, vote.GetStrMessage()));
+    } else if (strCommand == "txlvote") {
+        CConsensusVote vote;
+        vRecv >> vote;
+        if (GetMasternodePubKey(vote.vinMasternode, pubkey))
+            vChecks.push_back(CLegacySignatureCheck(pubkey, vote.vchMasterNodeSignature, vote.GetStrMessage()));
+    }
+}
+
+void PreverifyLegacySignatures(CNode* pfrom)
+{
+    if(fLiteMode || nScriptCheckThreads == 0) return;
+
+    std::vector<CLegacySignatureCheck> vChecks;
+    BOOST_FOREACH(CNetMessage& msg, pfrom->vRecvMsg) {
+        if (!msg.complete())
+            break;
+        if (msg.fPreverified)
+            continue;
+        msg.fPreverified = true;
+
+        try {
+            AddMessageChecks(msg.hdr.GetCommand(), msg.vRecv, vChecks);
+        } catch (const std::exception&) {
+            // malformed messages are rejected by ProcessMessage
+        }
+    }
+
+    // a single signature is checked just as fast when its message is processed
+    if (vChecks.size() < 2) return;
+
+    // the message handler and the message workers share the check queue
+    static CCriticalSection cs_legacysigcheckqueue;
+    LOCK(cs_legacysigcheckqueue);
+    int64_t nTimeStart = GetTimeMicros();
+    CCheckQueueControl<CLegacySignatureCheck> control(&legacysigcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+    LogPrint("bench", "PreverifyLegacySignatures: %u signatures from peer=%d in %.2fms\n",
+             vChecks.size(), pfrom->id, (GetTimeMicros() - nTimeStart) * 0.001);
+}
+
 //TODO: Rename/move to core
 void ThreadCheckLegacySigner()
 {
@@ -181,6 +414,11 @@ bool CHashSigner::VerifyHash(const uint256& hash, const CPubKey& pubkey, const s
 
 bool CHashSigner::VerifyHash(const uint256& hash, const CKeyID& keyID, const std::vector<unsigned char>& vchSig, std::string& strErrorRet)
 {
+    uint256 entry;
+    legacySignatureCache.ComputeEntry(entry, hash, keyID, vchSig);
+    if (legacySignatureCache.Get(entry))
+        return true;
+
     CPubKey pubkeyFromSig;
     if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
         strErrorRet = "Error recovering public key.";
@@ -194,6 +432,7 @@ bool CHashSigner::VerifyHash(const uint256& hash, const CKeyID& keyID, const std
         return false;
     }
 
+    legacySignatureCache.Set(entry);
     return true;
 }
 
@@ -28,6 +28,9 @@ class CActiveMasternode;
 #define MASTERNODE_REJECTED                    0
 #define MASTERNODE_RESET                       -1
 
+// limit the legacy signature cache to this many MiB
+static const unsigned int DEFAULT_MAX_LEGACY_SIG_CACHE_SIZE = 8;
+
 extern CLegacySigner legacySigner;
 extern std::string strMasterNodePrivKey;
 extern CActiveMasternode activeMasternode;
@@ -68,6 +71,48 @@ public:
     static bool VerifyHash(const uint256& hash, const CKeyID& keyID, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
 };
 
+/** A message signature check that can be run on the legacy signature worker pool.
+ *  Valid signatures end up in the legacy signature cache instead of being returned,
+ *  so one bad signature doesn't stop the rest of the batch from being checked.
+ */
+class CLegacySignatureCheck
+{
+private:
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    std::string strMessage;
+
+public:
+    CLegacySignatureCheck() {}
+    CLegacySignatureCheck(const CPubKey& pubkeyIn, const std::vector<unsigned char>& vchSigIn, const std::string& strMessageIn) :
+        pubkey(pubkeyIn), vchSig(vchSigIn), strMessage(strMessageIn) {}
+
+    bool operator()();
+
+    void swap(CLegacySignatureCheck& check) {
+        std::swap(pubkey, check.pubkey);
+        vchSig.swap(check.vchSig);
+        strMessage.swap(check.strMessage);
+    }
+};
+
+/** Check the signatures of the masternode, budget and InstantX messages waiting in
+ *  pfrom's receive queue in one batch, ahead of processing them in order.
+ *  Caller must hold pfrom->cs_vRecvMsg.
+ */
+void PreverifyLegacySignatures(CNode* pfrom);
+
+/** Statistics of the cache of valid signatures used by CLegacySigner and CHashSigner */
+struct CLegacySignatureCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    size_t nEntries;
+    size_t nUsage;
+};
+
+CLegacySignatureCacheStats GetLegacySignatureCacheStats();
+void ThreadLegacySignatureCheck();
 void ThreadCheckLegacySigner();
 
 #endif
@@ -171,6 +171,12 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterator for reading a short range of keys, which fills the block cache like Read() does
+    leveldb::Iterator* NewReadIterator() const
+    {
+        return pdb->NewIterator(readoptions);
+    }
 };
 
 class CDBTransaction {
@@ -16,6 +16,7 @@
 #include "checkqueue.h"
 #include "init.h"
 #include "instantx.h"
+#include "legacysigner.h"
 #include "masternodeman.h"
 #include "masternode-payments.h"
 #include "masternode-budget.h"
@@ -33,12 +34,15 @@
 #include "platform/specialtx.h"
 #include "platform/platform-db.h"
 
+#include <deque>
+#include <list>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <mn-pos/blockwitness.h>
 #include <mn-pos/prooftracker.h>
@@ -71,10 +75,14 @@ bool fImporting = false;
 bool fReindex = false;
 bool fPlatformReindex = false;
 bool fVerifying = false;
+unsigned int nReorgCacheBlocks = DEFAULT_REORG_CACHE_BLOCKS;
 bool fTxIndex = true;
+bool fHavePruned = false;
+bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 size_t nCoinCacheUsage = 5000 * 300;
+uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
 int nLastStakeAttempt = 0;
 
@@ -181,6 +189,165 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Global flag to indicate we should check to see if there are block/undo files that should be deleted. Set on startup or if we allocate more file space when we're in prune mode. */
+    bool fCheckForPruning = false;
+
+    /**
+     * Bodies and undo data of the most recently connected blocks, oldest first, so that
+     * disconnecting them in a shallow reorg doesn't read the blk and rev files again.
+     * Entries are keyed by block hash and their content never changes, so they are left
+     * in place when a block is disconnected and only pushed out by newer blocks.
+     * Left empty during the initial block download. Protected by cs_main.
+     */
+    class CReorgCache
+    {
+    private:
+        struct CEntry
+        {
+            uint256 hash;
+            CBlock block;
+            CBlockUndo undo;
+            size_t nSize;
+        };
+
+        std::deque<CEntry> entries;
+        size_t nBytes;
+
+        std::deque<CEntry>::iterator Find(const uint256& hash)
+        {
+            // Reorgs almost always disconnect the newest entries
+            for (std::deque<CEntry>::iterator it = entries.end(); it != entries.begin(); ) {
+                --it;
+                if (it->hash == hash)
+                    return it;
+            }
+            return entries.end();
+        }
+
+    public:
+        CReorgCacheStats stats;
+
+        CReorgCache() : nBytes(0)
+        {
+            stats.nBlockHits = stats.nBlockMisses = stats.nUndoHits = stats.nUndoMisses = 0;
+        }
+
+        void Add(const CBlockIndex* pindex, const CBlock& block, const CBlockUndo& undo)
+        {
+            std::deque<CEntry>::iterator it = Find(pindex->GetBlockHash());
+            if (it != entries.end()) {
+                nBytes -= it->nSize;
+                entries.erase(it);
+            }
+            if (nReorgCacheBlocks > 0) {
+                entries.push_back(CEntry());
+                CEntry& entry = entries.back();
+                entry.hash = pindex->GetBlockHash();
+                entry.block = block;
+                entry.undo = undo;
+                entry.nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + ::GetSerializeSize(undo, SER_DISK, CLIENT_VERSION);
+                nBytes += entry.nSize;
+            }
+            while (entries.size() > nReorgCacheBlocks) {
+                nBytes -= entries.front().nSize;
+                entries.pop_front();
+            }
+        }
+
+        bool GetBlock(const CBlockIndex* pindex, CBlock& block)
+        {
+            std::deque<CEntry>::iterator it = Find(pindex->GetBlockHash());
+            if (it == entries.end()) {
+                stats.nBlockMisses++;
+                return false;
+            }
+            stats.nBlockHits++;
+            block = it->block;
+            return true;
+        }
+
+        //! The cached undo data of a block, valid until the next Add or Clear, or NULL
+        const CBlockUndo* GetUndo(const CBlockIndex* pindex)
+        {
+            std::deque<CEntry>::iterator it = Find(pindex->GetBlockHash());
+            if (it == entries.end()) {
+                stats.nUndoMisses++;
+                return NULL;
+            }
+            stats.nUndoHits++;
+            return &it->undo;
+        }
+
+        void Clear()
+        {
+            entries.clear();
+            nBytes = 0;
+        }
+
+        unsigned int Size() const { return entries.size(); }
+        size_t Bytes() const { return nBytes; }
+    };
+    CReorgCache reorgCache;
+
+    /**
+     * Serialized blocks recently sent to peers, most recently used first, so that
+     * a new tip asked for by every peer is only read from disk once.
+     * Has its own lock, it is used without cs_main.
+     */
+    class CRawBlockCache
+    {
+    private:
+        typedef std::list<std::pair<uint256, boost::shared_ptr<const CDataStream> > > EntryList;
+
+        CCriticalSection cs;
+        EntryList entries;
+        std::map<uint256, EntryList::iterator> mapEntries;
+        size_t nBytes;
+
+    public:
+        CRawBlockCache() : nBytes(0) {}
+
+        boost::shared_ptr<const CDataStream> Get(const uint256& hash)
+        {
+            LOCK(cs);
+            std::map<uint256, EntryList::iterator>::iterator it = mapEntries.find(hash);
+            if (it == mapEntries.end())
+                return boost::shared_ptr<const CDataStream>();
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->second;
+        }
+
+        void Add(const uint256& hash, const boost::shared_ptr<const CDataStream>& pblock)
+        {
+            LOCK(cs);
+            if (mapEntries.count(hash))
+                return;
+            entries.push_front(std::make_pair(hash, pblock));
+            mapEntries[hash] = entries.begin();
+            nBytes += pblock->size();
+            while (nBytes > RAW_BLOCK_CACHE_SIZE && entries.size() > 1) {
+                nBytes -= entries.back().second->size();
+                mapEntries.erase(entries.back().first);
+                entries.pop_back();
+            }
+        }
+    };
+    CRawBlockCache rawBlockCache;
+
+    /** The serialized block from the raw block cache or disk, NULL if it can't be read */
+    boost::shared_ptr<const CDataStream> GetRawBlock(const uint256& hash, const CDiskBlockPos& pos)
+    {
+        boost::shared_ptr<const CDataStream> pblock = rawBlockCache.Get(hash);
+        if (!pblock) {
+            boost::shared_ptr<CDataStream> pblockNew(new CDataStream(SER_NETWORK, PROTOCOL_VERSION));
+            if (!ReadRawBlockFromDisk(*pblockNew, pos, hash))
+                return boost::shared_ptr<const CDataStream>();
+            pblock = pblockNew;
+            rawBlockCache.Add(hash, pblock);
+        }
+        return pblock;
+    }
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -511,7 +678,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                 // We consider the chain that this peer is on invalid.
                 return;
             }
-            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            if (pindex->nStatus & BLOCK_HAVE_DATA || chainActive.Contains(pindex)) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
@@ -974,12 +1141,12 @@ int GetIXConfirmations(uint256 nTXHash)
 }
 
 
-bool CheckTransaction(const CTransaction& tx, CValidationState &state)
+bool CheckTransaction(const CTransaction& tx, CValidationState &state, bool fCheckSpork)
 {
     // check version 3 transaction types
     if (tx.nVersion >= 3)
     {
-        if (!IsSporkActive(SPORK_17_NFT_TX))
+        if (fCheckSpork && !IsSporkActive(SPORK_17_NFT_TX))
         {
             return state.DoS(100, false, REJECT_INVALID, "nft-tx-spork-off");
         }
@@ -1486,6 +1653,13 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState &state, const CTransact
     return true;
 }
 
+/** Whether block file nFile was deleted by pruning */
+static bool IsBlockFilePruned(int nFile)
+{
+    LOCK(cs_LastBlockFile);
+    return fHavePruned && nFile >= 0 && (unsigned int)nFile < vinfoBlockFile.size() && vinfoBlockFile[nFile].nSize == 0;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256& hashBlock, bool fAllowSlow)
 {
@@ -1502,6 +1676,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256& hashBlock
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
+                // The index keeps pointing into block files that were pruned since
+                if (IsBlockFilePruned(postx.nFile))
+                    return false;
                 CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
                 if (file.IsNull())
                     return error("%s: OpenBlockFile failed", __func__);
@@ -1533,7 +1710,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256& hashBlock
         }
     }
 
-    if (pindexSlow) {
+    if (pindexSlow && (pindexSlow->nStatus & BLOCK_HAVE_DATA)) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow)) {
             BOOST_FOREACH(const CTransaction &tx, block.vtx) {
@@ -1549,6 +1726,25 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256& hashBlock
     return false;
 }
 
+/** Whether the transaction pays the fee of a budget proposal or finalized budget, see IsBudgetCollateralValid */
+static bool IsBudgetFeeTransaction(const CTransaction& tx)
+{
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        const CScript& script = txout.scriptPubKey;
+        if (txout.nValue >= BUDGET_FEE_TX && script.size() == 34 && script[0] == OP_RETURN && script[1] == 32)
+            return true;
+    }
+    return false;
+}
+
+bool GetBudgetFeeTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock)
+{
+    // Confirmed fee transactions are kept in the block tree database, their blocks may be pruned
+    if (pblocktree->ReadBudgetFeeTx(hash, txOut, hashBlock))
+        return true;
+    return GetTransaction(hash, txOut, hashBlock, true);
+}
+
 
 
 
@@ -1660,6 +1856,8 @@ static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos, bool fProofOfS
 template<typename T>
 static bool ReadBlockOrHeader(T& block, const CBlockIndex* pindex)
 {
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : block %s at height %d is not stored (pruned?)", pindex->GetBlockHash().ToString(), pindex->nHeight);
     if (!ReadBlockOrHeader(block, pindex->GetBlockPos(), pindex->IsProofOfStake()))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
@@ -1682,6 +1880,36 @@ bool ReadBlockHeaderFromDisk(CBlockHeader& block, const CBlockIndex* pindex)
     return ReadBlockOrHeader(block, pindex);
 }
 
+bool ReadRawBlockFromDisk(CDataStream& ssBlock, const CDiskBlockPos& pos, const uint256& hash)
+{
+    // The block is preceded by the network magic and its size
+    static const unsigned int nHeaderSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return error("%s : invalid position %u in file %d", __func__, pos.nPos, pos.nFile);
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - nHeaderSize), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE))
+            return error("%s : block magic mismatch", __func__);
+        if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+            return error("%s : invalid block size %u", __func__, nSize);
+        ssBlock.resize(nSize);
+        filein.read(&ssBlock[0], nSize);
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // The block hash is the hash of the 80 byte header at the start
+    if (Hash(ssBlock.begin(), ssBlock.begin() + 80) != hash)
+        return error("%s : block header doesn't match %s", __func__, hash.ToString());
+    return true;
+}
+
 double ConvertBitsToDouble(unsigned int nBits)
 {
     int nShift = (nBits >> 24) & 0xff;
@@ -1933,16 +2161,20 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
                 assert(false);
             // mark an outpoint spent, and construct undo information
             txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
+            inputs.GetStatsDelta().RemoveOutput(txin.prevout.hash, nPos, *coins);
             coins->Spend(nPos);
             if (coins->vout.size() == 0) {
                 CTxInUndo& undo = txundo.vprevout.back();
                 undo.nHeight = coins->nHeight;
                 undo.fBlockReward = coins->fBlockReward; //todo - make sure undo is correct
                 undo.nVersion = coins->nVersion;
+                inputs.GetStatsDelta().nTransactions--;
             }
         }
         // add outputs
-        inputs.ModifyNewCoins(tx.GetHash())->FromTx(tx, nHeight);
+        CCoinsModifier coins = inputs.ModifyNewCoins(tx.GetHash());
+        coins->FromTx(tx, nHeight);
+        inputs.GetStatsDelta().AddCoins(tx.GetHash(), *coins);
     }
     else {
         // add outputs for coinbase tx
@@ -1950,7 +2182,10 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
         // lookup to be sure the coins do not already exist otherwise we do not
         // know whether to mark them fresh or not.  We want the duplicate coinbases
         // before BIP30 to still be properly overwritten.
-        inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+        CCoinsModifier coins = inputs.ModifyCoins(tx.GetHash());
+        inputs.GetStatsDelta().RemoveCoins(tx.GetHash(), *coins);
+        coins->FromTx(tx, nHeight);
+        inputs.GetStatsDelta().AddCoins(tx.GetHash(), *coins);
     }
 }
 
@@ -2073,12 +2308,17 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
     bool fClean = true;
 
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull())
-        return error("DisconnectBlock() : no undo data available");
-    if (!blockUndo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
-        return error("DisconnectBlock() : failure reading undo data");
+    CBlockUndo blockUndoDisk;
+    const CBlockUndo* pblockUndo = reorgCache.GetUndo(pindex);
+    if (!pblockUndo) {
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull())
+            return error("DisconnectBlock() : no undo data available");
+        if (!blockUndoDisk.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
+            return error("DisconnectBlock() : failure reading undo data");
+        pblockUndo = &blockUndoDisk;
+    }
+    const CBlockUndo& blockUndo = *pblockUndo;
 
     int nSizeCheck = blockUndo.vtxundo.size() + 1;
     if (block.IsProofOfStake())
@@ -2102,6 +2342,7 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         {
         CCoins outsEmpty;
         CCoinsModifier outs = view.ModifyCoins(hash);
+        view.GetStatsDelta().RemoveCoins(hash, *outs);
         outs->ClearUnspendable();
 
         CCoins outsBlock(tx, pindex->nHeight);
@@ -2133,6 +2374,7 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                     // undo data contains height: this is the last output of the prevout tx being spent
                     if (!coins->IsPruned())
                         fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
+                    view.GetStatsDelta().RemoveCoins(out.hash, *coins);
                     coins->Clear();
                     coins->fBlockReward = undo.fBlockReward;
                     coins->nHeight = undo.nHeight;
@@ -2141,11 +2383,16 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                     if (coins->IsPruned())
                         fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
                 }
-                if (coins->IsAvailable(out.n))
+                if (coins->IsAvailable(out.n)) {
                     fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
+                    view.GetStatsDelta().RemoveOutput(out.hash, out.n, *coins);
+                } else if (coins->IsPruned()) {
+                    view.GetStatsDelta().nTransactions++;
+                }
                 if (coins->vout.size() < out.n+1)
                     coins->vout.resize(out.n+1);
                 coins->vout[out.n] = undo.txout;
+                view.GetStatsDelta().AddOutput(out.hash, out.n, *coins);
             }
         }
     }
@@ -2191,6 +2438,7 @@ void static FlushBlockFile(bool fFinalize = false)
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
+void static FindFilesToPrune(std::set<int>& setFilesToPrune);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
@@ -2498,6 +2746,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    // Budget fee transactions are only spent to OP_RETURN, so they can't be found
+    // through the coins either once the block is pruned
+    std::vector<CTransaction> vBudgetFeeTxs;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        if (IsBudgetFeeTransaction(tx))
+            vBudgetFeeTxs.push_back(tx);
+    if (!vBudgetFeeTxs.empty())
+        if (!pblocktree->WriteBudgetFeeTxs(vBudgetFeeTxs, pindex->GetBlockHash()))
+            return state.Abort("Failed to write budget fee transactions");
+
+    // Keep the block and its undo data at hand in case it gets disconnected again soon,
+    // not while importing or catching up, when reorgs are too rare to be worth the copies
+    if (!fVerifying && !IsInitialBlockDownload())
+        reorgCache.Add(pindex, block, blockundo);
+
     if (block.IsProofOfStake()) {
         COutPoint stakeSource(block.stakePointer.txid, block.stakePointer.nPos);
         mapUsedStakePointers.emplace(stakeSource.GetHash(), block.GetHash());
@@ -2520,24 +2783,31 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     return true;
 }
 
-enum FlushStateMode {
-    FLUSH_STATE_IF_NEEDED,
-    FLUSH_STATE_PERIODIC,
-    FLUSH_STATE_ALWAYS
-};
-
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed if either they're too large, forceWrite is set, or
  * fast is not set and it's been a while since the last write.
  */
-bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
+bool FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     int64_t nMempoolUsage = mempool.DynamicMemoryUsage();
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
     static int64_t nLastSetChain = 0;
+    std::set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
+    if (fPruneMode && fCheckForPruning && !fReindex) {
+        FindFilesToPrune(setFilesToPrune);
+        fCheckForPruning = false;
+        if (!setFilesToPrune.empty()) {
+            fFlushForPrune = true;
+            if (!fHavePruned) {
+                pblocktree->WriteFlag("prunedblockfiles", true);
+                fHavePruned = true;
+            }
+        }
+    }
     int64_t nNow = GetTimeMicros();
     // Avoid writing/flushing immediately after startup.
     if (nLastWrite == 0) {
@@ -2554,16 +2824,18 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
     // The cache is large and we're within 10% and 100 MiB of the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - 100 * 1024 * 1024);
-    // The cache is over the limit, we have to write now.
+    // The cache is over the limit, we have to write and trim it now.
     bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && static_cast<size_t>(cacheSize) > nCoinCacheUsage;
     // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
-    // Combine all conditions that result in a full cache flush.
-    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush;
+    // Combine all conditions that result in a full cache flush, which has to wait for the coin database.
+    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fFlushForPrune;
+    // Otherwise the coin database is written in the background and the cache keeps the unmodified entries of recent transactions.
+    bool fDoBackgroundFlush = !fDoFullFlush && (fCacheCritical || fCacheLarge || fPeriodicFlush);
     // Write blocks and block index to disk.
-    if (fDoFullFlush || fPeriodicWrite) {
+    if (fDoFullFlush || fDoBackgroundFlush || fPeriodicWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
@@ -2603,7 +2875,17 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!pcoinsTip->Flush())
             return state.Abort("Failed to write to coin database");
         nLastFlush = nNow;
+    } else if (fDoBackgroundFlush) {
+        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            return state.Error("out of disk space");
+        if (!pcoinsTip->Sync())
+            return state.Abort("Failed to write to coin database");
+        pcoinsTip->Trim(nCoinCacheUsage / 2);
+        nLastFlush = nNow;
     }
+    // Delete the pruned files only once the index and the chainstate no longer refer to them
+    if (fFlushForPrune)
+        UnlinkPrunedFiles(setFilesToPrune);
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
         // Update best block in wallet (so we can detect restored wallets).
         g_signals.SetBestChain(chainActive.GetLocator());
@@ -2620,6 +2902,12 @@ void FlushStateToDisk() {
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneAndFlush() {
+    CValidationState state;
+    fCheckForPruning = true;
+    FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     chainActive.SetTip(pindexNew);
@@ -2667,9 +2955,9 @@ bool static DisconnectTip(CValidationState &state) {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
     mempool.check(pcoinsTip);
-    // Read block from disk.
+    // Read block from the reorg cache or disk.
     CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete))
+    if (!reorgCache.GetBlock(pindexDelete, block) && !ReadBlockFromDisk(block, pindexDelete))
         return state.Abort("Failed to read block");
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
@@ -2701,6 +2989,8 @@ bool static DisconnectTip(CValidationState &state) {
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    mnodeman.BlockDisconnected(pindexDelete->nHeight);
+    snodeman.BlockDisconnected(pindexDelete->nHeight);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
@@ -2726,7 +3016,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CB
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
+        if (!reorgCache.GetBlock(pindexNew, block) && !ReadBlockFromDisk(block, pindexNew))
             return state.Abort("Failed to read block");
         pblock = &block;
     }
@@ -2782,6 +3072,14 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CB
     return true;
 }
 
+void GetReorgCacheStats(CReorgCacheStats& stats)
+{
+    AssertLockHeld(cs_main);
+    stats = reorgCache.stats;
+    stats.nBlocks = reorgCache.Size();
+    stats.nBytes = reorgCache.Bytes();
+}
+
 bool DisconnectBlocksAndReprocess(int blocks)
 {
     LOCK(cs_main);
@@ -2827,7 +3125,7 @@ bool DisconnectBlockAndInputs(CValidationState &state, CTransaction txLock)
         pindexNew = BlockReading->pprev; //new best block
 
         CBlock block;
-        if (!ReadBlockFromDisk(block, BlockReading))
+        if (!reorgCache.GetBlock(BlockReading, block) && !ReadBlockFromDisk(block, BlockReading))
             return state.Abort(_("Failed to read block"));
 
         // Queue memory transactions to resurrect.
@@ -3134,8 +3432,7 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block, bool fProofOfStake)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block, fProofOfStake);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate(CBlockIndex(block, fProofOfStake));
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3240,6 +3537,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         if (nNewChunks > nOldChunks) {
+            if (fPruneMode)
+                fCheckForPruning = true;
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
                 FILE *file = OpenBlockFile(pos);
                 if (file) {
@@ -3271,6 +3570,8 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     if (nNewChunks > nOldChunks) {
+        if (fPruneMode)
+            fCheckForPruning = true;
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
             FILE *file = OpenUndoFile(pos);
             if (file) {
@@ -3286,6 +3587,131 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
+int GetPruneKeepDepth()
+{
+    // Stake pointers up to ValidStakePointerDuration() blocks back are checked against their
+    // block, on top of any reorganization
+    return std::max((int)MIN_BLOCKS_TO_KEEP, Params().ValidStakePointerDuration() + Params().MaxReorganizationDepth());
+}
+
+int GetPruneHeight()
+{
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Tip();
+    if (pindex == NULL)
+        return 0;
+    while (pindex->pprev && (pindex->pprev->nStatus & BLOCK_HAVE_DATA))
+        pindex = pindex->pprev;
+    return pindex->nHeight;
+}
+
+uint64_t CalculateCurrentUsage()
+{
+    LOCK(cs_LastBlockFile);
+
+    uint64_t retval = 0;
+    BOOST_FOREACH(const CBlockFileInfo &file, vinfoBlockFile) {
+        retval += file.nSize + file.nUndoSize;
+    }
+    return retval;
+}
+
+/** Forget the blocks of one block file, before the file itself is deleted */
+void static PruneOneBlockFile(const int fileNumber)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_LastBlockFile);
+
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile == fileNumber) {
+            pindex->nStatus &= ~BLOCK_HAVE_DATA;
+            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            setDirtyBlockIndex.insert(pindex);
+
+            // Prune from mapBlocksUnlinked -- any block we prune would have
+            // to be downloaded again in order to consider its chain, at which
+            // point it would be considered as a candidate for
+            // mapBlocksUnlinked or setBlockIndexCandidates.
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex *, CBlockIndex *>::iterator it = range.first;
+                range.first++;
+                if (it->second == pindex) {
+                    mapBlocksUnlinked.erase(it);
+                }
+            }
+        }
+    }
+
+    vinfoBlockFile[fileNumber].SetNull();
+    setDirtyFileInfo.insert(fileNumber);
+}
+
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
+{
+    for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+        CDiskBlockPos pos(*it, 0);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    }
+}
+
+/**
+ * Pick the oldest block files to delete until the block and undo files are below
+ * nPruneTarget again, and forget their blocks. Files with a block less than
+ * GetPruneKeepDepth() below the tip are kept, and nothing is pruned before the
+ * chain is past PruneAfterHeight(). The files are unlinked by the caller once the
+ * block index has been written.
+ */
+void static FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nPruneTarget == 0)
+        return;
+    if (chainActive.Tip()->nHeight <= Params().PruneAfterHeight() || chainActive.Tip()->nHeight <= GetPruneKeepDepth())
+        return;
+
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - GetPruneKeepDepth();
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // We don't check to prune until after we've allocated new space for files,
+    // so leave a buffer under our target to account for another allocation
+    // before the next pruning.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    int count = 0;
+
+    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
+            uint64_t nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+
+            if (vinfoBlockFile[fileNumber].nSize == 0)
+                continue;
+
+            if (nCurrentUsage + nBuffer < nPruneTarget) // are we below our target?
+                break;
+
+            // don't prune files that could have a block within the keep depth of the main chain's tip but keep scanning
+            if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+                continue;
+
+            PruneOneBlockFile(fileNumber);
+            // Queue up the files for removal
+            setFilesToPrune.insert(fileNumber);
+            nCurrentUsage -= nBytesToPrune;
+            count++;
+        }
+    }
+
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+           nPruneTarget/1024/1024, nCurrentUsage/1024/1024,
+           ((int64_t)nPruneTarget - (int64_t)nCurrentUsage)/1024/1024,
+           nLastBlockWeCanPrune, count);
+}
+
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
 {
     // Check proof of work matches claimed amount
@@ -3309,11 +3735,11 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlockStructure(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
 
-    if (block.fChecked)
+    if (block.fStructureChecked)
         return true;
 
     // Check that the header is valid (particularly PoW).  This is mostly
@@ -3361,6 +3787,43 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
                              REJECT_INVALID, "bad-cs-multiple");
     }
 
+    // Check transactions, the spork they depend on is checked by CheckBlock
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        if (!CheckTransaction(tx, state, false))
+            return error("CheckBlock() : CheckTransaction failed");
+
+    unsigned int nSigOps = 0;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        nSigOps += GetLegacySigOpCount(tx);
+    }
+    if (nSigOps > MAX_BLOCK_SIGOPS)
+        return state.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"),
+                         REJECT_INVALID, "bad-blk-sigops", true);
+
+    // Proof of work is never checked for proof of stake blocks, so fCheckPOW does not matter for them
+    if ((fCheckPOW || !block.IsProofOfWork()) && fCheckMerkleRoot)
+        block.fStructureChecked = true;
+
+    return true;
+}
+
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+{
+    if (block.fChecked)
+        return true;
+
+    if (!CheckBlockStructure(block, state, fCheckPOW, fCheckMerkleRoot))
+        return false;
+
+    // The checks below depend on the chain, the spork and the masternode lists
+
+    if (!IsSporkActive(SPORK_17_NFT_TX)) {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            if (tx.nVersion >= 3)
+                return state.DoS(100, error("CheckBlock() : version 3 transaction before the NFT spork"),
+                                 REJECT_INVALID, "nft-tx-spork-off");
+    }
 
     // ----------- instantX transaction scanning -----------
 
@@ -3432,20 +3895,6 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // -------------------------------------------
 
-    // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state))
-            return error("CheckBlock() : CheckTransaction failed");
-
-    unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(tx);
-    }
-    if (nSigOps > MAX_BLOCK_SIGOPS)
-        return state.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"),
-                         REJECT_INVALID, "bad-blk-sigops", true);
-
     if (fCheckPOW && fCheckMerkleRoot)
         block.fChecked = true;
 
@@ -3605,6 +4054,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return true;
     }
 
+    // A block of the active chain that was processed before and pruned since isn't stored again
+    if (pindex->nTx != 0 && chainActive.Contains(pindex))
+        return true;
+
     pindex->fProofOfStake = block.IsProofOfStake();
     if (pindex->fProofOfStake) {
         pindex->stakeSource.first = block.stakePointer.txid;
@@ -3876,9 +4329,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash, bool fProofOfStake)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate(CBlockIndex());
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
     pindexNew->fProofOfStake = fProofOfStake;
@@ -3886,15 +4337,17 @@ CBlockIndex * InsertBlockIndex(uint256 hash, bool fProofOfStake)
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB()
-{
-    if (!pblocktree->LoadBlockIndexGuts())
-        return false;
+/** Format version of the block index snapshot written at shutdown */
+static const int BLOCK_INDEX_SNAPSHOT_VERSION = 1;
 
-    boost::this_thread::interruption_point();
+static boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+static void SortBlockIndexByHeight(vector<pair<int, CBlockIndex*> >& vSortedByHeight)
+{
+    vSortedByHeight.clear();
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
     {
@@ -3902,43 +4355,218 @@ bool static LoadBlockIndexDB()
         vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
-            if (pindex->pprev) {
-                if (pindex->pprev->nChainTx) {
-                    pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
-                } else {
-                    pindex->nChainTx = 0;
-                    mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
-                }
-            } else {
-                pindex->nChainTx = pindex->nTx;
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
+    if (fReindex || fImporting || pcoinsTip == NULL || pblocktree == NULL || chainActive.Tip() == NULL)
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    SortBlockIndexByHeight(vSortedByHeight);
+
+    // Parents are stored as their position in the snapshot, they always come before their children
+    boost::unordered_map<const CBlockIndex*, uint32_t> mapPos;
+    mapPos.reserve(vSortedByHeight.size());
+
+    uint256 id = GetRandHash();
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    boost::filesystem::path pathTmp = path.string() + ".new";
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : failed to open %s", __func__, pathTmp.string());
+
+    try {
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << FLATDATA(Params().MessageStart()) << BLOCK_INDEX_SNAPSHOT_VERSION << id;
+        ss << pcoinsTip->GetBestBlock() << (uint64_t)vSortedByHeight.size();
+        for (size_t i = 0; i < vSortedByHeight.size(); i++) {
+            const CBlockIndex* pindex = vSortedByHeight[i].second;
+            mapPos[pindex] = i;
+            uint32_t nPrev = pindex->pprev ? mapPos[pindex->pprev] : std::numeric_limits<uint32_t>::max();
+            ss << pindex->GetBlockHash() << nPrev << pindex->nHeight << pindex->nStatus << pindex->nTx;
+            ss << pindex->nFile << pindex->nDataPos << pindex->nUndoPos << ArithToUint256(pindex->nChainWork);
+            ss << pindex->nVersion << pindex->hashMerkleRoot << pindex->nTime << pindex->nBits << pindex->nNonce;
+            ss << pindex->fProofOfStake;
+            if (pindex->fProofOfStake)
+                ss << pindex->stakeSource;
+            if (ss.size() >= (1 << 20) || i + 1 == vSortedByHeight.size()) {
+                hasher.write(&ss[0], ss.size());
+                fileout.write(&ss[0], ss.size());
+                ss.clear();
             }
         }
-        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
-            setBlockIndexCandidates.insert(pindex);
-        if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
-            pindexBestInvalid = pindex;
-        if (pindex->pprev)
-            pindex->BuildSkip();
-        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
-            pindexBestHeader = pindex;
+        fileout << hasher.GetHash();
+    } catch (const std::exception& e) {
+        return error("%s : %s", __func__, e.what());
     }
+    FileCommit(fileout.Get());
+    fileout.fclose();
 
-    // Load block file info
-    pblocktree->ReadLastBlockFile(nLastBlockFile);
-    vinfoBlockFile.resize(nLastBlockFile + 1);
-    LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
-    for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
-        pblocktree->ReadBlockFileInfo(nFile, vinfoBlockFile[nFile]);
-    }
-    LogPrintf("%s: last block file info: %s\n", __func__, vinfoBlockFile[nLastBlockFile].ToString());
-    for (int nFile = nLastBlockFile + 1; true; nFile++) {
-        CBlockFileInfo info;
-        if (pblocktree->ReadBlockFileInfo(nFile, info)) {
+    if (!RenameOver(pathTmp, path))
+        return error("%s : failed to rename %s", __func__, pathTmp.string());
+    if (!pblocktree->WriteBlockIndexSnapshotId(id))
+        return error("%s : failed to write snapshot id", __func__);
+
+    LogPrintf("%s: wrote %u entries in %dms\n", __func__, vSortedByHeight.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Fill mapBlockIndex from the snapshot written at the last clean shutdown, sorted by height.
+ * Returns false, leaving the block index empty, when there is no usable snapshot.
+ */
+static bool LoadBlockIndexSnapshot(vector<pair<int, CBlockIndex*> >& vSortedByHeight)
+{
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    if (!boost::filesystem::exists(path))
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s : failed to open %s", __func__, path.string());
+        try {
+            ss.resize(boost::filesystem::file_size(path));
+            if (!ss.empty())
+                filein.read(&ss[0], ss.size());
+        } catch (const std::exception& e) {
+            return error("%s : %s", __func__, e.what());
+        }
+    }
+    // The block index changes as soon as the node runs, so a snapshot is only ever used once
+    boost::filesystem::remove(path);
+
+    std::map<PointerHash, uint256> mapStakePointers;
+    try {
+        uint256 hashChecksum;
+        if (ss.size() < hashChecksum.size())
+            return error("%s : snapshot is truncated", __func__);
+        memcpy(hashChecksum.begin(), &ss[ss.size() - hashChecksum.size()], hashChecksum.size());
+        ss.resize(ss.size() - hashChecksum.size());
+        if (Hash(ss.begin(), ss.end()) != hashChecksum)
+            return error("%s : checksum mismatch", __func__);
+
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        int nVersion;
+        uint256 id, idExpected, hashBestBlock;
+        uint64_t nEntries;
+        ss >> FLATDATA(pchMessageStart) >> nVersion >> id >> hashBestBlock >> nEntries;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) || nVersion != BLOCK_INDEX_SNAPSHOT_VERSION)
+            return error("%s : snapshot is for another network or version", __func__);
+        if (!pblocktree->ReadBlockIndexSnapshotId(idExpected) || id != idExpected || hashBestBlock != pcoinsTip->GetBestBlock()) {
+            LogPrintf("%s: snapshot is stale, loading the block index from the database\n", __func__);
+            return false;
+        }
+
+        vector<CBlockIndex*> vEntries;
+        vEntries.reserve(nEntries);
+        vSortedByHeight.reserve(nEntries);
+        mapBlockIndex.reserve(nEntries);
+        for (uint64_t i = 0; i < nEntries; i++) {
+            uint256 hash, hashChainWork;
+            uint32_t nPrev;
+            std::pair<uint256, unsigned int> stakeSource;
+            CBlockIndex entry;
+            ss >> hash >> nPrev >> entry.nHeight >> entry.nStatus >> entry.nTx;
+            ss >> entry.nFile >> entry.nDataPos >> entry.nUndoPos >> hashChainWork;
+            ss >> entry.nVersion >> entry.hashMerkleRoot >> entry.nTime >> entry.nBits >> entry.nNonce;
+            ss >> entry.fProofOfStake;
+            if (entry.fProofOfStake)
+                ss >> stakeSource;
+            entry.nChainWork = UintToArith256(hashChainWork);
+            if (nPrev != std::numeric_limits<uint32_t>::max()) {
+                if (nPrev >= i)
+                    throw std::runtime_error("parent stored after its child");
+                entry.pprev = vEntries[nPrev];
+            }
+
+            CBlockIndex* pindex = blockIndexArena.Allocate(entry);
+            std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(make_pair(hash, pindex));
+            if (!ret.second)
+                throw std::runtime_error("duplicate entry");
+            pindex->phashBlock = &ret.first->first;
+            if (pindex->fProofOfStake) {
+                pindex->stakeSource = stakeSource;
+                COutPoint stakeSourceOut(stakeSource.first, stakeSource.second);
+                mapStakePointers.insert(make_pair(stakeSourceOut.GetHash(), hash));
+            }
+            vEntries.push_back(pindex);
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        }
+        if (!ss.empty())
+            throw std::runtime_error("trailing data");
+    } catch (const std::exception& e) {
+        UnloadBlockIndex();
+        vSortedByHeight.clear();
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    mapUsedStakePointers.insert(mapStakePointers.begin(), mapStakePointers.end());
+
+    LogPrintf("%s: loaded %u entries in %dms\n", __func__, vSortedByHeight.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool static LoadBlockIndexDB()
+{
+    // Use the snapshot from the last clean shutdown if there is one, it is already sorted and has the chain work
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    bool fFromSnapshot = LoadBlockIndexSnapshot(vSortedByHeight);
+    if (!fFromSnapshot) {
+        if (!pblocktree->LoadBlockIndexGuts())
+            return false;
+
+        boost::this_thread::interruption_point();
+
+        SortBlockIndexByHeight(vSortedByHeight);
+    }
+
+    // Calculate nChainWork
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        CBlockIndex* pindex = item.second;
+        if (!fFromSnapshot)
+            pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        // We can link the chain of blocks for which we've received transactions at some point.
+        // Pruned nodes may have deleted the block.
+        if (pindex->nTx > 0) {
+            if (pindex->pprev) {
+                if (pindex->pprev->nChainTx) {
+                    pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+                } else {
+                    pindex->nChainTx = 0;
+                    mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
+                }
+            } else {
+                pindex->nChainTx = pindex->nTx;
+            }
+        }
+        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
+            setBlockIndexCandidates.insert(pindex);
+        if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
+            pindexBestInvalid = pindex;
+        if (pindex->pprev)
+            pindex->BuildSkip();
+        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+            pindexBestHeader = pindex;
+    }
+
+    // Load block file info
+    pblocktree->ReadLastBlockFile(nLastBlockFile);
+    vinfoBlockFile.resize(nLastBlockFile + 1);
+    LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
+    for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
+        pblocktree->ReadBlockFileInfo(nFile, vinfoBlockFile[nFile]);
+    }
+    LogPrintf("%s: last block file info: %s\n", __func__, vinfoBlockFile[nLastBlockFile].ToString());
+    for (int nFile = nLastBlockFile + 1; true; nFile++) {
+        CBlockFileInfo info;
+        if (pblocktree->ReadBlockFileInfo(nFile, info)) {
             vinfoBlockFile.push_back(info);
         } else {
             break;
@@ -3963,6 +4591,11 @@ bool static LoadBlockIndexDB()
         }
     }
 
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -4025,6 +4658,11 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -4081,14 +4719,23 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
 
 void UnloadBlockIndex()
 {
-    mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
+    pindexBestHeader = NULL;
+    mapBlocksUnlinked.clear();
+    setDirtyBlockIndex.clear();
+    mapBlockIndex.clear();
+    blockIndexArena.Clear();
+    reorgCache.Clear();
 }
 
 bool LoadBlockIndex()
 {
+    // A snapshot from before a reindex no longer describes the block files
+    if (fReindex)
+        boost::filesystem::remove(GetBlockIndexSnapshotPath());
+
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB())
         return false;
@@ -4147,102 +4794,352 @@ bool InitBlockIndex() {
 
 
 
+namespace {
+
+/**
+ * Blocks of an external file on their way from the reader to the connector.
+ *
+ * The reader appends the serialized blocks in file order, the checkers
+ * deserialize them and run CheckBlockStructure in any order, and the
+ * connector takes them back in file order once they are checked. When a
+ * block turns out not to be readable, the connector drops everything after
+ * it and makes the reader scan on from just past its header, like the
+ * serial loader did.
+ */
+class CImportQueue
+{
+public:
+    struct CEntry
+    {
+        //! Position of the block data in the file
+        uint64_t nPos;
+        //! Where to continue scanning if the block cannot be read
+        uint64_t nRewind;
+        //! Serialized block, as read by the reader
+        CDataStream ss;
+        CBlock block;
+        uint256 hash;
+        //! Whether a checker is done with the entry
+        bool fChecked;
+        //! Whether block holds the deserialized data
+        bool fRead;
+        std::string strError;
+
+        CEntry() : nPos(0), nRewind(0), ss(SER_DISK, CLIENT_VERSION), fChecked(false), fRead(false) {}
+    };
+    typedef boost::shared_ptr<CEntry> CEntryRef;
+
+private:
+    boost::mutex mutex;
+    boost::condition_variable condReader;
+    boost::condition_variable condChecker;
+    boost::condition_variable condConnector;
+
+    //! Entries in file order, for the connector
+    std::deque<CEntryRef> queueOrdered;
+    //! Entries no checker took yet
+    std::deque<CEntryRef> queueUnchecked;
+    //! Serialized size of the entries in queueOrdered
+    size_t nQueuedSize;
+
+    //! Whether the reader reached the end of the file
+    bool fEnd;
+    //! Whether the reader has to continue at nRestartPos
+    bool fRestart;
+    uint64_t nRestartPos;
+    //! Whether the reader thread exited
+    bool fReaderDone;
+    //! Whether the connector is done, so every other thread has to exit
+    bool fClosed;
+
+public:
+    CImportQueue() : nQueuedSize(0), fEnd(false), fRestart(false), nRestartPos(0), fReaderDone(false), fClosed(false) {}
+
+    //! Called by the reader, waits while the queue is full
+    void Push(const CEntryRef& entry)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!queueOrdered.empty() && !fRestart && !fClosed &&
+               (queueOrdered.size() >= MAX_IMPORT_QUEUE_BLOCKS || nQueuedSize + entry->ss.size() > MAX_IMPORT_QUEUE_SIZE))
+            condReader.wait(lock);
+        // A restart drops everything read after the block that failed
+        if (fRestart || fClosed)
+            return;
+        queueOrdered.push_back(entry);
+        queueUnchecked.push_back(entry);
+        nQueuedSize += entry->ss.size();
+        condChecker.notify_one();
+    }
+
+    //! Called by the reader, whether it should stop scanning and call WaitForRestart
+    bool IsRestarting()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return fRestart || fClosed;
+    }
+
+    //! Called by the reader at the end of the file, false once the connector is done
+    bool WaitForRestart(uint64_t& nPos)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fEnd = true;
+        condConnector.notify_all();
+        while (!fRestart && !fClosed)
+            condReader.wait(lock);
+        if (fClosed)
+            return false;
+        fRestart = false;
+        fEnd = false;
+        nPos = nRestartPos;
+        return true;
+    }
+
+    //! Called when the reader thread exits
+    void ReaderDone()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fReaderDone = true;
+        condConnector.notify_all();
+    }
+
+    //! Called by the checkers, false once the connector is done
+    bool TakeUnchecked(CEntryRef& entry)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queueUnchecked.empty() && !fClosed)
+            condChecker.wait(lock);
+        if (fClosed)
+            return false;
+        entry = queueUnchecked.front();
+        queueUnchecked.pop_front();
+        return true;
+    }
+
+    void Checked(const CEntryRef& entry)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        entry->fChecked = true;
+        condConnector.notify_all();
+    }
+
+    //! Called by the connector, waits for the next block in file order, false at the end of the file
+    bool Pop(CEntryRef& entry)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            if (!queueOrdered.empty() && queueOrdered.front()->fChecked)
+                break;
+            if (queueOrdered.empty() && ((fEnd && !fRestart) || fReaderDone))
+                return false;
+            condConnector.wait(lock);
+        }
+        entry = queueOrdered.front();
+        queueOrdered.pop_front();
+        nQueuedSize -= entry->ss.size();
+        condReader.notify_all();
+        return true;
+    }
+
+    //! Called by the connector, drops the queued blocks and has the reader scan again from nPos
+    void Restart(uint64_t nPos)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queueOrdered.clear();
+        queueUnchecked.clear();
+        nQueuedSize = 0;
+        fRestart = true;
+        fEnd = false;
+        nRestartPos = nPos;
+        condReader.notify_all();
+    }
+
+    //! Called by the connector when it is done, makes the other threads exit
+    void Close()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fClosed = true;
+        condReader.notify_all();
+        condChecker.notify_all();
+    }
+};
+
+/** Scan fileIn for blocks and queue them, in file order */
+void ThreadImportReader(CImportQueue* pqueue, FILE* fileIn)
+{
+    RenameThread("crown-loadblkrd");
+
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        do {
+            while (!blkdat.eof() && !pqueue->IsRestarting()) {
+                boost::this_thread::interruption_point();
+
+                blkdat.SetPos(nRewind);
+                nRewind++; // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[MESSAGE_START_SIZE];
+                    blkdat.FindByte(Params().MessageStart()[0]);
+                    nRewind = blkdat.GetPos()+1;
+                    blkdat >> FLATDATA(buf);
+                    if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                        continue;
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                        continue;
+                } catch (const std::exception &) {
+                    // no valid block header found; don't complain
+                    break;
+                }
+                try {
+                    // read block, the checkers deserialize it
+                    CImportQueue::CEntryRef entry(new CImportQueue::CEntry());
+                    entry->nPos = blkdat.GetPos();
+                    entry->nRewind = nRewind;
+                    entry->ss.resize(nSize);
+                    blkdat.read(&entry->ss[0], nSize);
+                    nRewind = blkdat.GetPos();
+                    pqueue->Push(entry);
+                } catch (std::exception &e) {
+                    LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
+                }
+            }
+        } while (pqueue->WaitForRestart(nRewind) && blkdat.Seek(nRewind));
+    } catch(std::runtime_error &e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    pqueue->ReaderDone();
+}
+
+/** Deserialize queued blocks and run the checks that do not need cs_main on them */
+void ThreadImportChecker(CImportQueue* pqueue)
+{
+    RenameThread("crown-loadblkchk");
+
+    CImportQueue::CEntryRef entry;
+    while (pqueue->TakeUnchecked(entry)) {
+        try {
+            entry->ss >> entry->block;
+            entry->hash = entry->block.GetHash();
+            entry->fRead = true;
+            // The result is cached in the block, ProcessNewBlock reports failures
+            CValidationState state;
+            CheckBlockStructure(entry->block, state, entry->block.IsProofOfWork());
+        } catch (std::exception &e) {
+            entry->strError = e.what();
+        }
+        pqueue->Checked(entry);
+        entry.reset();
+    }
+}
+
+/** Stops the reader and the checkers when the connector leaves LoadExternalBlockFile, in whatever way */
+class CImportThreads
+{
+private:
+    CImportQueue& queue;
+    boost::thread_group threads;
+
+public:
+    CImportThreads(CImportQueue& queueIn, FILE* fileIn) : queue(queueIn)
+    {
+        threads.create_thread(boost::bind(&ThreadImportReader, &queue, fileIn));
+        int nCheckers = std::max(1, nScriptCheckThreads);
+        for (int i = 0; i < nCheckers; i++)
+            threads.create_thread(boost::bind(&ThreadImportChecker, &queue));
+    }
+
+    ~CImportThreads()
+    {
+        queue.Close();
+        threads.interrupt_all();
+        threads.join_all();
+    }
+};
+
+} // anon namespace
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
+    // Reading and checking happen on their own threads, this one connects the blocks in file order
+    CImportQueue queue;
+    CImportThreads threads(queue, fileIn);
+
     int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+    CImportQueue::CEntryRef entry;
+    while (queue.Pop(entry)) {
+        boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception &) {
-                // no valid block header found; don't complain
-                break;
+        if (!entry->fRead) {
+            LogPrintf("%s : Deserialize or I/O error - %s", __func__, entry->strError);
+            queue.Restart(entry->nRewind);
+            continue;
+        }
+        try {
+            CBlock& block = entry->block;
+            CDiskBlockPos pos;
+            if (dbp) {
+                pos = *dbp;
+                pos.nPos = entry->nPos;
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
+
+            // detect out of order blocks, and store them for later
+            uint256 hash = entry->hash;
+            if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                        block.hashPrevBlock.ToString());
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+                    mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, pos));
+                continue;
+            }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+            // process in case the block isn't known yet
+            if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                CValidationState state;
+                if (ProcessNewBlock(state, NULL, &block, dbp ? &pos : NULL))
+                    nLoaded++;
+                if (state.IsError())
+                    break;
+            } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+            }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second))
+            // Recursively process earlier encountered successors of this block
+            deque<uint256> queueChildren;
+            queueChildren.push_back(hash);
+            while (!queueChildren.empty()) {
+                uint256 head = queueChildren.front();
+                queueChildren.pop_front();
+                std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                while (range.first != range.second) {
+                    std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                    if (ReadBlockFromDisk(block, it->second))
+                    {
+                        LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                                head.ToString());
+                        CValidationState dummy;
+                        if (ProcessNewBlock(dummy, NULL, &block, &it->second))
                         {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, &it->second))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
+                            nLoaded++;
+                            queueChildren.push_back(block.GetHash());
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
                     }
+                    range.first++;
+                    mapBlocksUnknownParent.erase(it);
                 }
-            } catch (std::exception &e) {
-                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
+        } catch (std::exception &e) {
+            LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
-    } catch(std::runtime_error &e) {
-        AbortNode(std::string("System error: ") + e.what());
     }
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
@@ -4285,6 +5182,7 @@ void static CheckBlockIndex()
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = NULL; // Oldest ancestor of pindex which is invalid.
     CBlockIndex* pindexFirstMissing = NULL; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstNeverProcessed = NULL; // Oldest ancestor of pindex for which nTx == 0.
     CBlockIndex* pindexFirstNotTreeValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
@@ -4292,6 +5190,7 @@ void static CheckBlockIndex()
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
         if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
@@ -4302,12 +5201,19 @@ void static CheckBlockIndex()
             assert(pindex->GetBlockHash() == Params().HashGenesisBlock()); // Genesis block's hash must match.
             assert(pindex == chainActive.Genesis()); // The current active chain's genesis block must be this block.
         }
-        // HAVE_DATA is equivalent to VALID_TRANSACTIONS and equivalent to nTx > 0 (we stored the number of transactions in the block)
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+        if (!fHavePruned) {
+            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
+            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        } else {
+            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+        }
+        if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
         assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
-        // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstMissing != NULL) == (pindex->nChainTx == 0)); // nChainTx == 0 is used to signal that all parent block's transaction data is available.
+        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
@@ -4319,9 +5225,18 @@ void static CheckBlockIndex()
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstMissing == NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block sorts at least as good as the current tip and is valid, it must be in setBlockIndexCandidates.
-                 assert(setBlockIndexCandidates.count(pindex));
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+            if (pindexFirstInvalid == NULL) {
+                // If this block sorts at least as good as the current tip and
+                // is valid and we have all data for its parents, it must be in
+                // setBlockIndexCandidates. chainActive.Tip() must also be there
+                // even if some data has been pruned.
+                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                    assert(setBlockIndexCandidates.count(pindex));
+                }
+                // If some parent is missing, then it could be that this block was in
+                // setBlockIndexCandidates but had to be removed because of the missing data.
+                // In this case it must be in mapBlocksUnlinked -- see test below.
             }
         } else { // If this block sorts worse than the current tip, it cannot be in setBlockIndexCandidates.
             assert(setBlockIndexCandidates.count(pindex) == 0);
@@ -4337,12 +5252,25 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
-                assert(foundInUnlinked);
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+            assert(foundInUnlinked);
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
+        if (pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
+            // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
+            assert(fHavePruned); // We must have pruned.
+            // This block may have entered mapBlocksUnlinked if it has a descendant that at some
+            // point had more work than the tip, and we tried switching to that descendant but
+            // were missing data for some intermediate block between chainActive and the tip.
+            // So if this block is itself better than chainActive.Tip() and it wasn't in
+            // setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
+            if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
+                if (pindexFirstInvalid == NULL) {
+                    assert(foundInUnlinked);
+                }
             }
-        } else { // If this block does not have block data available, or all parents do, it cannot be in mapBlocksUnlinked.
-            assert(!foundInUnlinked);
         }
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
@@ -4362,6 +5290,7 @@ void static CheckBlockIndex()
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
             if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
             if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
@@ -4480,7 +5409,10 @@ bool static AlreadyHave(const CInv& inv)
     case MSG_TXLOCK_VOTE:
         return GetInstantSend().AlreadyHave(inv.hash);
     case MSG_SPORK:
-        return mapSporks.count(inv.hash);
+        {
+            LOCK(cs_mapSporks);
+            return mapSporks.count(inv.hash);
+        }
     case MSG_MASTERNODE_WINNER:
         if(masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
             masternodeSync.AddedMasternodeWinner(inv.hash);
@@ -4539,14 +5471,142 @@ bool static AlreadyHave(const CInv& inv)
 }
 
 
+/**
+ * Serialize a non-transaction inventory item as sent in reply to getdata, in the
+ * legacy masternode wire format for old peers if fLegacyFormat. False if we don't have it.
+ */
+static bool SerializeInventoryItem(const CInv& inv, bool fLegacyFormat, std::string& strCommand, CDataStream& ss)
+{
+    AssertLockHeld(cs_main);
+    if (inv.type == MSG_TXLOCK_VOTE) {
+        boost::optional<CConsensusVote> vote = GetInstantSend().GetLockVote(inv.hash);
+        if (vote)
+        {
+            ss << vote.get();
+            strCommand = "txlvote";
+            return true;
+        }
+    }
+    if (inv.type == MSG_TXLOCK_REQUEST) {
+        boost::optional<CTransaction> lockedTx = GetInstantSend().GetLockReq(inv.hash);
+        if (lockedTx)
+        {
+            ss << lockedTx.get();
+            strCommand = "ix";
+            return true;
+        }
+    }
+    if (inv.type == MSG_SPORK) {
+        LOCK(cs_mapSporks);
+        if(mapSporks.count(inv.hash)){
+            ss << mapSporks[inv.hash];
+            strCommand = "spork";
+            return true;
+        }
+    }
+    if (inv.type == MSG_MASTERNODE_WINNER) {
+        if(masternodePayments.mapMasternodePayeeVotes.count(inv.hash)){
+            ss << masternodePayments.mapMasternodePayeeVotes[inv.hash];
+            strCommand = "mnw";
+            return true;
+        }
+    }
+    if (inv.type == MSG_BUDGET_VOTE) {
+        const CBudgetVote* item = budget.GetSeenVote(inv.hash);
+        if(item){
+            ss << *item;
+            strCommand = "mvote";
+            return true;
+        }
+    }
+
+    if (inv.type == MSG_BUDGET_PROPOSAL) {
+        const CBudgetProposalBroadcast* item = budget.GetSeenProposal(inv.hash);
+        if(item){
+            ss << *item;
+            strCommand = "mprop";
+            return true;
+        }
+    }
+
+    if (inv.type == MSG_BUDGET_FINALIZED_VOTE) {
+        const BudgetDraftVote* item = budget.GetSeenBudgetDraftVote(inv.hash);
+        if(item){
+            ss << *item;
+            strCommand = "fbvote";
+            return true;
+        }
+    }
+
+    if (inv.type == MSG_BUDGET_FINALIZED) {
+        const BudgetDraftBroadcast* item = budget.GetSeenBudgetDraft(inv.hash);
+        if(item){
+            ss << *item;
+            strCommand = "fbs";
+            return true;
+        }
+    }
+
+    if (inv.type == MSG_MASTERNODE_ANNOUNCE) {
+        if(mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
+            auto mnb = mnodeman.mapSeenMasternodeBroadcast[inv.hash];
+            strCommand = "mnb_new";
+            if (fLegacyFormat) {
+                //Make sure this serializes to a format that is readable by the peer we are sending to
+                mnb.lastPing.nVersion = 1;
+            }
+            if (mnb.lastPing.nVersion == 1)
+                strCommand = "mnb";
+            ss << mnb;
+            return true;
+        }
+    }
+
+    if (inv.type == MSG_MASTERNODE_PING) {
+        if(mnodeman.mapSeenMasternodePing.count(inv.hash)){
+            auto mnp = mnodeman.mapSeenMasternodePing[inv.hash];
+            strCommand = "mnp_new";
+            if (fLegacyFormat) {
+                //Make sure this serializes to a format that is readable by the peer we are sending to
+                mnp.nVersion = 1;
+            }
+            if (mnp.nVersion == 1)
+                strCommand = "mnp";
+            ss << mnp;
+            return true;
+        }
+    }
+    if (inv.type == MSG_SYSTEMNODE_WINNER) {
+        if(systemnodePayments.mapSystemnodePayeeVotes.count(inv.hash)){
+            ss << systemnodePayments.mapSystemnodePayeeVotes[inv.hash];
+            strCommand = "snw";
+            return true;
+        }
+    }
+    if (inv.type == MSG_SYSTEMNODE_ANNOUNCE) {
+        if(snodeman.mapSeenSystemnodeBroadcast.count(inv.hash)){
+            ss << snodeman.mapSeenSystemnodeBroadcast[inv.hash];
+            strCommand = "snb";
+            return true;
+        }
+    }
+
+    if (inv.type == MSG_SYSTEMNODE_PING) {
+        if(snodeman.mapSeenSystemnodePing.count(inv.hash)){
+            ss << snodeman.mapSeenSystemnodePing[inv.hash];
+            strCommand = "snp";
+            return true;
+        }
+    }
+    return false;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -4559,36 +5619,56 @@ void static ProcessGetData(CNode* pfrom)
 
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
             {
+                // Only look the block up under cs_main, reading and sending it doesn't need it
                 bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                CDiskBlockPos pos;
+                uint256 hashContinueTip;
                 {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older than the best header
-                        // chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                            (mi->second->GetBlockTime() > pindexBestHeader->GetBlockTime() - 30 * 24 * 60 * 60);
-                        if (!send) {
-                            LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end())
+                    {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a month older than the best header
+                            // chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                                (mi->second->GetBlockTime() > pindexBestHeader->GetBlockTime() - 30 * 24 * 60 * 60);
+                            if (!send) {
+                                LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
+                            }
+                        }
+                    }
+                    // Pruned nodes may have deleted the block, so check whether
+                    // it's available before trying to send.
+                    send = send && (mi->second->nStatus & BLOCK_HAVE_DATA);
+                    if (send) {
+                        pos = mi->second->GetBlockPos();
+                        if (inv.hash == pfrom->hashContinue) {
+                            hashContinueTip = chainActive.Tip()->GetBlockHash();
+                            pfrom->hashContinue.SetNull();
                         }
                     }
                 }
                 if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    // Send block from the raw block cache or disk. The block may
+                    // have been pruned since it was looked up, so don't assert.
+                    boost::shared_ptr<const CDataStream> pblock = GetRawBlock(inv.hash, pos);
+                    if (!pblock) {
+                        LogPrintf("ProcessGetData(): cannot load block %s from disk for peer=%i\n", inv.hash.ToString(), pfrom->GetId());
+                    } else if (inv.type == MSG_BLOCK) {
+                        pfrom->PushMessage("block", *pblock);
+                    } else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
+                            CBlock block;
+                            CDataStream ssBlock(*pblock);
+                            ssBlock >> block;
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
                             pfrom->PushMessage("merkleblock", merkleBlock);
                             // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
@@ -4607,15 +5687,14 @@ void static ProcessGetData(CNode* pfrom)
                     }
 
                     // Trigger them to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
+                    if (!hashContinueTip.IsNull())
                     {
                         // Bypass PushInventory, this must send even if redundant,
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        vInv.push_back(CInv(MSG_BLOCK, hashContinueTip));
                         pfrom->PushMessage("inv", vInv);
-                        pfrom->hashContinue.SetNull();
                     }
                 }
             }
@@ -4643,154 +5722,25 @@ void static ProcessGetData(CNode* pfrom)
                         pushed = true;
                     }
                 }
-                if (!pushed && inv.type == MSG_TXLOCK_VOTE) {
-                    boost::optional<CConsensusVote> vote = GetInstantSend().GetLockVote(inv.hash);
-                    if (vote)
-                    {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << vote.get();
-                        pfrom->PushMessage("txlvote", ss);
-                        pushed = true;
-                    }
-                }
-                if (!pushed && inv.type == MSG_TXLOCK_REQUEST) {
-                    boost::optional<CTransaction> lockedTx = GetInstantSend().GetLockReq(inv.hash);
-                    if (lockedTx)
-                    {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << lockedTx.get();
-                        pfrom->PushMessage("ix", ss);
-                        pushed = true;
-                    }
-                }
-                if (!pushed && inv.type == MSG_SPORK) {
-                    if(mapSporks.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mapSporks[inv.hash];
-                        pfrom->PushMessage("spork", ss);
-                        pushed = true;
-                    }
-                }
-                if (!pushed && inv.type == MSG_MASTERNODE_WINNER) {
-                    if(masternodePayments.mapMasternodePayeeVotes.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << masternodePayments.mapMasternodePayeeVotes[inv.hash];
-                        pfrom->PushMessage("mnw", ss);
-                        pushed = true;
-                    }
-                }
-                if (!pushed && inv.type == MSG_BUDGET_VOTE) {
-                    const CBudgetVote* item = budget.GetSeenVote(inv.hash);
-                    if(item){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << *item;
-                        pfrom->PushMessage("mvote", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_BUDGET_PROPOSAL) {
-                    const CBudgetProposalBroadcast* item = budget.GetSeenProposal(inv.hash);
-                    if(item){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << *item;
-                        pfrom->PushMessage("mprop", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_BUDGET_FINALIZED_VOTE) {
-                    const BudgetDraftVote* item = budget.GetSeenBudgetDraftVote(inv.hash);
-                    if(item){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << *item;
-                        pfrom->PushMessage("fbvote", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_BUDGET_FINALIZED) {
-                    const BudgetDraftBroadcast* item = budget.GetSeenBudgetDraft(inv.hash);
-                    if(item){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << *item;
-                        pfrom->PushMessage("fbs", ss);
-                        pushed = true;
-                    }
-                }
 
-                if (!pushed && inv.type == MSG_MASTERNODE_ANNOUNCE) {
-                    if(mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
-                        auto mnb = mnodeman.mapSeenMasternodeBroadcast[inv.hash];
-                        std::string strCommand = "mnb_new";
-                        if (pfrom->nVersion < MIN_MNW_PING_VERSION) {
-                            //Make sure this serializes to a format that is readable by the peer we are sending to
-                            mnb.lastPing.nVersion = 1;
+                if (!pushed && inv.type != MSG_TX) {
+                    // Everything else is serialized once and shared through the relay cache
+                    bool fLegacyFormat = pfrom->nVersion < MIN_MNW_PING_VERSION;
+                    boost::shared_ptr<const CRelayCache::Entry> pentry = relayCache.Get(inv, fLegacyFormat);
+                    if (!pentry) {
+                        boost::shared_ptr<CRelayCache::Entry> pentryNew(new CRelayCache::Entry());
+                        pentryNew->ss.reserve(1000);
+                        LOCK(cs_main);
+                        if (SerializeInventoryItem(inv, fLegacyFormat, pentryNew->strCommand, pentryNew->ss)) {
+                            pentry = pentryNew;
+                            relayCache.Add(inv, fLegacyFormat, pentry);
                         }
-                        if (mnb.lastPing.nVersion == 1)
-                            strCommand = "mnb";
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mnb;
-                        pfrom->PushMessage(strCommand.c_str(), ss);
-                        pushed = true;
                     }
-                }
-
-                if (!pushed && inv.type == MSG_MASTERNODE_PING) {
-                    if(mnodeman.mapSeenMasternodePing.count(inv.hash)){
-                        auto mnp = mnodeman.mapSeenMasternodePing[inv.hash];
-                        std::string strCommand = "mnp_new";
-                        if (pfrom->nVersion < MIN_MNW_PING_VERSION) {
-                            //Make sure this serializes to a format that is readable by the peer we are sending to
-                            mnp.nVersion = 1;
-                        }
-                        if (mnp.nVersion == 1)
-                            strCommand = "mnp";
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mnp;
-                        pfrom->PushMessage(strCommand.c_str(), ss);
+                    if (pentry) {
+                        pfrom->PushMessage(pentry->strCommand.c_str(), pentry->ss);
                         pushed = true;
                     }
                 }
-                if (!pushed && inv.type == MSG_SYSTEMNODE_WINNER) {
-                    if(systemnodePayments.mapSystemnodePayeeVotes.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << systemnodePayments.mapSystemnodePayeeVotes[inv.hash];
-                        pfrom->PushMessage("snw", ss);
-                        pushed = true;
-                    }
-                }
-                if (!pushed && inv.type == MSG_SYSTEMNODE_ANNOUNCE) {
-                    if(snodeman.mapSeenSystemnodeBroadcast.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << snodeman.mapSeenSystemnodeBroadcast[inv.hash];
-                        pfrom->PushMessage("snb", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_SYSTEMNODE_PING) {
-                    if(snodeman.mapSeenSystemnodePing.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << snodeman.mapSeenSystemnodePing[inv.hash];
-                        pfrom->PushMessage("snp", ss);
-                        pushed = true;
-                    }
-                }
-
 
                 if (!pushed) {
                     vNotFound.push_back(inv);
@@ -5447,7 +6397,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     // getaddr message mitigates the attack.
     else if ((strCommand == "getaddr") && (pfrom->fInbound))
     {
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -5706,6 +6659,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 LogPrint("net", "Unparseable reject message received\n");
         }
     }
+    else if (strCommand == "spork" || strCommand == "getsporks")
+    {
+        // the spork maps have their own lock, message workers handle these
+        ProcessSpork(pfrom, strCommand, vRecv);
+    }
     else
     {
         //probably one the extensions
@@ -5725,8 +6683,51 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     return true;
 }
 
+/**
+ * Whether a message can be handled by a message worker beside the message handler.
+ * Only messages whose state is locked on its own qualify. The masternode, systemnode
+ * and budget managers, their seen maps and getdata replies from them stay on the
+ * message handler, as do transactions, blocks and headers.
+ */
+static bool IsWorkerMessage(const std::string& strCommand)
+{
+    static const char* const pszWorkerCommands[] = {
+        "addr", "spork", "getsporks",
+    };
+    BOOST_FOREACH(const char* pszCommand, pszWorkerCommands)
+        if (strCommand == pszCommand)
+            return true;
+    return false;
+}
+
+static CCriticalSection cs_messageStats;
+static std::map<std::string, CMessageStats> mapMessageStats;
+
+static void RecordMessageStats(const std::string& strCommand, bool fWorker, int64_t nMicros)
+{
+    LOCK(cs_messageStats);
+    std::map<std::string, CMessageStats>::iterator mi = mapMessageStats.find(strCommand);
+    if (mi == mapMessageStats.end()) {
+        // peers choose the command names, so keep the map bounded
+        std::string strKey = mapMessageStats.size() < MAX_MESSAGE_STATS ? strCommand : "other";
+        mi = mapMessageStats.insert(std::make_pair(strKey, CMessageStats())).first;
+    }
+    CMessageStats& stats = mi->second;
+    stats.nCount++;
+    if (fWorker)
+        stats.nWorkerCount++;
+    stats.nTotalMicros += nMicros;
+    stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+}
+
+void GetMessageStats(std::map<std::string, CMessageStats>& mapStats)
+{
+    LOCK(cs_messageStats);
+    mapStats = mapMessageStats;
+}
+
 // requires LOCK(cs_vRecvMsg)
-bool ProcessMessages(CNode* pfrom)
+bool ProcessMessages(CNode* pfrom, bool fWorker)
 {
     //if (fDebug)
     //    LogPrintf("ProcessMessages(%u messages)\n", pfrom->vRecvMsg.size());
@@ -5747,6 +6748,9 @@ bool ProcessMessages(CNode* pfrom)
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // check the signatures of all masternode messages queued by this peer in one batch
+    PreverifyLegacySignatures(pfrom);
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -5784,12 +6788,22 @@ bool ProcessMessages(CNode* pfrom)
         }
         string strCommand = hdr.GetCommand();
 
+        // Hand the peer over when the message belongs on the other thread;
+        // the peer stays with one thread at a time so its messages keep their order
+        bool fWorkerMessage = HasMessageWorkers() && IsWorkerMessage(strCommand);
+        if (fWorkerMessage != fWorker) {
+            it--;
+            if (!fWorker)
+                QueueMessageWorker(pfrom);
+            break;
+        }
+
         // Message size
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
         CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+        const uint256& hash = msg.GetMessageHash();
         unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
         if (nChecksum != hdr.nChecksum)
         {
@@ -5800,9 +6814,11 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nTimeStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            RecordMessageStats(strCommand, fWorker, GetTimeMicros() - nTimeStart);
             boost::this_thread::interruption_point();
         }
         catch (std::ios_base::failure& e)
@@ -5836,7 +6852,9 @@ bool ProcessMessages(CNode* pfrom)
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
 
-        break;
+        // a message worker drains the peer's queue, the message handler takes turns between peers
+        if (!fWorker)
+            break;
     }
 
     // In case the connection got shut down, its receive buffer was wiped
@@ -5895,8 +6913,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear setAddrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->setAddrKnown.clear();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -5910,23 +6930,30 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         if (fSendTrickle)
         {
+            vector<CAddress> vAddrNew;
+            {
+                // message workers add addresses while handling addr messages
+                LOCK(pto->cs_vAddrToSend);
+                vAddrNew.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
+                {
+                    // returns true if wasn't already contained in the set
+                    if (pto->setAddrKnown.insert(addr).second)
+                        vAddrNew.push_back(addr);
+                }
+                pto->vAddrToSend.clear();
+            }
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
+            BOOST_FOREACH(const CAddress& addr, vAddrNew)
             {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second)
+                vAddr.push_back(addr);
+                // receiver rejects addr messages larger than 1000
+                if (vAddr.size() >= 1000)
                 {
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
-                    {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
-                    }
+                    pto->PushMessage("addr", vAddr);
+                    vAddr.clear();
                 }
             }
-            pto->vAddrToSend.clear();
             if (!vAddr.empty())
                 pto->PushMessage("addr", vAddr);
         }
@@ -6173,10 +7200,7 @@ class CMainCleanup
 public:
     CMainCleanup() {}
     ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        // block headers, the entries themselves are released with blockIndexArena
         mapBlockIndex.clear();
 
         // orphan transactions
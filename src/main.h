@@ -53,6 +53,7 @@ class CValidationState;
 
 struct CBlockTemplate;
 struct CNodeStateStats;
+struct CReorgCacheStats;
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 1000000;
@@ -101,8 +102,18 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Most blocks read ahead of the one being connected during -reindex and -loadblock. */
+static const unsigned int MAX_IMPORT_QUEUE_BLOCKS = 1024;
+/** Most bytes of serialized blocks read ahead during -reindex and -loadblock. */
+static const unsigned int MAX_IMPORT_QUEUE_SIZE = 64 * 1000 * 1000;
+/** Default for -reorgcache, number of recently connected blocks kept in memory with their undo data */
+static const unsigned int DEFAULT_REORG_CACHE_BLOCKS = 10;
+/** Bytes of recently sent serialized blocks kept in memory for other peers asking for them. */
+static const unsigned int RAW_BLOCK_CACHE_SIZE = 16 * MAX_BLOCK_SIZE;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
+/** Number of distinct message commands with their own handling statistics. */
+static const unsigned int MAX_MESSAGE_STATS = 256;
 /** The maximum allowed size of version 2 extra payload */
 static const unsigned int MAX_TX_EXTRA_PAYLOAD = 10000;
 
@@ -146,9 +157,17 @@ extern bool fPlatformReindex;
 extern bool fVerifying;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+/** True if any block files have ever been pruned. */
+extern bool fHavePruned;
+/** True if we're running in -prune mode. */
+extern bool fPruneMode;
+/** Number of bytes of block files that we're trying to stay below. */
+extern uint64_t nPruneTarget;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern size_t nCoinCacheUsage;
+/** Number of recently connected blocks whose body and undo data are kept in memory for reorgs. */
+extern unsigned int nReorgCacheBlocks;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern bool fLargeWorkForkFound;
@@ -167,6 +186,13 @@ extern CBlockIndex *pindexBestHeader;
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
+/** Block files containing a block within this many blocks of the tip are never pruned, one day at one minute blocks */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 1440;
+
+/** Smallest -prune target: two full block files with their undo data, plus the blocks that are kept below the tip.
+ *  It is a target only, files holding blocks the node still needs stay even when it is exceeded. */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
+
 /** Register a wallet to receive updates from core */
 void RegisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister a wallet from core */
@@ -209,8 +235,23 @@ bool InitBlockIndex();
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
-/** Process protocol messages received from a given node */
-bool ProcessMessages(CNode* pfrom);
+/** Write a snapshot of the block index that the next LoadBlockIndex uses instead of walking the database */
+bool WriteBlockIndexSnapshot();
+/** Process protocol messages received from a given node, on the message handler or a message worker */
+bool ProcessMessages(CNode* pfrom, bool fWorker);
+
+/** Time spent handling one message command */
+struct CMessageStats
+{
+    uint64_t nCount;
+    uint64_t nWorkerCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+
+    CMessageStats() : nCount(0), nWorkerCount(0), nTotalMicros(0), nMaxMicros(0) {}
+};
+/** Copy the per-command message handling statistics */
+void GetMessageStats(std::map<std::string, CMessageStats>& mapStats);
 /**
  * Send queued protocol messages to be sent to a give node.
  *
@@ -235,6 +276,8 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false);
+/** Retrieve a budget fee transaction, also after its block was pruned */
+bool GetBudgetFeeTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
 /** Find the best known block, and make it the tip of the block chain */
 
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -258,6 +301,26 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** When FlushStateToDisk writes the caches and indexes */
+enum FlushStateMode {
+    FLUSH_STATE_IF_NEEDED,
+    FLUSH_STATE_PERIODIC,
+    FLUSH_STATE_ALWAYS
+};
+/** Update the on-disk chain state as far as mode asks for */
+bool FlushStateToDisk(CValidationState &state, FlushStateMode mode);
+/** Prune block files if the -prune target is exceeded, and flush state to disk. */
+void PruneAndFlush();
+/** Calculate the amount of disk space the block and undo files currently use */
+uint64_t CalculateCurrentUsage();
+/** Delete the block and undo files with the given numbers */
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
+/** Number of blocks below the tip whose files are kept in prune mode */
+int GetPruneKeepDepth();
+/** Lowest height of the active chain with block data still stored */
+int GetPruneHeight();
+/** Get the size and hit counters of the cache of recently connected blocks */
+void GetReorgCacheStats(CReorgCacheStats& stats);
 
 
 /** (try to) add transaction to memory pool **/
@@ -280,6 +343,15 @@ struct CNodeStateStats {
     std::vector<int> vHeightInFlight;
 };
 
+struct CReorgCacheStats {
+    unsigned int nBlocks;
+    size_t nBytes;
+    uint64_t nBlockHits;
+    uint64_t nBlockMisses;
+    uint64_t nUndoHits;
+    uint64_t nUndoMisses;
+};
+
 struct CDiskTxPos : public CDiskBlockPos
 {
     unsigned int nTxOffset; // after header
@@ -355,8 +427,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight);
 
-/** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, CValidationState& state);
+/** Context-independent validity checks, apart from the NFT spork unless fCheckSpork is false */
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, bool fCheckSpork = true);
 
 /** Check for standard transaction types
  * @return True if all outputs (scriptPubKeys) use only standard transaction forms
@@ -422,6 +494,8 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 bool ReadBlockHeaderFromDisk(CBlockHeader& block, const CBlockIndex* pindex);
+/** Read the serialized block stored at pos as is, checking that its header hashes to hash */
+bool ReadRawBlockFromDisk(CDataStream& ssBlock, const CDiskBlockPos& pos, const uint256& hash);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -440,6 +514,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** The part of CheckBlock that does not look at the chain, the mempool, the sporks or the masternode lists, safe to run on any thread */
+bool CheckBlockStructure(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -110,7 +110,7 @@ bool IsBudgetCollateralValid(uint256 nTxCollateralHash, uint256 nExpectedHash, s
 {
     CTransaction txCollateral;
     uint256 nBlockHash;
-    if(!GetTransaction(nTxCollateralHash, txCollateral, nBlockHash, true)){
+    if(!GetBudgetFeeTransaction(nTxCollateralHash, txCollateral, nBlockHash)){
         strError = strprintf("Can't find collateral tx %s", txCollateral.ToString());
         LogPrintf ("CBudgetProposalBroadcast::IsBudgetCollateralValid - %s\n", strError);
         return false;
@@ -301,7 +301,7 @@ void CBudgetManager::SubmitBudgetDraft()
         CTransaction txCollateral;
         uint256 nBlockHash;
 
-        if(!GetTransaction(txidCollateral, txCollateral, nBlockHash, true)) {
+        if(!GetBudgetFeeTransaction(txidCollateral, txCollateral, nBlockHash)) {
             LogPrintf ("CBudgetManager::SubmitBudgetDraft - Can't find collateral tx %s", txidCollateral.ToString());
             return;
         }
@@ -1215,6 +1215,20 @@ const CBudgetVote* CBudgetManager::GetSeenVote(uint256 hash) const
         return &found->second;
 }
 
+void CBudgetManager::EraseSeenFromRelayCache()
+{
+    AssertLockHeld(cs);
+
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CBudgetProposalBroadcast)& item, mapSeenMasternodeBudgetProposals)
+        relayCache.Erase(CInv(MSG_BUDGET_PROPOSAL, item.first));
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CBudgetVote)& item, mapSeenMasternodeBudgetVotes)
+        relayCache.Erase(CInv(MSG_BUDGET_VOTE, item.first));
+    BOOST_FOREACH(const PAIRTYPE(const uint256, BudgetDraftBroadcast)& item, mapSeenBudgetDrafts)
+        relayCache.Erase(CInv(MSG_BUDGET_FINALIZED, item.first));
+    BOOST_FOREACH(const PAIRTYPE(const uint256, BudgetDraftVote)& item, mapSeenBudgetDraftVotes)
+        relayCache.Erase(CInv(MSG_BUDGET_FINALIZED_VOTE, item.first));
+}
+
 
 bool CBudgetManager::SubmitProposalVote(const CBudgetVote& vote, std::string& strError)
 {
@@ -1648,7 +1662,7 @@ bool CBudgetVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     CKey keyCollateralAddress;
 
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetStrMessage();
 
     if(!legacySigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrintf("CBudgetVote::Sign - Error upon calling SignMessage");
@@ -1663,10 +1677,15 @@ bool CBudgetVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     return true;
 }
 
+std::string CBudgetVote::GetStrMessage() const
+{
+    return vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+}
+
 bool CBudgetVote::SignatureValid(bool fSignatureCheck) const
 {
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetStrMessage();
 
     CMasternode* pmn = mnodeman.Find(vin);
 
@@ -2322,7 +2341,7 @@ bool BudgetDraftVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     CKey keyCollateralAddress;
 
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetStrMessage();
 
     if(!legacySigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrintf("BudgetDraftVote::Sign - Error upon calling SignMessage");
@@ -2337,11 +2356,16 @@ bool BudgetDraftVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     return true;
 }
 
+std::string BudgetDraftVote::GetStrMessage() const
+{
+    return vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+}
+
 bool BudgetDraftVote::SignatureValid(bool fSignatureCheck)
 {
     std::string errorMessage;
 
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetStrMessage();
 
     CMasternode* pmn = mnodeman.Find(vin);
 
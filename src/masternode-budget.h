@@ -71,6 +71,7 @@ public:
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck) const;
+    std::string GetStrMessage() const;
     void Relay();
 
     std::string GetVoteString() const {
@@ -128,6 +129,9 @@ private:
     std::map<uint256, BudgetDraftVote> mapSeenBudgetDraftVotes;
     std::map<uint256, BudgetDraftVote> mapOrphanBudgetDraftVotes;
 
+    //! Drop the seen items from the relay cache before they are forgotten
+    void EraseSeenFromRelayCache();
+
 public:
     CBudgetManager()
     {
@@ -138,6 +142,7 @@ public:
     void ClearSeen()
     {
         LOCK(cs);
+        EraseSeenFromRelayCache();
         mapSeenMasternodeBudgetProposals.clear();
         mapSeenMasternodeBudgetVotes.clear();
         mapSeenBudgetDrafts.clear();
@@ -207,6 +212,7 @@ public:
         LogPrintf("Budget object cleared\n");
         mapProposals.clear();
         mapBudgetDrafts.clear();
+        EraseSeenFromRelayCache();
         mapSeenMasternodeBudgetProposals.clear();
         mapSeenMasternodeBudgetVotes.clear();
         mapSeenBudgetDrafts.clear();
@@ -452,6 +458,7 @@ public:
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetStrMessage() const;
     void Relay();
 
     uint256 GetHash() const;
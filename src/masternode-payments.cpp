@@ -286,9 +286,7 @@ bool CMasternodePaymentWinner::Sign(CKey& keyMasternode, CPubKey& pubKeyMasterno
     std::string errorMessage;
     std::string strMasterNodeSignMessage;
 
-    std::string strMessage =  vinMasternode.prevout.ToStringShort() +
-                boost::lexical_cast<std::string>(nBlockHeight) +
-                payee.ToString();
+    std::string strMessage = GetStrMessage();
 
     if(!legacySigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrintf("CMasternodePing::Sign() - Error: %s\n", errorMessage.c_str());
@@ -367,11 +365,65 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
 
     int n = 1;
     if(IsReferenceNode(winnerIn.vinMasternode)) n = 100;
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, n);
+
+    LOCK(cs_mapMasternodeBlocks);
+    CMasternodeBlockPayees& blockPayees = mapMasternodeBlocks[winnerIn.nBlockHeight];
+    blockPayees.AddPayee(winnerIn.payee, n);
+    if(blockPayees.HasPayeeWithVotes(winnerIn.payee, MNPAYMENTS_PAID_VOTES_REQUIRED))
+        AddPaidHeight(winnerIn.payee, winnerIn.nBlockHeight);
 
     return true;
 }
 
+void CMasternodePayments::AddPaidHeight(const CScript& payee, int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+    mapPayeePaidHeights[payee].insert(nBlockHeight);
+}
+
+void CMasternodePayments::RemovePaidHeights(const CMasternodeBlockPayees& blockPayees)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+
+    BOOST_FOREACH(const CMasternodePayee& payee, blockPayees.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator it = mapPayeePaidHeights.find(payee.scriptPubKey);
+        if(it == mapPayeePaidHeights.end()) continue;
+
+        it->second.erase(blockPayees.nBlockHeight);
+        if(it->second.empty())
+            mapPayeePaidHeights.erase(it);
+    }
+}
+
+void CMasternodePayments::RebuildPaidIndex()
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    mapPayeePaidHeights.clear();
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.begin();
+    for(; it != mapMasternodeBlocks.end(); ++it) {
+        BOOST_FOREACH(const CMasternodePayee& payee, it->second.vecPayments) {
+            if(payee.nVotes >= MNPAYMENTS_PAID_VOTES_REQUIRED)
+                AddPaidHeight(payee.scriptPubKey, it->first);
+        }
+    }
+}
+
+int CMasternodePayments::GetLastPaidHeight(const CScript& payee, int nMaxHeight, int nMinHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator it = mapPayeePaidHeights.find(payee);
+    if(it == mapPayeePaidHeights.end()) return 0;
+
+    // the first paid height above nMaxHeight, step back once to get the most recent one in range
+    std::set<int>::const_iterator itHeight = it->second.upper_bound(nMaxHeight);
+    if(itHeight == it->second.begin()) return 0;
+    --itHeight;
+
+    return *itHeight >= nMinHeight ? *itHeight : 0;
+}
+
 bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew, const CAmount& nValueCreated)
 {
     LOCK(cs_vecPayments);
@@ -494,8 +546,14 @@ void CMasternodePayments::CheckAndRemove()
         if(nHeight - winner.nBlockHeight > nLimit){
             LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
             masternodeSync.mapSeenSyncMNW.erase((*it).first);
+            relayCache.Erase(CInv(MSG_MASTERNODE_WINNER, (*it).first));
             mapMasternodePayeeVotes.erase(it++);
-            mapMasternodeBlocks.erase(winner.nBlockHeight);
+
+            std::map<int, CMasternodeBlockPayees>::iterator itBlock = mapMasternodeBlocks.find(winner.nBlockHeight);
+            if(itBlock != mapMasternodeBlocks.end()) {
+                RemovePaidHeights(itBlock->second);
+                mapMasternodeBlocks.erase(itBlock);
+            }
         } else {
             ++it;
         }
@@ -638,6 +696,13 @@ void CMasternodePaymentWinner::Relay()
     RelayInv(inv);
 }
 
+std::string CMasternodePaymentWinner::GetStrMessage() const
+{
+    return vinMasternode.prevout.ToStringShort() +
+           boost::lexical_cast<std::string>(nBlockHeight) +
+           payee.ToString();
+}
+
 bool CMasternodePaymentWinner::SignatureValid()
 {
 
@@ -645,9 +710,7 @@ bool CMasternodePaymentWinner::SignatureValid()
 
     if(pmn != NULL)
     {
-        std::string strMessage =  vinMasternode.prevout.ToStringShort() +
-                    boost::lexical_cast<std::string>(nBlockHeight) +
-                    payee.ToString();
+        std::string strMessage = GetStrMessage();
 
         std::string errorMessage = "";
         if(!legacySigner.VerifyMessage(pmn->pubkey2, vchSig, strMessage, errorMessage)){
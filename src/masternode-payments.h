@@ -10,6 +10,7 @@
 #include "main.h"
 #include "masternode.h"
 #include <boost/lexical_cast.hpp>
+#include <set>
 
 using namespace std;
 
@@ -25,6 +26,7 @@ extern CMasternodePayments masternodePayments;
 
 #define MNPAYMENTS_SIGNATURES_REQUIRED           6
 #define MNPAYMENTS_SIGNATURES_TOTAL              10
+#define MNPAYMENTS_PAID_VOTES_REQUIRED           2
 #define MN_PMT_SLOT                              1
 
 void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
@@ -161,6 +163,7 @@ public:
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool IsValid(CNode* pnode, std::string& strError);
     bool SignatureValid();
+    std::string GetStrMessage() const;
     void Relay();
 
     void AddPayee(CScript payeeIn){
@@ -200,6 +203,13 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    // Heights at which each payee collected at least MNPAYMENTS_PAID_VOTES_REQUIRED winner votes,
+    // kept in step with mapMasternodeBlocks so last paid lookups don't have to walk the chain
+    std::map<CScript, std::set<int> > mapPayeePaidHeights;
+
+    void AddPaidHeight(const CScript& payee, int nBlockHeight);
+    void RemovePaidHeights(const CMasternodeBlockPayees& blockPayees);
+
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
@@ -213,7 +223,10 @@ public:
     void Clear() {
         LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
         mapMasternodeBlocks.clear();
+        BOOST_FOREACH(const PAIRTYPE(const uint256, CMasternodePaymentWinner)& item, mapMasternodePayeeVotes)
+            relayCache.Erase(CInv(MSG_MASTERNODE_WINNER, item.first));
         mapMasternodePayeeVotes.clear();
+        mapPayeePaidHeights.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -221,6 +234,9 @@ public:
 
     void Sync(CNode* node, int nCountNeeded);
     void CheckAndRemove();
+    /// Most recent height in [nMinHeight, nMaxHeight] at which payee was paid, 0 if there is none
+    int GetLastPaidHeight(const CScript& payee, int nMaxHeight, int nMinHeight);
+    void RebuildPaidIndex();
     int LastPayment(CMasternode& mn);
 
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
@@ -243,6 +259,8 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            RebuildPaidIndex();
     }
 };
 
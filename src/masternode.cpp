@@ -78,6 +78,7 @@ CMasternode::CMasternode()
     nScanningErrorCount = 0;
     nLastScanningErrorBlockHeight = 0;
     lastTimeChecked = 0;
+    nCacheCollateralHeight = -1;
 }
 
 CMasternode::CMasternode(const CMasternode& other)
@@ -97,6 +98,7 @@ CMasternode::CMasternode(const CMasternode& other)
     unitTest = other.unitTest;
     allowFreeTx = other.allowFreeTx;
     protocolVersion = other.protocolVersion;
+    nCacheCollateralHeight = other.nCacheCollateralHeight;
     nLastDsq = other.nLastDsq;
     nScanningErrorCount = other.nScanningErrorCount;
     nLastScanningErrorBlockHeight = other.nLastScanningErrorBlockHeight;
@@ -124,6 +126,20 @@ CMasternode::CMasternode(const CMasternodeBroadcast& mnb)
     nScanningErrorCount = 0;
     nLastScanningErrorBlockHeight = 0;
     lastTimeChecked = 0;
+    nCacheCollateralHeight = -1;
+}
+
+int CMasternode::GetCollateralHeight() const
+{
+    if(nCacheCollateralHeight >= 0)
+        return nCacheCollateralHeight;
+
+    int nHeight = GetInputHeight(vin);
+    // only a confirmed collateral has a height that won't change until a reorg
+    if(nHeight >= 0 && nHeight != MEMPOOL_HEIGHT)
+        nCacheCollateralHeight = nHeight;
+
+    return nHeight;
 }
 
 //
@@ -159,7 +175,7 @@ arith_uint256 CMasternode::CalculateScore(int64_t nBlockHeight) const
         return arith_uint256();
 
     // Find the block hash where tx got MASTERNODE_MIN_CONFIRMATIONS
-    CBlockIndex *pblockIndex = chainActive[GetInputHeight(vin) + MASTERNODE_MIN_CONFIRMATIONS - 1];
+    CBlockIndex *pblockIndex = chainActive[GetCollateralHeight() + MASTERNODE_MIN_CONFIRMATIONS - 1];
     if (!pblockIndex)
         return arith_uint256();
     uint256 collateralMinConfBlockHash = pblockIndex->GetBlockHash();
@@ -229,12 +245,9 @@ bool CMasternode::IsValidNetAddr() const
     return (addr.IsIPv4() && addr.IsRoutable());
 }
 
-int64_t CMasternode::SecondsSincePayment() const
+int64_t CMasternode::SecondsSincePayment(int nMaxBlocksAgo) const
 {
-    CScript pubkeyScript;
-    pubkeyScript = GetScriptForDestination(pubkey.GetID());
-
-    int64_t sec = (GetAdjustedTime() - GetLastPaid());
+    int64_t sec = (GetAdjustedTime() - GetLastPaid(nMaxBlocksAgo));
     int64_t month = 60*60*24*30;
     if(sec < month) return sec; //if it's less than 30 days, give seconds
 
@@ -247,7 +260,7 @@ int64_t CMasternode::SecondsSincePayment() const
     return month + UintToArith256(hash).GetCompact(false);
 }
 
-int64_t CMasternode::GetLastPaid() const
+int64_t CMasternode::GetLastPaid(int nMaxBlocksAgo) const
 {
     CBlockIndex* pindexPrev = chainActive.Tip();
     if(pindexPrev == NULL) return false;
@@ -263,33 +276,19 @@ int64_t CMasternode::GetLastPaid() const
     // use a deterministic offset to break a tie -- 2.5 minutes
     int64_t nOffset = UintToArith256(hash).GetCompact(false) % 150; 
 
-    if (chainActive.Tip() == NULL) return false;
+    if(nMaxBlocksAgo < 0)
+        nMaxBlocksAgo = mnodeman.CountEnabled()*1.25;
 
-    const CBlockIndex *BlockReading = chainActive.Tip();
-
-    int nMnCount = mnodeman.CountEnabled()*1.25;
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if(n >= nMnCount){
-            return 0;
-        }
-        n++;
+    /*
+        Search for this payee, with at least 2 votes. This will aid in consensus allowing the network 
+        to converge on the same payees quickly, then keep the same schedule.
+    */
+    int nMinHeight = std::max(pindexPrev->nHeight - nMaxBlocksAgo + 1, 1);
+    int nPaidHeight = masternodePayments.GetLastPaidHeight(mnpayee, pindexPrev->nHeight, nMinHeight);
+    if(nPaidHeight == 0)
+        return 0;
 
-        if(masternodePayments.mapMasternodeBlocks.count(BlockReading->nHeight)){
-            /*
-                Search for this payee, with at least 2 votes. This will aid in consensus allowing the network 
-                to converge on the same payees quickly, then keep the same schedule.
-            */
-            if(masternodePayments.mapMasternodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2)){
-                return BlockReading->nTime + nOffset;
-            }
-        }
-
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
-    }
-
-    return 0;
+    return chainActive[nPaidHeight]->nTime + nOffset;
 }
 
 
@@ -536,8 +535,7 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos) const
     if(protocolVersion <= 99999999) {
         std::string vchPubKey(pubkey.begin(), pubkey.end());
         std::string vchPubKey2(pubkey2.begin(), pubkey2.end());
-        strMessage = addr.ToString(false) + boost::lexical_cast<std::string>(sigTime) +
-                        vchPubKey + vchPubKey2 + boost::lexical_cast<std::string>(protocolVersion);
+        strMessage = GetStrMessage();
 
         LogPrint("masternode", "mnb - sanitized strMessage: %s, pubkey address: %s, sig: %s\n",
             SanitizeString(strMessage), CBitcoinAddress(pubkey.GetID()).ToString(),
@@ -568,9 +566,7 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos) const
             }
         }
     } else {
-        strMessage = addr.ToString(false) + boost::lexical_cast<std::string>(sigTime) +
-                        pubkey.GetID().ToString() + pubkey2.GetID().ToString() +
-                        boost::lexical_cast<std::string>(protocolVersion);
+        strMessage = GetStrMessage();
 
         LogPrint("masternode", "mnb - strMessage: %s, pubkey address: %s, sig: %s\n",
             strMessage, CBitcoinAddress(pubkey.GetID()).ToString(), EncodeBase64(&sig[0], sig.size()));
@@ -609,7 +605,7 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos) const
     if(pmn->pubkey == pubkey && !pmn->IsBroadcastedWithin(MASTERNODE_MIN_MNB_SECONDS)) {
         //take the newest entry
         LogPrintf("mnb - Got updated entry for %s\n", addr.ToString());
-        if(pmn->UpdateFromNewBroadcast((*this))){
+        if(mnodeman.UpdateFromNewBroadcast(*pmn, *this)){
             pmn->Check();
             if(pmn->IsEnabled()) Relay();
         }
@@ -652,6 +648,7 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS) const
             // not mnb fault, let it to be checked again later
             mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
             masternodeSync.mapSeenSyncMNB.erase(GetHash());
+            relayCache.Erase(CInv(MSG_MASTERNODE_ANNOUNCE, GetHash()));
             return false;
         }
 
@@ -669,6 +666,7 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS) const
         // maybe we miss few blocks, let this mnb to be checked again later
         mnodeman.mapSeenMasternodeBroadcast.erase(GetHash());
         masternodeSync.mapSeenSyncMNB.erase(GetHash());
+        relayCache.Erase(CInv(MSG_MASTERNODE_ANNOUNCE, GetHash()));
         return false;
     }
 
@@ -742,6 +740,20 @@ bool CMasternodeBroadcast::Sign(const CKey& keyCollateralAddress)
     return true;
 }
 
+std::string CMasternodeBroadcast::GetStrMessage() const
+{
+    if(protocolVersion <= 99999999) {
+        std::string vchPubKey(pubkey.begin(), pubkey.end());
+        std::string vchPubKey2(pubkey2.begin(), pubkey2.end());
+        return addr.ToString(false) + boost::lexical_cast<std::string>(sigTime) +
+                  vchPubKey + vchPubKey2 + boost::lexical_cast<std::string>(protocolVersion);
+    }
+
+    return addr.ToString(false) + boost::lexical_cast<std::string>(sigTime) +
+              pubkey.GetID().ToString() + pubkey2.GetID().ToString() +
+              boost::lexical_cast<std::string>(protocolVersion);
+}
+
 bool CMasternodeBroadcast::VerifySignature() const
 {
     std::string errorMessage;
@@ -794,7 +806,7 @@ bool CMasternodePing::Sign(const CKey& keyMasternode, const CPubKey& pubKeyMaste
     std::string strMasterNodeSignMessage;
 
     sigTime = GetAdjustedTime();
-    std::string strMessage = vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
+    std::string strMessage = GetStrMessage();
 
     if(!legacySigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrintf("CMasternodePing::Sign() - Error: %s\n", errorMessage);
@@ -820,9 +832,14 @@ bool CMasternodePing::Sign(const CKey& keyMasternode, const CPubKey& pubKeyMaste
     return true;
 }
 
+std::string CMasternodePing::GetStrMessage() const
+{
+    return vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
+}
+
 bool CMasternodePing::VerifySignature(const CPubKey& pubKeyMasternode, int &nDos) const
 {
-    std::string strMessage = vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
+    std::string strMessage = GetStrMessage();
     std::string errorMessage = "";
 
     if(!legacySigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, errorMessage))
@@ -907,6 +924,7 @@ bool CMasternodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled, bool fChec
             uint256 hash = mnb.GetHash();
             if(mnodeman.mapSeenMasternodeBroadcast.count(hash)) {
                 mnodeman.mapSeenMasternodeBroadcast[hash].lastPing = *this;
+                relayCache.Erase(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
             }
 
             pmn->Check(true);
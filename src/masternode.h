@@ -75,6 +75,7 @@ public:
     bool CheckAndUpdate(int& nDos, bool fRequireEnabled = true, bool fCheckSigTimeOnly = false) const;
     bool Sign(const CKey& keyMasternode, const CPubKey& pubKeyMasternode);
     bool VerifySignature(const CPubKey& pubKeyMasternode, int &nDos) const;
+    std::string GetStrMessage() const;
     void Relay() const;
 
     uint256 GetHash() const
@@ -123,6 +124,8 @@ private:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
     int64_t lastTimeChecked;
+    // height of the block that confirmed vin, -1 while unknown
+    mutable int nCacheCollateralHeight;
 public:
     enum state
     {
@@ -140,6 +143,7 @@ public:
     std::vector<unsigned char> sig;
     int activeState;
     int64_t sigTime; //mnb message time
+    // no longer used, kept for the mncache.dat format
     int cacheInputAge;
     int cacheInputAgeBlock;
     bool unitTest;
@@ -180,6 +184,7 @@ public:
         swap(first.nScanningErrorCount, second.nScanningErrorCount);
         swap(first.nLastScanningErrorBlockHeight, second.nLastScanningErrorBlockHeight);
         swap(first.vchSignover, second.vchSignover);
+        swap(first.nCacheCollateralHeight, second.nCacheCollateralHeight);
     }
 
     CMasternode& operator=(CMasternode from)
@@ -224,7 +229,7 @@ public:
         READWRITE(vchSignover);
     }
 
-    int64_t SecondsSincePayment() const;
+    int64_t SecondsSincePayment(int nMaxBlocksAgo = -1) const;
     bool UpdateFromNewBroadcast(const CMasternodeBroadcast& mnb);
     void Check(bool forceCheck = false);
 
@@ -255,16 +260,21 @@ public:
 
     bool IsValidNetAddr() const;
 
-    int GetMasternodeInputAge()
+    int GetMasternodeInputAge() const
     {
         if(chainActive.Tip() == NULL) return 0;
 
-        if(cacheInputAge == 0){
-            cacheInputAge = GetInputAge(vin);
-            cacheInputAgeBlock = chainActive.Tip()->nHeight;
-        }
+        int nCollateralHeight = GetCollateralHeight();
+        if(nCollateralHeight < 0 || nCollateralHeight == MEMPOOL_HEIGHT) return 0;
+
+        return (chainActive.Tip()->nHeight + 1) - nCollateralHeight;
+    }
 
-        return cacheInputAge+(chainActive.Tip()->nHeight-cacheInputAgeBlock);
+    /// Height of the block that confirmed vin, looked up once and kept until that block is disconnected
+    int GetCollateralHeight() const;
+    void BlockDisconnected(int nHeight)
+    {
+        if(nCacheCollateralHeight >= nHeight) nCacheCollateralHeight = -1;
     }
 
     std::string Status() const
@@ -280,7 +290,8 @@ public:
         return strStatus;
     }
 
-    int64_t GetLastPaid() const;
+    /// Time of the last payment within nMaxBlocksAgo blocks of the tip, defaults to 1.25 times the enabled node count
+    int64_t GetLastPaid(int nMaxBlocksAgo = -1) const;
 
     bool GetRecentPaymentBlocks(std::vector<const CBlockIndex*>& vPaymentBlocks, bool limitMostRecent = false) const;
 };
@@ -305,6 +316,8 @@ public:
     bool CheckInputsAndAdd(int& nDos) const;
     bool Sign(const CKey& keyCollateralAddress);
     bool VerifySignature() const;
+    /// Message CheckAndUpdate verifies sig against first
+    std::string GetStrMessage() const;
     void Relay() const;
 
     ADD_SERIALIZE_METHODS;
@@ -35,15 +35,6 @@ struct CompareScoreTxIn
     }
 };
 
-struct CompareScoreMN
-{
-    bool operator()(const pair<int64_t, CMasternode>& t1,
-                    const pair<int64_t, CMasternode>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
-
 CMasternodeMan::CMasternodeMan() {
     nDsqCount = 0;
 }
@@ -60,6 +51,8 @@ bool CMasternodeMan::Add(const CMasternode &mn)
     {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.addr.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        indexMasternodes.Add(vMasternodes.back(), vMasternodes.size() - 1);
+        mapRankCache.clear();
         return true;
     }
 
@@ -99,6 +92,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
+    bool fRemoved = false;
     vector<CMasternode>::iterator it = vMasternodes.begin();
     while(it != vMasternodes.end()){
         if((*it).activeState == CMasternode::MASTERNODE_REMOVE ||
@@ -114,6 +108,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             while(it3 != mapSeenMasternodeBroadcast.end()){
                 if((*it3).second.vin == (*it).vin){
                     masternodeSync.mapSeenSyncMNB.erase((*it3).first);
+                    relayCache.Erase(CInv(MSG_MASTERNODE_ANNOUNCE, (*it3).first));
                     mapSeenMasternodeBroadcast.erase(it3++);
                 } else {
                     ++it3;
@@ -131,11 +126,17 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            fRemoved = true;
         } else {
             ++it;
         }
     }
 
+    if(fRemoved) {
+        indexMasternodes.Rebuild(vMasternodes);
+        mapRankCache.clear();
+    }
+
     // check who's asked for the Masternode list
     map<CNetAddr, int64_t>::iterator it1 = mAskedUsForMasternodeList.begin();
     while(it1 != mAskedUsForMasternodeList.end()){
@@ -172,6 +173,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
         if((*it3).second.lastPing.sigTime < GetTime() - MASTERNODE_REMOVAL_SECONDS*2){
             LogPrint("masternode", "CMasternodeMan::CheckAndRemove - Removing expired Masternode broadcast %s\n", (*it3).second.GetHash().ToString());
             masternodeSync.mapSeenSyncMNB.erase((*it3).second.GetHash());
+            relayCache.Erase(CInv(MSG_MASTERNODE_ANNOUNCE, (*it3).first));
             mapSeenMasternodeBroadcast.erase(it3++);
         } else {
             ++it3;
@@ -182,6 +184,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     map<uint256, CMasternodePing>::iterator it4 = mapSeenMasternodePing.begin();
     while(it4 != mapSeenMasternodePing.end()){
         if((*it4).second.sigTime < GetTime()-(MASTERNODE_REMOVAL_SECONDS*2)){
+            relayCache.Erase(CInv(MSG_MASTERNODE_PING, (*it4).first));
             mapSeenMasternodePing.erase(it4++);
         } else {
             ++it4;
@@ -194,14 +197,28 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    indexMasternodes.Clear();
+    mapRankCache.clear();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CMasternodeBroadcast)& item, mapSeenMasternodeBroadcast)
+        relayCache.Erase(CInv(MSG_MASTERNODE_ANNOUNCE, item.first));
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CMasternodePing)& item, mapSeenMasternodePing)
+        relayCache.Erase(CInv(MSG_MASTERNODE_PING, item.first));
     mapSeenMasternodeBroadcast.clear();
     mapSeenMasternodePing.clear();
     nDsqCount = 0;
 }
 
+void CMasternodeMan::BlockDisconnected(int nHeight)
+{
+    LOCK(cs);
+    BOOST_FOREACH(CMasternode& mn, vMasternodes)
+        mn.BlockDisconnected(nHeight);
+    mapRankCache.clear();
+}
+
 int CMasternodeMan::CountEnabled(int protocolVersion)
 {
     int i = 0;
@@ -241,27 +258,17 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
 CMasternode *CMasternodeMan::Find(const CScript &payee)
 {
     LOCK(cs);
-    CScript payee2;
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        payee2 = GetScriptForDestination(mn.pubkey.GetID());
-        if(payee2 == payee)
-            return &mn;
-    }
-    return NULL;
+    int nPos = indexMasternodes.Find(payee);
+    return nPos < 0 ? NULL : &vMasternodes[nPos];
 }
 
 CMasternode *CMasternodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    int nPos = indexMasternodes.Find(vin.prevout);
+    return nPos < 0 ? NULL : &vMasternodes[nPos];
 }
 
 
@@ -269,24 +276,16 @@ CMasternode *CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.pubkey2 == pubKeyMasternode)
-            return &mn;
-    }
-    return NULL;
+    int nPos = indexMasternodes.Find(pubKeyMasternode);
+    return nPos < 0 ? NULL : &vMasternodes[nPos];
 }
 
 CMasternode *CMasternodeMan::Find(const CService& addr)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.addr == addr)
-            return &mn;
-    }
-    return NULL;
+    int nPos = indexMasternodes.Find(addr);
+    return nPos < 0 ? NULL : &vMasternodes[nPos];
 }
 
 // 
@@ -304,6 +303,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     */
 
     int nMnCount = CountEnabled();
+    int nLastPaidDepth = nMnCount*1.25;
     BOOST_FOREACH(CMasternode &mn, vMasternodes)
     {
         mn.Check();
@@ -322,7 +322,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         //make sure it has as many confirmations as there are masternodes
         if(mn.GetMasternodeInputAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(), mn.vin));
+        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(nLastPaidDepth), mn.vin));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
@@ -337,7 +337,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = CountEnabled()/10;
+    int nTenthNetwork = nMnCount/10;
     int nCountTenth = 0; 
     arith_uint256 nHigh = 0;
     BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn)& s, vecMasternodeLastPaid){
@@ -389,53 +389,82 @@ CMasternode *CMasternodeMan::FindRandomNotInVec(std::vector<CTxIn> &vecToExclude
 
 CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
-    int64_t score = 0;
-    CMasternode* winner = NULL;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-        mn.Check();
-        if(mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
+    const std::vector<pair<int64_t, CTxIn> >* pvecScores = GetScores(nBlockHeight);
+    if(pvecScores == NULL) return NULL;
 
-        // calculate the score for each Masternode
-        arith_uint256 n = mn.CalculateScore(nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+    // the first enabled entry with a non zero score is the winner
+    BOOST_FOREACH(const PAIRTYPE(int64_t, CTxIn)& s, *pvecScores) {
+        if(s.first <= 0) break;
 
-        // determine the winner
-        if(n2 > score){
-            score = n2;
-            winner = &mn;
-        }
+        CMasternode* pmn = Find(s.second);
+        if(pmn == NULL) continue;
+
+        pmn->Check();
+        if(pmn->protocolVersion < minProtocol || !pmn->IsEnabled()) continue;
+
+        return pmn;
     }
 
-    return winner;
+    return NULL;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const std::vector<pair<int64_t, CTxIn> >* CMasternodeMan::GetScores(int64_t nBlockHeight)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
+
+    if(chainActive.Tip() == NULL) return NULL;
+
+    // scores depend on the chain, start over whenever the tip moves
+    if(hashRankCacheTip != chainActive.Tip()->GetBlockHash()) {
+        mapRankCache.clear();
+        hashRankCacheTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    // height 0 stands for the tip when calculating scores
+    if(nBlockHeight == 0) nBlockHeight = chainActive.Tip()->nHeight;
+
+    std::map<int64_t, std::vector<pair<int64_t, CTxIn> > >::const_iterator it = mapRankCache.find(nBlockHeight);
+    if(it != mapRankCache.end()) return &it->second;
 
     //make sure we know about this block
     uint256 hash = uint256();
-    if(!GetBlockHash(hash, nBlockHeight)) return -1;
+    if(!GetBlockHash(hash, nBlockHeight)) return NULL;
 
-    // scan for winner
+    std::vector<pair<int64_t, CTxIn> > vecScores;
+    vecScores.reserve(vMasternodes.size());
     BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-        if(mn.protocolVersion < minProtocol) continue;
-        if(fOnlyActive) {
-            mn.Check();
-            if(!mn.IsEnabled()) continue;
-        }
-        arith_uint256 n = mn.CalculateScore(nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
+        int64_t n2 = mn.CalculateScore(nBlockHeight).GetCompact(false);
+        vecScores.push_back(make_pair(n2, mn.vin));
     }
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
+    sort(vecScores.rbegin(), vecScores.rend(), CompareScoreTxIn());
+
+    if(mapRankCache.size() >= MASTERNODES_RANK_CACHE_HEIGHTS)
+        mapRankCache.erase(mapRankCache.begin());
+
+    std::vector<pair<int64_t, CTxIn> >& vecCached = mapRankCache[nBlockHeight];
+    vecCached.swap(vecScores);
+    return &vecCached;
+}
+
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    LOCK(cs);
+
+    const std::vector<pair<int64_t, CTxIn> >* pvecScores = GetScores(nBlockHeight);
+    if(pvecScores == NULL) return -1;
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn)& s, vecMasternodeScores){
+    BOOST_FOREACH(const PAIRTYPE(int64_t, CTxIn)& s, *pvecScores) {
+        CMasternode* pmn = Find(s.second);
+        if(pmn == NULL || pmn->protocolVersion < minProtocol) continue;
+        if(fOnlyActive) {
+            pmn->Check();
+            if(!pmn->IsEnabled()) continue;
+        }
+
         rank++;
         if(s.second.prevout == vin.prevout) {
             return rank;
@@ -445,35 +474,23 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
     return -1;
 }
 
-std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
+std::vector<pair<int, CTxIn> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<pair<int64_t, CMasternode> > vecMasternodeScores;
-    std::vector<pair<int, CMasternode> > vecMasternodeRanks;
-
-    //make sure we know about this block
-    uint256 hash = uint256();
-    if(!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
-
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        mn.Check();
+    LOCK(cs);
 
-        if(mn.protocolVersion < minProtocol) continue;
-        if(!mn.IsEnabled()) {
-            continue;
-        }
+    std::vector<pair<int, CTxIn> > vecMasternodeRanks;
 
-        arith_uint256 n = mn.CalculateScore(nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+    const std::vector<pair<int64_t, CTxIn> >* pvecScores = GetScores(nBlockHeight);
+    if(pvecScores == NULL) return vecMasternodeRanks;
 
-        vecMasternodeScores.push_back(make_pair(n2, mn));
-    }
+    int rank = 0;
+    BOOST_FOREACH(const PAIRTYPE(int64_t, CTxIn)& s, *pvecScores) {
+        CMasternode* pmn = Find(s.second);
+        if(pmn == NULL) continue;
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+        pmn->Check();
+        if(pmn->protocolVersion < minProtocol || !pmn->IsEnabled()) continue;
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode)& s, vecMasternodeScores){
         rank++;
         vecMasternodeRanks.push_back(make_pair(rank, s.second));
     }
@@ -483,30 +500,23 @@ std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    const std::vector<pair<int64_t, CTxIn> >* pvecScores = GetScores(nBlockHeight);
+    if(pvecScores == NULL) return NULL;
 
-        if(mn.protocolVersion < minProtocol) continue;
+    int rank = 0;
+    BOOST_FOREACH(const PAIRTYPE(int64_t, CTxIn)& s, *pvecScores) {
+        CMasternode* pmn = Find(s.second);
+        if(pmn == NULL || pmn->protocolVersion < minProtocol) continue;
         if(fOnlyActive) {
-            mn.Check();
-            if(!mn.IsEnabled()) continue;
+            pmn->Check();
+            if(!pmn->IsEnabled()) continue;
         }
 
-        arith_uint256 n = mn.CalculateScore(nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn)& s, vecMasternodeScores){
         rank++;
         if(rank == nRank) {
-            return Find(s.second);
+            return pmn;
         }
     }
 
@@ -655,6 +665,8 @@ void CMasternodeMan::Remove(CTxIn vin)
         if((*it).vin == vin){
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).addr.ToString(), size() - 1);
             vMasternodes.erase(it);
+            indexMasternodes.Rebuild(vMasternodes);
+            mapRankCache.clear();
             break;
         }
         ++it;
@@ -687,10 +699,24 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb) {
         CMasternode mn(mnb);
         Add(mn);
     } else {
-        pmn->UpdateFromNewBroadcast(mnb);
+        UpdateFromNewBroadcast(*pmn, mnb);
     }
 }
 
+bool CMasternodeMan::UpdateFromNewBroadcast(CMasternode& mn, const CMasternodeBroadcast& mnb)
+{
+    LOCK(cs);
+
+    CPubKey pubkey2Old = mn.pubkey2;
+    CService addrOld = mn.addr;
+    if(!mn.UpdateFromNewBroadcast(mnb)) return false;
+
+    if(mn.pubkey2 != pubkey2Old || mn.addr != addrOld)
+        indexMasternodes.Rebuild(vMasternodes);
+
+    return true;
+}
+
 bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CMasternodeBroadcast mnb, int& nDos) {
     nDos = 0;
     LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList - Masternode broadcast, vin: %s\n", mnb.vin.ToString());
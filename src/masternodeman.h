@@ -13,9 +13,11 @@
 #include "base58.h"
 #include "main.h"
 #include "masternode.h"
+#include "nodeindex.h"
 
 #define MASTERNODES_DUMP_SECONDS               (15*60)
 #define MASTERNODES_DSEG_SECONDS               (3*60*60)
+#define MASTERNODES_RANK_CACHE_HEIGHTS        16
 
 using namespace std;
 
@@ -35,6 +37,12 @@ private:
 
     // map to hold all MNs
     std::vector<CMasternode> vMasternodes;
+    // lookup tables into vMasternodes, rebuilt whenever an entry is removed
+    CNodeIndex<CMasternode> indexMasternodes;
+    // scores of every entry for recently requested heights, sorted high to low and
+    // shared by all rank lookups until the tip or the list changes
+    std::map<int64_t, std::vector<pair<int64_t, CTxIn> > > mapRankCache;
+    uint256 hashRankCacheTip;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -57,6 +65,10 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         LOCK(cs);
         READWRITE(vMasternodes);
+        if (ser_action.ForRead()) {
+            indexMasternodes.Rebuild(vMasternodes);
+            mapRankCache.clear();
+        }
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -84,6 +96,9 @@ public:
     /// Clear Masternode vector
     void Clear();
 
+    /// Forget cached collateral heights at or above a disconnected block
+    void BlockDisconnected(int nHeight);
+
     int CountEnabled(int protocolVersion = -1);
 
     void DsegUpdate(CNode* pnode);
@@ -105,7 +120,10 @@ public:
 
     std::vector<CMasternode> GetFullMasternodeVector() { Check(); return vMasternodes; }
 
-    std::vector<pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol=0);
+    /// Scores of all entries at nBlockHeight sorted high to low, NULL if the block is unknown
+    const std::vector<pair<int64_t, CTxIn> >* GetScores(int64_t nBlockHeight);
+
+    std::vector<pair<int, CTxIn> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol=0);
     int GetMasternodeRank(const CTxIn &vin, int64_t nBlockHeight, int minProtocol=0, bool fOnlyActive=true);
     CMasternode* GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol=0, bool fOnlyActive=true);
 
@@ -120,6 +138,9 @@ public:
 
     void Remove(CTxIn vin);
 
+    /// Update an entry from a newer broadcast, keeping the lookup tables in sync
+    bool UpdateFromNewBroadcast(CMasternode& mn, const CMasternodeBroadcast& mnb);
+
     /// Update masternode list and maps using provided CMasternodeBroadcast
     void UpdateMasternodeList(CMasternodeBroadcast mnb);
     /// Perform complete check and only then update list and maps
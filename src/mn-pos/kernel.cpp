@@ -1,11 +1,13 @@
 
 #include <iostream>
+#include <string.h>
 #include <arith_uint256.h>
 #include "kernel.h"
 #include "../streams.h"
 #include "../hash.h"
 #include "stakepointer.h"
 #include "../tinyformat.h"
+#include "../crypto/common.h"
 
 /*
  * A 'proof hash' (also referred to as a 'kernel') is comprised of the following:
@@ -22,13 +24,47 @@ Kernel::Kernel(const std::pair<uint256, unsigned int>& outpoint, const uint64_t
     m_nStakeModifier = nStakeModifier;
     m_nTimeBlockFrom = nTimeBlockFrom;
     m_nTimeStake = nTimeStake;
+
+    // The stake time is serialized last, hash everything in front of it once
+    CDataStream ss(SER_GETHASH, 0);
+    ss << m_outpoint.first << m_outpoint.second << m_nStakeModifier << m_nTimeBlockFrom;
+    m_hasherPrefix.Write((const unsigned char*)&ss[0], ss.size());
+}
+
+uint256 Kernel::HashStakeTime(uint64_t nTimeStake) const
+{
+    unsigned char vchTime[8];
+    WriteLE64(vchTime, nTimeStake);
+
+    uint256 hash;
+    unsigned char buf[CSHA256::OUTPUT_SIZE];
+    CSHA256 hasher(m_hasherPrefix);
+    hasher.Write(vchTime, sizeof(vchTime)).Finalize(buf);
+    CSHA256().Write(buf, sizeof(buf)).Finalize(hash.begin());
+    return hash;
 }
 
 uint256 Kernel::GetStakeHash()
 {
-    CDataStream ss(SER_GETHASH, 0);
-    ss << m_outpoint.first << m_outpoint.second << m_nStakeModifier << m_nTimeBlockFrom << m_nTimeStake;
-    return Hash(ss.begin(), ss.end());
+    return HashStakeTime(m_nTimeStake);
+}
+
+void Kernel::GetStakeHashes(uint64_t nTimeStart, unsigned int nCount, uint256* pHashes) const
+{
+    // The candidates only differ in the stake time, so they are hashed side by side from the prefix state
+    unsigned char vchTimes[8 * HASH_BATCH_SIZE];
+    unsigned char vchHashes[CSHA256::OUTPUT_SIZE * HASH_BATCH_SIZE];
+    while (nCount > 0) {
+        unsigned int nBatch = nCount < HASH_BATCH_SIZE ? nCount : HASH_BATCH_SIZE;
+        for (unsigned int i = 0; i < nBatch; ++i)
+            WriteLE64(vchTimes + 8 * i, nTimeStart + i);
+        m_hasherPrefix.FinalizeDoubleTails(vchTimes, 8, nBatch, vchHashes);
+        for (unsigned int i = 0; i < nBatch; ++i)
+            memcpy(pHashes[i].begin(), vchHashes + CSHA256::OUTPUT_SIZE * i, CSHA256::OUTPUT_SIZE);
+        nTimeStart += nBatch;
+        pHashes += nBatch;
+        nCount -= nBatch;
+    }
 }
 
 uint64_t Kernel::GetTime() const
@@ -1,6 +1,7 @@
 #ifndef CROWN_CORE_KERNEL_H
 #define CROWN_CORE_KERNEL_H
 
+#include "crypto/sha256.h"
 #include "uint256.h"
 
 class arith_uint256;
@@ -12,19 +13,29 @@ public:
     Kernel(const std::pair<uint256, unsigned int>& outpoint, const uint64_t nAmount, const uint256& nStakeModifier,
             const uint64_t& nTimeBlockFrom, const uint64_t& nTimeStake);
     uint256 GetStakeHash();
+    //! Stake hashes for nCount consecutive stake times starting at nTimeStart, the kernel's own stake time is left alone
+    void GetStakeHashes(uint64_t nTimeStart, unsigned int nCount, uint256* pHashes) const;
     uint64_t GetTime() const;
+    uint64_t GetAmount() const { return m_nAmount; }
     bool IsValidProof(const uint256& nTarget);
     void SetStakeTime(uint64_t nTime);
     std::string ToString();
 
     static bool CheckProof(const arith_uint256& target, const arith_uint256& hash, const uint64_t nAmount);
 
+    //! Number of stake times GetStakeHashes is best called with
+    static const unsigned int HASH_BATCH_SIZE = 8;
+
 private:
     std::pair<uint256, unsigned int> m_outpoint;
     uint256 m_nStakeModifier;
     uint64_t m_nTimeBlockFrom;
     uint64_t m_nTimeStake;
     uint64_t m_nAmount;
+    //! SHA256 state after everything but the stake time, which is the only part that changes while searching
+    CSHA256 m_hasherPrefix;
+
+    uint256 HashStakeTime(uint64_t nTimeStake) const;
 };
 
 #endif //CROWN_CORE_KERNEL_H
@@ -1,26 +1,74 @@
+#include "checkqueue.h"
 #include "key.h"
 #include "legacysigner.h"
 #include "stakeminer.h"
 #include "kernel.h"
 #include "stakevalidation.h"
 #include "util.h"
+#include "arith_uint256.h"
+
+#include <algorithm>
 
 //! Search a specific period of timestamps to see if a valid proof hash is created
 bool SearchTimeSpan(Kernel& kernel, uint32_t nTimeStart, uint32_t nTimeEnd, const uint256& nTarget)
 {
-    uint64_t nTimeStake = nTimeStart;
-    kernel.SetStakeTime(nTimeStart);
+    // Same comparison as Kernel::CheckProof, with the weighted target worked out once
+    arith_uint256 targetWeighted = kernel.GetAmount() * UintToArith256(nTarget);
+    uint256 vHashes[Kernel::HASH_BATCH_SIZE];
+
+    // Like the one at a time search this replaced, nTimeEnd + 1 is the last time tried
+    uint64_t nTimeLast = (uint64_t)nTimeEnd + 1;
+    for (uint64_t nTimeBatch = nTimeStart; nTimeBatch <= nTimeLast; nTimeBatch += Kernel::HASH_BATCH_SIZE) {
+        unsigned int nCount = std::min<uint64_t>(Kernel::HASH_BATCH_SIZE, nTimeLast - nTimeBatch + 1);
+        kernel.GetStakeHashes(nTimeBatch, nCount, vHashes);
+        for (unsigned int i = 0; i < nCount; ++i) {
+            if (UintToArith256(vHashes[i]) < targetWeighted) {
+                kernel.SetStakeTime(nTimeBatch + i);
+                return true;
+            }
+        }
+    }
+
+    kernel.SetStakeTime(nTimeLast);
+    return false;
+}
+
+bool CStakeKernelCheck::operator()()
+{
+    *pfFound = SearchTimeSpan(*pkernel, nTimeStart, nTimeEnd, nTarget);
+    return !*pfFound;
+}
+
+// One kernel per job, so a found proof cancels as many searches as possible
+static CCheckQueue<CStakeKernelCheck> stakekernelcheckqueue(1);
+
+int SearchStakeKernels(std::vector<Kernel>& vKernels, uint32_t nTimeStart, uint32_t nTimeEnd, const uint256& nTarget)
+{
+    std::vector<char> vFound(vKernels.size(), false);
 
-    while (!kernel.IsValidProof(nTarget)) {
-        ++nTimeStake;
-        kernel.SetStakeTime(nTimeStake);
+    // The queue hands out jobs from the back, add them in reverse so the first kernels are searched first.
+    // The calling thread works through the queue too, so this also works without worker threads.
+    std::vector<CStakeKernelCheck> vChecks;
+    vChecks.reserve(vKernels.size());
+    for (int i = vKernels.size() - 1; i >= 0; --i)
+        vChecks.push_back(CStakeKernelCheck(&vKernels[i], nTimeStart, nTimeEnd, nTarget, &vFound[i]));
 
-        //Searched through the requested period
-        if (nTimeStake > nTimeEnd)
-            break;
+    CCheckQueueControl<CStakeKernelCheck> control(&stakekernelcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    // More than one kernel may have been found before the rest were cancelled, prefer the earliest
+    for (unsigned int i = 0; i < vFound.size(); ++i) {
+        if (vFound[i])
+            return i;
     }
+    return -1;
+}
 
-    return kernel.IsValidProof(nTarget);
+void ThreadStakeKernelCheck()
+{
+    RenameThread("crown-stakecheck");
+    stakekernelcheckqueue.Thread();
 }
 
 bool SignBlock(CBlock* pblock)
@@ -2,11 +2,47 @@
 #define CROWN_CORE_STAKEMINER_H
 
 #include <cstdint>
+#include <vector>
+
+#include "uint256.h"
 
 class CBlock;
 class Kernel;
-class uint256;
+
+//! Worker threads searching stake kernels next to the stake miner thread
+static const int DEFAULT_STAKE_KERNEL_THREADS = 2;
+
+/** Search one kernel's time span as a job of the stake kernel check queue */
+class CStakeKernelCheck
+{
+private:
+    Kernel* pkernel;
+    uint32_t nTimeStart;
+    uint32_t nTimeEnd;
+    uint256 nTarget;
+    char* pfFound;
+
+public:
+    CStakeKernelCheck() : pkernel(NULL), nTimeStart(0), nTimeEnd(0), pfFound(NULL) {}
+    CStakeKernelCheck(Kernel* pkernelIn, uint32_t nTimeStartIn, uint32_t nTimeEndIn, const uint256& nTargetIn, char* pfFoundIn) :
+        pkernel(pkernelIn), nTimeStart(nTimeStartIn), nTimeEnd(nTimeEndIn), nTarget(nTargetIn), pfFound(pfFoundIn) {}
+
+    //! Returns false once a valid proof is found, which makes the queue skip the searches that haven't started
+    bool operator()();
+
+    void swap(CStakeKernelCheck& check) {
+        std::swap(pkernel, check.pkernel);
+        std::swap(nTimeStart, check.nTimeStart);
+        std::swap(nTimeEnd, check.nTimeEnd);
+        std::swap(nTarget, check.nTarget);
+        std::swap(pfFound, check.pfFound);
+    }
+};
 
 bool SearchTimeSpan(Kernel& kernel, uint32_t nTimeStart, uint32_t nTimeEnd, const uint256& nTarget);
+/** Search the time span of every kernel concurrently, stopping early once one has a valid proof.
+ *  Returns the position of the first kernel in vKernels with a valid proof, -1 if there is none. */
+int SearchStakeKernels(std::vector<Kernel>& vKernels, uint32_t nTimeStart, uint32_t nTimeEnd, const uint256& nTarget);
+void ThreadStakeKernelCheck();
 bool SignBlock(CBlock* pblock);
 #endif //CROWN_CORE_STAKEMINER_H
@@ -16,6 +16,7 @@
 #include "clientversion.h"
 #include "primitives/transaction.h"
 #include "miner.h"
+#include "mn-pos/stakeminer.h"
 #include "ui_interface.h"
 #include "legacysigner.h"
 #include "wallet.h"
@@ -27,6 +28,11 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -34,6 +40,9 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#include <deque>
+#include <map>
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -64,8 +73,9 @@ namespace {
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
+        bool fReady;
 
-        ListenSocket(SOCKET socket, bool whitelisted) : socket(socket), whitelisted(whitelisted) {}
+        ListenSocket(SOCKET socket, bool whitelisted) : socket(socket), whitelisted(whitelisted), fReady(false) {}
     };
 }
 
@@ -94,6 +104,7 @@ map<CInv, CDataStream> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
+CRelayCache relayCache;
 
 static deque<string> vOneShots;
 CCriticalSection cs_vOneShots;
@@ -110,10 +121,79 @@ CCriticalSection cs_nLastNodeId;
 static CSemaphore *semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
 
+// Nodes waiting for a message worker
+static std::deque<CNode*> vWorkerNodes;
+static boost::mutex csWorkerNodes;
+static boost::condition_variable condWorkerNodes;
+static int nMessageWorkers = 0;
+
+static bool fSocketEventsEpoll = false;
+#ifdef USE_EPOLL
+static int hEpoll = -1;
+static int hWakeupEvent = -1;
+
+/** epoll event data of the wakeup event and of the listen sockets, any other value is a CNode* */
+static const uint64_t EPOLL_DATA_WAKEUP = 0;
+static const uint64_t EPOLL_DATA_LISTEN = 1; // + index in vhListenSocket
+#endif
+
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
 
+bool SetSocketEvents(const std::string& strMode, std::string& strError)
+{
+    if (strMode == "select") {
+        fSocketEventsEpoll = false;
+        return true;
+    }
+#ifdef USE_EPOLL
+    if (strMode == "epoll") {
+        if (hEpoll == -1) {
+            hEpoll = epoll_create1(EPOLL_CLOEXEC);
+            if (hEpoll == -1) {
+                strError = strprintf("epoll_create1 failed: %s", NetworkErrorString(errno));
+                return false;
+            }
+            hWakeupEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = EPOLL_DATA_WAKEUP;
+            if (hWakeupEvent == -1 || epoll_ctl(hEpoll, EPOLL_CTL_ADD, hWakeupEvent, &event) == -1) {
+                strError = strprintf("Creating the socket handler wakeup event failed: %s", NetworkErrorString(errno));
+                if (hWakeupEvent != -1)
+                    close(hWakeupEvent);
+                close(hEpoll);
+                hWakeupEvent = hEpoll = -1;
+                return false;
+            }
+        }
+        fSocketEventsEpoll = true;
+        return true;
+    }
+#endif
+    strError = strprintf(_("Unsupported -socketevents mode: '%s'"), strMode);
+    return false;
+}
+
+bool IsSocketEventsEpoll()
+{
+    return fSocketEventsEpoll;
+}
+
+/** Get the socket handler out of its wait, to pick up a new node, queued data or freed receive space */
+static void WakeupSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (fSocketEventsEpoll) {
+        uint64_t nValue = 1;
+        // EAGAIN means the counter is full, so a wakeup is pending anyway
+        if (write(hWakeupEvent, &nValue, sizeof(nValue)) == -1 && errno != EAGAIN)
+            LogPrintf("socket handler wakeup failed: %s\n", NetworkErrorString(errno));
+    }
+#endif
+}
+
 void AddOneShot(string strDest)
 {
     LOCK(cs_vOneShots);
@@ -424,7 +504,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool Masternode, b
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!fSocketEventsEpoll && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -440,6 +520,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool Masternode, b
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
         }
+        WakeupSocketHandler();
 
         pnode->nTimeConnected = GetTime();
         if(Masternode) pnode->fMasternode = true;
@@ -626,6 +707,56 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
     return true;
 }
 
+// Allocations of large received messages, kept to be used again
+static std::multimap<size_t, CSerializeData> mapRecvBuffers;
+static size_t nRecvBufferBytes = 0;
+static CCriticalSection cs_mapRecvBuffers;
+
+// Size vRecv for nSize bytes with a kept buffer that holds them without reallocating
+static void AcquireRecvBuffer(CDataStream& vRecv, size_t nSize)
+{
+    {
+        LOCK(cs_mapRecvBuffers);
+        std::multimap<size_t, CSerializeData>::iterator it = mapRecvBuffers.lower_bound(nSize);
+        if (it == mapRecvBuffers.end())
+            return;
+        nRecvBufferBytes -= it->first;
+        vRecv.swap(it->second);
+        mapRecvBuffers.erase(it);
+    }
+    // the bytes are received straight into the buffer, zeroing them first would touch it all twice
+    vRecv.resize_uninitialized(nSize);
+}
+
+static void ReleaseRecvBuffer(CDataStream& vRecv)
+{
+    CSerializeData data;
+    vRecv.swap(data);
+    size_t nCapacity = data.capacity();
+    if (nCapacity < RECV_BUFFER_POOL_MIN)
+        return;
+
+    LOCK(cs_mapRecvBuffers);
+    if (nRecvBufferBytes + nCapacity > RECV_BUFFER_POOL_SIZE)
+        return;
+    data.clear();
+    mapRecvBuffers.insert(std::make_pair(nCapacity, CSerializeData()))->second.swap(data);
+    nRecvBufferBytes += nCapacity;
+}
+
+CNetMessage::~CNetMessage()
+{
+    ReleaseRecvBuffer(vRecv);
+}
+
+// requires LOCK(cs_vRecvMsg)
+unsigned int CNode::GetRecvBuffer(char*& pch, unsigned int nSize)
+{
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data || vRecvMsg.back().complete())
+        return nSize;
+    return vRecvMsg.back().GetDataBuffer(pch);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -654,6 +785,12 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    // a kept buffer can hold the whole message right away
+    if (hdr.nMessageSize >= RECV_BUFFER_POOL_MIN && hdr.nMessageSize <= MAX_PROTOCOL_MESSAGE_LENGTH)
+        AcquireRecvBuffer(vRecv, hdr.nMessageSize);
+    if (hdr.nMessageSize == 0)
+        hasher.Finalize(data_hash.begin());
+
     return nCopy;
 }
 
@@ -664,15 +801,31 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        vRecv.resize_uninitialized(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
     }
 
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // data from GetDataBuffer is already in place
+    if (pch != &vRecv[nDataPos])
+        memcpy(&vRecv[nDataPos], pch, nCopy);
+    hasher.Write((const unsigned char*)&vRecv[nDataPos], nCopy);
     nDataPos += nCopy;
 
+    if (nDataPos == hdr.nMessageSize)
+        hasher.Finalize(data_hash.begin());
+
     return nCopy;
 }
 
+unsigned int CNetMessage::GetDataBuffer(char*& pch)
+{
+    if (vRecv.size() == nDataPos) {
+        // Allocate up to 256 KiB ahead, but never more than the total message size.
+        vRecv.resize_uninitialized(std::min(hdr.nMessageSize, nDataPos + 256 * 1024));
+    }
+    pch = &vRecv[nDataPos];
+    return vRecv.size() - nDataPos;
+}
+
 
 
 
@@ -727,9 +880,166 @@ void SocketSendData(CNode *pnode)
 
 static list<CNode*> vNodesDisconnected;
 
+/** Wait with select() and record which listen sockets and nodes are ready */
+static void WaitSocketEventsSelect()
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is no (complete) message in the receive buffer,
+            //   or there is space left in the buffer, select() for receiving data.
+            // * (if neither of the above applies, there is certainly one message
+            //   in the receiver buffer ready to be processed).
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend && !pnode->vSendMsg.empty()) {
+                    FD_SET(pnode->hSocket, &fdsetSend);
+                    continue;
+                }
+            }
+            {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && (
+                    pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                    pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    FD_SET(pnode->hSocket, &fdsetRecv);
+            }
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec/1000);
+    }
+
+    BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket)
+        hListenSocket.fReady = hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            pnode->fHasRecvData = FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError);
+            pnode->fCanSendData = FD_ISSET(pnode->hSocket, &fdsetSend);
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+/**
+ * Wait with epoll and record which listen sockets and nodes became ready. Nodes are
+ * edge triggered, so their readiness is kept until the socket handler used it up.
+ * Doesn't wait if the last round left work that can be done now.
+ */
+static void WaitSocketEventsEpoll(bool fMoreWork)
+{
+    // Sockets of new nodes are added once and leave the set when they are closed
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            if (pnode->fSocketRegistered || pnode->hSocket == INVALID_SOCKET)
+                continue;
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.ptr = pnode;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) == -1) {
+                LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(errno));
+                pnode->CloseSocketDisconnect();
+                continue;
+            }
+            pnode->fSocketRegistered = true;
+        }
+    }
+
+    struct epoll_event events[MAX_SOCKET_EVENTS];
+    int nEvents = epoll_wait(hEpoll, events, MAX_SOCKET_EVENTS, fMoreWork ? 0 : 50);
+    boost::this_thread::interruption_point();
+
+    if (nEvents == -1)
+    {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(errno));
+            MilliSleep(50);
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++)
+    {
+        uint64_t nData = events[i].data.u64;
+        if (nData == EPOLL_DATA_WAKEUP) {
+            uint64_t nValue;
+            while (read(hWakeupEvent, &nValue, sizeof(nValue)) > 0) {}
+        } else if (nData - EPOLL_DATA_LISTEN < vhListenSocket.size()) {
+            vhListenSocket[nData - EPOLL_DATA_LISTEN].fReady = true;
+        } else {
+            // Nodes are only deleted by this thread, after their socket left the set
+            CNode* pnode = (CNode*)events[i].data.ptr;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                pnode->fHasRecvData = true;
+            if (events[i].events & EPOLLOUT)
+                pnode->fCanSendData = true;
+        }
+    }
+}
+#endif
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    bool fMoreWork = false;
     while (true)
     {
         //
@@ -798,92 +1108,21 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
+#ifdef USE_EPOLL
+        if (fSocketEventsEpoll)
+            WaitSocketEventsEpoll(fMoreWork);
+        else
+#endif
+            WaitSocketEventsSelect();
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.fReady)
             {
+                hListenSocket.fReady = false;
                 struct sockaddr_storage sockaddr;
                 socklen_t len = sizeof(sockaddr);
                 SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
@@ -908,7 +1147,7 @@ void ThreadSocketHandler()
                     if (nErr != WSAEWOULDBLOCK)
                         LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
                 }
-                else if (!IsSelectableSocket(hSocket))
+                else if (!fSocketEventsEpoll && !IsSelectableSocket(hSocket))
                 {
                     LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
                     CloseSocket(hSocket);
@@ -956,6 +1195,7 @@ void ThreadSocketHandler()
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
                 pnode->AddRef();
         }
+        fMoreWork = false;
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
             boost::this_thread::interruption_point();
@@ -965,18 +1205,39 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            // select() only reports sockets it was asked about (see WaitSocketEventsSelect),
+            // with epoll the same limits are applied here: drain the send queue before
+            // receiving more, and leave the data in the socket while the receive buffer is full.
+            bool fRecvFlooded = false;
+            bool fRecvBusy = false;
+            if (pnode->fHasRecvData && !(fSocketEventsEpoll && pnode->nSendSize > 0))
             {
+                // Set before trying, so a thread releasing the lock right after sees it
+                pnode->fRecvWakeup = true;
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
+                    pnode->fRecvWakeup = false;
+                else
+                    fRecvBusy = true;
+                if (lockRecv && fSocketEventsEpoll && !pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+                    pnode->GetTotalRecvSize() > ReceiveFloodSize())
+                {
+                    fRecvFlooded = true;
+                }
+                else if (lockRecv)
                 {
                     {
-                        // typical socket buffer is 8K-64K
+                        // typical socket buffer is 8K-64K, message data is received straight into its message
                         char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                        char* pch = pchBuf;
+                        unsigned int nRecvSize = pnode->GetRecvBuffer(pch, sizeof(pchBuf));
+                        int nBytes = recv(pnode->hSocket, pch, nRecvSize, MSG_DONTWAIT);
                         if (nBytes > 0)
                         {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+                            // A short read emptied the socket, after a full one there may be more
+                            if (nBytes < (int)nRecvSize)
+                                pnode->fHasRecvData = false;
+                            if (!pnode->ReceiveMsgBytes(pch, nBytes))
                                 pnode->CloseSocketDisconnect();
                             pnode->nLastRecv = GetTime();
                             pnode->nRecvBytes += nBytes;
@@ -999,6 +1260,8 @@ void ThreadSocketHandler()
                                     LogPrintf("socket recv error %s (%s)\n", NetworkErrorString(nErr), pnode->addr.ToString());
                                 pnode->CloseSocketDisconnect();
                             }
+                            else if (nErr == WSAEWOULDBLOCK)
+                                pnode->fHasRecvData = false;
                         }
                     }
                 }
@@ -1009,13 +1272,29 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            bool fSendBusy = false;
+            if (pnode->fCanSendData && pnode->nSendSize > 0)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
+                {
                     SocketSendData(pnode);
+                    // What is left didn't fit in the socket, wait until it has room again
+                    if (!pnode->vSendMsg.empty())
+                        pnode->fCanSendData = false;
+                }
+                else
+                    fSendBusy = true;
             }
 
+            // Readiness epoll won't report again that can be used right away. Not for a node
+            // whose lock is held elsewhere: its holder wakes us up (receive) or the idle wait
+            // ends (send), polling it meanwhile would only spin.
+            if (fSocketEventsEpoll && pnode->hSocket != INVALID_SOCKET &&
+                ((pnode->fHasRecvData && !fRecvFlooded && !fRecvBusy && pnode->nSendSize == 0) ||
+                 (pnode->fCanSendData && !fSendBusy && pnode->nSendSize > 0)))
+                fMoreWork = true;
+
             //
             // Inactivity checking
             //
@@ -1511,16 +1790,21 @@ void ThreadMessageHandler()
 
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            if (pnode->fDisconnect)
+            // A message worker has this node
+            if (pnode->fDisconnect || pnode->fWorkerBusy)
                 continue;
 
             // Receive messages
+            bool fRecvResume = false;
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
                 {
-                    if (!g_signals.ProcessMessages(pnode))
+                    bool fRecvFlooded = pnode->GetTotalRecvSize() > ReceiveFloodSize();
+                    if (!g_signals.ProcessMessages(pnode, false))
                         pnode->CloseSocketDisconnect();
+                    // The socket handler stopped reading from this node, let it resume
+                    fRecvResume = fRecvFlooded && pnode->GetTotalRecvSize() <= ReceiveFloodSize();
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
@@ -1531,9 +1815,14 @@ void ThreadMessageHandler()
                     }
                 }
             }
+            // Only now that cs_vRecvMsg is released can the socket handler receive again
+            if (pnode->fRecvWakeup.exchange(false) || fRecvResume)
+                WakeupSocketHandler();
             boost::this_thread::interruption_point();
 
             // Send messages
+            if (pnode->fWorkerBusy)
+                continue;
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
@@ -1559,6 +1848,72 @@ void ThreadMessageHandler()
 
 
 
+bool HasMessageWorkers()
+{
+    return nMessageWorkers > 0;
+}
+
+void QueueMessageWorker(CNode* pnode)
+{
+    pnode->fWorkerBusy = true;
+    {
+        // nRefCount is only changed under cs_vNodes
+        LOCK(cs_vNodes);
+        pnode->AddRef();
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(csWorkerNodes);
+        vWorkerNodes.push_back(pnode);
+    }
+    condWorkerNodes.notify_one();
+}
+
+void ThreadMessageWorker()
+{
+    SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    while (true)
+    {
+        CNode* pnode;
+        {
+            boost::unique_lock<boost::mutex> lock(csWorkerNodes);
+            while (vWorkerNodes.empty())
+                condWorkerNodes.wait(lock);
+            pnode = vWorkerNodes.front();
+            vWorkerNodes.pop_front();
+        }
+
+        // The node is only ours, so the messages are processed in the order they came
+        bool fRecvResume = false;
+        if (!pnode->fDisconnect)
+        {
+            LOCK(pnode->cs_vRecvMsg);
+            bool fRecvFlooded = pnode->GetTotalRecvSize() > ReceiveFloodSize();
+            try {
+                if (!g_signals.ProcessMessages(pnode, true))
+                    pnode->CloseSocketDisconnect();
+            } catch (const boost::thread_interrupted&) {
+                // shutting down, don't keep the node alive
+                pnode->fWorkerBusy = false;
+                LOCK(cs_vNodes);
+                pnode->Release();
+                throw;
+            }
+            fRecvResume = fRecvFlooded && pnode->GetTotalRecvSize() <= ReceiveFloodSize();
+        }
+        // Only now that cs_vRecvMsg is released can the socket handler receive again
+        if (pnode->fRecvWakeup.exchange(false) || fRecvResume)
+            WakeupSocketHandler();
+
+        pnode->fWorkerBusy = false;
+        {
+            LOCK(cs_vNodes);
+            pnode->Release();
+        }
+        messageHandlerCondition.notify_one();
+        boost::this_thread::interruption_point();
+    }
+}
+
 bool BindListenPort(const CService &addrBind, string& strError, bool fWhitelisted)
 {
     strError = "";
@@ -1745,6 +2100,19 @@ void StartNode(boost::thread_group& threadGroup)
     // Map ports with UPnP
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
+#ifdef USE_EPOLL
+    // Listen sockets stay level triggered, one connection is accepted per round
+    if (fSocketEventsEpoll) {
+        for (unsigned int i = 0; i < vhListenSocket.size(); i++) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = EPOLL_DATA_LISTEN + i;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, vhListenSocket[i].socket, &event) == -1)
+                LogPrintf("socket epoll_ctl error for listen socket %s\n", NetworkErrorString(errno));
+        }
+    }
+#endif
+
     // Send and receive from sockets, accept connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
@@ -1757,12 +2125,20 @@ void StartNode(boost::thread_group& threadGroup)
     // Process messages
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
+    // Process non-consensus messages beside the message handler
+    nMessageWorkers = std::max(0, std::min((int)GetArg("-msgworkers", DEFAULT_MESSAGE_WORKERS), MAX_MESSAGE_WORKERS));
+    for (int i = 0; i < nMessageWorkers; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msgworker", &ThreadMessageWorker));
+
     // Dump network addresses
     threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "dumpaddr", &DumpAddresses, DUMP_ADDRESSES_INTERVAL * 1000));
 
     // Stake miner thread
-    if (GetBoolArg("-staking", true))
+    if (GetBoolArg("-staking", true)) {
         threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "stake-miner", &ThreadStakeMiner));
+        for (int i = 0; i < DEFAULT_STAKE_KERNEL_THREADS; i++)
+            threadGroup.create_thread(&ThreadStakeKernelCheck);
+    }
 
 }
 
@@ -1770,6 +2146,21 @@ bool StopNode()
 {
     LogPrintf("StopNode()\n");
     MapPort(false);
+
+    // The message workers are stopped, release the nodes still waiting for one
+    std::deque<CNode*> vWorkerNodesLeft;
+    {
+        boost::unique_lock<boost::mutex> lock(csWorkerNodes);
+        vWorkerNodesLeft.swap(vWorkerNodes);
+    }
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vWorkerNodesLeft) {
+            pnode->fWorkerBusy = false;
+            pnode->Release();
+        }
+    }
+
     if (semOutbound)
         for (int i=0; i<MAX_OUTBOUND_CONNECTIONS; i++)
             semOutbound->post();
@@ -1811,6 +2202,13 @@ public:
         semOutbound = NULL;
         delete pnodeLocalHost;
         pnodeLocalHost = NULL;
+#ifdef USE_EPOLL
+        if (hWakeupEvent != -1)
+            close(hWakeupEvent);
+        if (hEpoll != -1)
+            close(hEpoll);
+        hWakeupEvent = hEpoll = -1;
+#endif
 
 #ifdef WIN32
         // Shutdown Windows Sockets
@@ -1828,6 +2226,71 @@ void CExplicitNetCleanup::callCleanup()
     delete tmp; // Stroustrup's gonna kill me for that
 }
 
+void CRelayCache::Expire(int64_t nNow)
+{
+    while (!vExpiration.empty() && vExpiration.front().first < nNow) {
+        std::map<Key, boost::shared_ptr<const Entry> >::iterator it = mapEntries.find(vExpiration.front().second);
+        if (it != mapEntries.end()) {
+            nBytes -= it->second->ss.size();
+            mapEntries.erase(it);
+        }
+        vExpiration.pop_front();
+    }
+}
+
+boost::shared_ptr<const CRelayCache::Entry> CRelayCache::Get(const CInv& inv, bool fLegacyFormat)
+{
+    LOCK(cs);
+    Expire(GetTime());
+    std::map<Key, boost::shared_ptr<const Entry> >::const_iterator it = mapEntries.find(std::make_pair(inv, fLegacyFormat));
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return boost::shared_ptr<const Entry>();
+    }
+    nHits++;
+    return it->second;
+}
+
+void CRelayCache::Add(const CInv& inv, bool fLegacyFormat, const boost::shared_ptr<const Entry>& pentry)
+{
+    LOCK(cs);
+    Key key(inv, fLegacyFormat);
+    if (!mapEntries.insert(std::make_pair(key, pentry)).second)
+        return;
+    nBytes += pentry->ss.size();
+    // Same lifetime as transactions in mapRelay
+    vExpiration.push_back(std::make_pair(GetTime() + 15 * 60, key));
+}
+
+void CRelayCache::Erase(const CInv& inv)
+{
+    LOCK(cs);
+    for (int i = 0; i < 2; i++) {
+        std::map<Key, boost::shared_ptr<const Entry> >::iterator it = mapEntries.find(std::make_pair(inv, i == 1));
+        if (it != mapEntries.end()) {
+            nBytes -= it->second->ss.size();
+            mapEntries.erase(it);
+        }
+    }
+}
+
+void CRelayCache::Clear()
+{
+    LOCK(cs);
+    mapEntries.clear();
+    vExpiration.clear();
+    nBytes = 0;
+}
+
+void CRelayCache::GetStats(size_t& nEntriesOut, size_t& nBytesOut, uint64_t& nHitsOut, uint64_t& nMissesOut) const
+{
+    LOCK(cs);
+    nEntriesOut = mapEntries.size();
+    nBytesOut = nBytes;
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
+
 void RelayTransaction(const CTransaction& tx)
 {
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
@@ -2069,6 +2532,11 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fHasRecvData = false;
+    fCanSendData = false;
+    fSocketRegistered = false;
+    fWorkerBusy = false;
+    fRecvWakeup = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2205,8 +2673,12 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     nSendSize += (*it).size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (it == vSendMsg.begin()) {
         SocketSendData(this);
+        // Leave what the socket didn't take to the socket handler
+        if (!vSendMsg.empty())
+            WakeupSocketHandler();
+    }
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
@@ -19,6 +19,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -28,6 +29,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
@@ -50,6 +52,10 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 32 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 32 * 1024 * 1024;
+/** Receive buffers of at least this size are kept for later messages once their message is handled. */
+static const unsigned int RECV_BUFFER_POOL_MIN = 64 * 1024;
+/** Maximum total size of the kept receive buffers. */
+static const unsigned int RECV_BUFFER_POOL_SIZE = 32 * 1024 * 1024;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
 /** -upnp default */
@@ -58,12 +64,29 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
+/** -socketevents default, how the socket handler waits for sockets to become ready */
+#ifdef USE_EPOLL
+static const char* const DEFAULT_SOCKET_EVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKET_EVENTS = "select";
+#endif
+/** Most epoll events taken per wait by the socket handler */
+static const int MAX_SOCKET_EVENTS = 1024;
+/** Default for -msgworkers, threads processing non-consensus messages beside the message handler */
+static const int DEFAULT_MESSAGE_WORKERS = 2;
+/** Maximum for -msgworkers */
+static const int MAX_MESSAGE_WORKERS = 16;
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
 
+/** Select select() or epoll for the socket handler, false if the mode is unknown or can't be set up */
+bool SetSocketEvents(const std::string& strMode, std::string& strError);
+/** Whether the socket handler uses epoll, so isn't limited to FD_SETSIZE sockets */
+bool IsSocketEventsEpoll();
+
 void AddOneShot(std::string strDest);
 bool RecvLine(SOCKET hSocket, std::string& strLine);
 void AddressCurrentlyConnected(const CService& addr);
@@ -78,6 +101,10 @@ bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+/** Whether there are message workers to hand non-consensus messages to */
+bool HasMessageWorkers();
+/** Have a message worker process the node's messages, the message handler leaves it alone until then */
+void QueueMessageWorker(CNode* pnode);
 
 typedef int NodeId;
 
@@ -85,7 +112,7 @@ typedef int NodeId;
 struct CNodeSignals
 {
     boost::signals2::signal<int ()> GetHeight;
-    boost::signals2::signal<bool (CNode*)> ProcessMessages;
+    boost::signals2::signal<bool (CNode*, bool)> ProcessMessages;
     boost::signals2::signal<bool (CNode*, bool)> SendMessages;
     boost::signals2::signal<void (NodeId, const CNode*)> InitializeNode;
     boost::signals2::signal<void (NodeId)> FinalizeNode;
@@ -136,6 +163,47 @@ extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
 
+/**
+ * Serialized non-transaction inventory (masternode, systemnode, budget, spork and
+ * instantsend items), made once and shared by every peer asking for it.
+ * Items with a legacy wire format for old peers are kept once per format.
+ */
+class CRelayCache
+{
+public:
+    struct Entry
+    {
+        std::string strCommand;
+        CDataStream ss;
+
+        Entry() : ss(SER_NETWORK, PROTOCOL_VERSION) {}
+    };
+
+private:
+    typedef std::pair<CInv, bool> Key;
+
+    mutable CCriticalSection cs;
+    std::map<Key, boost::shared_ptr<const Entry> > mapEntries;
+    std::deque<std::pair<int64_t, Key> > vExpiration;
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Expire(int64_t nNow);
+
+public:
+    CRelayCache() : nBytes(0), nHits(0), nMisses(0) {}
+
+    /** The cached item in the legacy or current format, NULL if it isn't cached */
+    boost::shared_ptr<const Entry> Get(const CInv& inv, bool fLegacyFormat);
+    void Add(const CInv& inv, bool fLegacyFormat, const boost::shared_ptr<const Entry>& pentry);
+    /** Drop both formats of an item whose contents changed */
+    void Erase(const CInv& inv);
+    void Clear();
+    void GetStats(size_t& nEntriesOut, size_t& nBytesOut, uint64_t& nHitsOut, uint64_t& nMissesOut) const;
+};
+extern CRelayCache relayCache;
+
 /** Subversion as sent to the P2P network in `version` messages */
 extern std::string strSubVersion;
 
@@ -187,17 +255,24 @@ public:
 
     CDataStream vRecv;              // received message data
     unsigned int nDataPos;
+    CHash256 hasher;                // hash of the data received so far
+    uint256 data_hash;              // hash of the complete message data
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
+    bool fPreverified;              // signatures already queued by PreverifyLegacySignatures
+
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fPreverified = false;
     }
 
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -211,8 +286,16 @@ public:
         vRecv.SetVersion(nVersionIn);
     }
 
+    const uint256& GetMessageHash() const
+    {
+        assert(complete());
+        return data_hash;
+    }
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+    /** Room in vRecv for the next bytes of data, so they can be received into it without a copy */
+    unsigned int GetDataBuffer(char*& pch);
 };
 
 
@@ -236,6 +319,12 @@ public:
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Set while a message worker owns the node, the message handler neither
+    // processes its messages nor sends to it until the worker is done
+    std::atomic<bool> fWorkerBusy;
+    // Set while the socket handler couldn't lock cs_vRecvMsg to receive, the thread
+    // holding the lock wakes it up after releasing it
+    std::atomic<bool> fRecvWakeup;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -258,6 +347,11 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // Socket readiness as last reported to the socket handler thread, only used by
+    // that thread. With epoll it is reported once per change, so kept until used up.
+    bool fHasRecvData;
+    bool fCanSendData;
+    bool fSocketRegistered;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in their version message that we should not relay tx invs
@@ -299,6 +393,7 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     mruset<CAddress> setAddrKnown;
+    CCriticalSection cs_vAddrToSend; // protects vAddrToSend and setAddrKnown, addr messages are relayed by message workers
     bool fGetAddr;
     std::set<uint256> setKnown;
     bool fSyncingWith;
@@ -351,12 +446,14 @@ public:
     {
         unsigned int total = 0;
         BOOST_FOREACH(const CNetMessage &msg, vRecvMsg)
-            total += msg.vRecv.size() + 24;
+            total += msg.nDataPos + 24;
         return total;
     }
 
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
+    // requires LOCK(cs_vRecvMsg)
+    unsigned int GetRecvBuffer(char*& pch, unsigned int nSize);
 
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
@@ -381,6 +478,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         setAddrKnown.insert(addr);
     }
 
@@ -389,6 +487,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !setAddrKnown.count(addr)) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
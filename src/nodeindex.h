@@ -0,0 +1,110 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SRC_NODEINDEX_H_
+#define SRC_NODEINDEX_H_
+
+#include "netbase.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/standard.h"
+
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
+struct OutPointHasher
+{
+    uint256 salt;
+
+    OutPointHasher() : salt(GetRandHash()) {}
+
+    size_t operator()(const COutPoint& outpoint) const
+    {
+        size_t seed = outpoint.hash.GetHash(salt);
+        boost::hash_combine(seed, outpoint.n);
+        return seed;
+    }
+};
+
+struct PubKeyHasher
+{
+    size_t operator()(const CPubKey& pubkey) const { return boost::hash_range(pubkey.begin(), pubkey.end()); }
+};
+
+struct ScriptHasher
+{
+    size_t operator()(const CScript& script) const { return boost::hash_range(script.begin(), script.end()); }
+};
+
+struct ServiceHasher
+{
+    size_t operator()(const CService& addr) const
+    {
+        std::vector<unsigned char> vchKey = addr.GetKey();
+        return boost::hash_range(vchKey.begin(), vchKey.end());
+    }
+};
+
+/**
+ * Secondary lookup tables for a vector of masternodes or systemnodes, mapping
+ * collateral outpoint, node pubkey, payee script and service address to the
+ * node's position in the vector.
+ *
+ * Like the linear scans they replace, lookups return the first node in vector
+ * order that matches. Positions are invalidated by erasing from the vector, so
+ * the owner has to Rebuild() after removals or after changing a node's
+ * pubkey2 or addr.
+ */
+template <typename TNode>
+class CNodeIndex
+{
+private:
+    boost::unordered_map<COutPoint, size_t, OutPointHasher> mapByOutPoint;
+    boost::unordered_map<CPubKey, size_t, PubKeyHasher> mapByPubKey;
+    boost::unordered_map<CScript, size_t, ScriptHasher> mapByPayee;
+    boost::unordered_map<CService, size_t, ServiceHasher> mapByAddr;
+
+    template <typename TMap>
+    static int Get(const TMap& map, const typename TMap::key_type& key)
+    {
+        typename TMap::const_iterator it = map.find(key);
+        return it == map.end() ? -1 : static_cast<int>(it->second);
+    }
+
+public:
+    void Clear()
+    {
+        mapByOutPoint.clear();
+        mapByPubKey.clear();
+        mapByPayee.clear();
+        mapByAddr.clear();
+    }
+
+    /// Index a node appended at nPos, keys already taken by an earlier node are kept
+    void Add(const TNode& node, size_t nPos)
+    {
+        mapByOutPoint.insert(std::make_pair(node.vin.prevout, nPos));
+        mapByPubKey.insert(std::make_pair(node.pubkey2, nPos));
+        mapByPayee.insert(std::make_pair(GetScriptForDestination(node.pubkey.GetID()), nPos));
+        mapByAddr.insert(std::make_pair(node.addr, nPos));
+    }
+
+    void Rebuild(const std::vector<TNode>& vNodes)
+    {
+        Clear();
+        for (size_t i = 0; i < vNodes.size(); ++i)
+            Add(vNodes[i], i);
+    }
+
+    /// Position of the matching node, -1 if there is none
+    int Find(const COutPoint& outpoint) const { return Get(mapByOutPoint, outpoint); }
+    int Find(const CPubKey& pubkey) const { return Get(mapByPubKey, pubkey); }
+    int Find(const CScript& payee) const { return Get(mapByPayee, payee); }
+    int Find(const CService& addr) const { return Get(mapByAddr, addr); }
+};
+
+#endif /* SRC_NODEINDEX_H_ */
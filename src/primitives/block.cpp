@@ -10,6 +10,7 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 
 void CBlockHeader::SetAuxpow (CAuxPow* apow)
 {
@@ -74,15 +75,18 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
+        }
+        // The pairs of a level lie next to each other, so they are hashed in place as 64 byte inputs.
+        // Nothing is reallocated, the reserve above covers the whole tree.
+        size_t nLevel = vMerkleTree.size();
+        vMerkleTree.resize(nLevel + (nSize + 1) / 2);
+        SHA256D64(vMerkleTree[nLevel].begin(), vMerkleTree[j].begin(), nSize / 2);
+        if (nSize % 2) {
+            const uint256& last = vMerkleTree[j+nSize-1];
+            vMerkleTree.back() = Hash(BEGIN(last), END(last), BEGIN(last), END(last));
         }
         j += nSize;
     }
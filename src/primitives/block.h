@@ -93,6 +93,7 @@ public:
     mutable CScript payeeSN;
     mutable std::vector<uint256> vMerkleTree;
     mutable bool fChecked;
+    mutable bool fStructureChecked;
 
     CBlock()
     {
@@ -126,6 +127,7 @@ public:
         vchBlockSig.clear();
         stakePointer.SetNull();
         fChecked = false;
+        fStructureChecked = false;
         vMerkleTree.clear();
         payee = CScript();
         payeeSN = CScript();
@@ -6,6 +6,7 @@
 
 #include "checkpoints.h"
 #include "main.h"
+#include "memusage.h"
 #include "rpcserver.h"
 #include "sync.h"
 #include "util.h"
@@ -310,6 +311,9 @@ Value getblock(const Array& params, bool fHelp)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
     if(!ReadBlockFromDisk(block, pblockindex))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
@@ -363,6 +367,9 @@ Value getblockheader(const Array& params, bool fHelp)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
     if(!ReadBlockFromDisk(block, pblockindex))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
@@ -383,15 +390,15 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
         throw runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "They are kept up to date as blocks are connected, so this call is cheap.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"bytes_serialized\": n,  (numeric) The serialized size of the unspent outputs\n"
+            "  \"muhash\": \"hash\",      (string) The MuHash3072 of the unspent outputs, independent of how they are stored\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
@@ -402,14 +409,16 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
     Object ret;
 
     CCoinsStats stats;
-    FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+        if (mi != mapBlockIndex.end())
+            stats.nHeight = mi->second->nHeight;
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        ret.push_back(Pair("muhash", stats.GetHash().GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
@@ -534,6 +543,22 @@ Value getblockchaininfo(const Array& params, bool fHelp)
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
+            "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
+            "  \"blockindex\": {           (object) memory used by the in-memory block index\n"
+            "    \"entries\": xxxxxx,       (numeric) number of block index entries\n"
+            "    \"arena\": xxxxxx,         (numeric) bytes of the slabs holding the entries\n"
+            "    \"map\": xxxxxx,           (numeric) bytes of the hash to entry map\n"
+            "    \"usage\": xxxxxx          (numeric) total bytes used by the block index\n"
+            "  }\n"
+            "  \"reorgcache\": {           (object) recently connected blocks kept in memory for reorgs\n"
+            "    \"blocks\": xxxxxx,        (numeric) number of cached blocks\n"
+            "    \"bytes\": xxxxxx,         (numeric) serialized size of the cached blocks and undo data\n"
+            "    \"blockhits\": xxxxxx,     (numeric) block reads answered from the cache\n"
+            "    \"blockmisses\": xxxxxx,   (numeric) block reads that went to disk\n"
+            "    \"undohits\": xxxxxx,      (numeric) undo data reads answered from the cache\n"
+            "    \"undomisses\": xxxxxx     (numeric) undo data reads that went to disk\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblockchaininfo", "")
@@ -548,6 +573,29 @@ Value getblockchaininfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("pruned",                fPruneMode));
+    if (fPruneMode)
+        obj.push_back(Pair("pruneheight",       GetPruneHeight()));
+
+    Object blockindex;
+    size_t nArenaUsage = blockIndexArena.DynamicMemoryUsage();
+    size_t nMapUsage = memusage::DynamicUsage(mapBlockIndex);
+    blockindex.push_back(Pair("entries",        (uint64_t)blockIndexArena.Size()));
+    blockindex.push_back(Pair("arena",          (uint64_t)nArenaUsage));
+    blockindex.push_back(Pair("map",            (uint64_t)nMapUsage));
+    blockindex.push_back(Pair("usage",          (uint64_t)(nArenaUsage + nMapUsage)));
+    obj.push_back(Pair("blockindex",            blockindex));
+
+    CReorgCacheStats reorgstats;
+    GetReorgCacheStats(reorgstats);
+    Object reorgcache;
+    reorgcache.push_back(Pair("blocks",         (uint64_t)reorgstats.nBlocks));
+    reorgcache.push_back(Pair("bytes",          (uint64_t)reorgstats.nBytes));
+    reorgcache.push_back(Pair("blockhits",      reorgstats.nBlockHits));
+    reorgcache.push_back(Pair("blockmisses",    reorgstats.nBlockMisses));
+    reorgcache.push_back(Pair("undohits",       reorgstats.nUndoHits));
+    reorgcache.push_back(Pair("undomisses",     reorgstats.nUndoMisses));
+    obj.push_back(Pair("reorgcache",            reorgcache));
     return obj;
 }
 
@@ -99,7 +99,7 @@ Value masternode(const Array& params, bool fHelp)
         (strCommand != "start" && strCommand != "start-alias" && strCommand != "start-many" && strCommand != "start-all" && strCommand != "start-missing" &&
          strCommand != "start-disabled" && strCommand != "list" && strCommand != "list-conf" && strCommand != "count"  && strCommand != "enforce" &&
         strCommand != "debug" && strCommand != "current" && strCommand != "winners" && strCommand != "connect" &&
-        strCommand != "outputs" && strCommand != "status" && strCommand != "calcscore"))
+        strCommand != "outputs" && strCommand != "status" && strCommand != "calcscore" && strCommand != "sigcache"))
         throw runtime_error(
                 "masternode \"command\"... ( \"passphrase\" )\n"
                 "Set of commands to execute masternode related actions\n"
@@ -112,6 +112,7 @@ Value masternode(const Array& params, bool fHelp)
                 "  debug        - Print masternode status\n"
                 "  enforce      - Enforce masternode payments\n"
                 "  outputs      - Print masternode compatible outputs\n"
+                "  sigcache     - Print hit and miss counters of the message signature cache\n"
                 "  start        - Start masternode configured in crown.conf\n"
                 "  start-alias  - Start single masternode by assigned alias configured in masternode.conf\n"
                 "  start-<mode> - Start masternodes configured in masternode.conf (<mode>: 'all', 'missing', 'disabled')\n"
@@ -380,6 +381,18 @@ Value masternode(const Array& params, bool fHelp)
 
     }
 
+    if(strCommand == "sigcache")
+    {
+        CLegacySignatureCacheStats stats = GetLegacySignatureCacheStats();
+
+        Object obj;
+        obj.push_back(Pair("hits", stats.nHits));
+        obj.push_back(Pair("misses", stats.nMisses));
+        obj.push_back(Pair("entries", (uint64_t)stats.nEntries));
+        obj.push_back(Pair("usage", (uint64_t)stats.nUsage));
+        return obj;
+    }
+
     if(strCommand == "status")
     {
         if(!fMasterNode) throw runtime_error("This is not a masternode\n");
@@ -512,14 +525,15 @@ Value masternodelist(const Array& params, bool fHelp)
 
     Object obj;
     if (strMode == "rank") {
-        std::vector<pair<int, CMasternode> > vMasternodeRanks = mnodeman.GetMasternodeRanks(chainActive.Tip()->nHeight);
-        BOOST_FOREACH(PAIRTYPE(int, CMasternode)& s, vMasternodeRanks) {
-            std::string strVin = s.second.vin.prevout.ToStringShort();
+        std::vector<pair<int, CTxIn> > vMasternodeRanks = mnodeman.GetMasternodeRanks(chainActive.Tip()->nHeight);
+        BOOST_FOREACH(PAIRTYPE(int, CTxIn)& s, vMasternodeRanks) {
+            std::string strVin = s.second.prevout.ToStringShort();
             if(strFilter !="" && strVin.find(strFilter) == string::npos) continue;
             obj.push_back(Pair(strVin,       s.first));
         }
     } else {
         std::vector<CMasternode> vMasternodes = mnodeman.GetFullMasternodeVector();
+        int nLastPaidDepth = mnodeman.CountEnabled()*1.25;
         BOOST_FOREACH(CMasternode& mn, vMasternodes) {
             std::string strVin = mn.vin.prevout.ToStringShort();
             if (strMode == "activeseconds") {
@@ -541,7 +555,7 @@ Value masternodelist(const Array& params, bool fHelp)
                                mn.addr.ToString() << " " <<
                                (int64_t)mn.lastPing.sigTime << " " << setw(8) <<
                                (int64_t)(mn.lastPing.sigTime - mn.sigTime) << " " <<
-                               (int64_t)mn.GetLastPaid();
+                               (int64_t)mn.GetLastPaid(nLastPaidDepth);
                 std::string output = stringStream.str();
                 stringStream << " " << strVin;
                 if(strFilter !="" && stringStream.str().find(strFilter) == string::npos &&
@@ -553,7 +567,7 @@ Value masternodelist(const Array& params, bool fHelp)
             } else if (strMode == "lastpaid"){
                 if(strFilter !="" && mn.vin.prevout.hash.ToString().find(strFilter) == string::npos &&
                     strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,      (int64_t)mn.GetLastPaid()));
+                obj.push_back(Pair(strVin,      (int64_t)mn.GetLastPaid(nLastPaidDepth)));
             } else if (strMode == "protocol") {
                 if(strFilter !="" && strFilter != strprintf("%d", mn.protocolVersion) &&
                     strVin.find(strFilter) == string::npos) continue;
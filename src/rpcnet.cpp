@@ -404,7 +404,14 @@ Value getnettotals(const Array& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"relaycache\": {        (json object) Serialized masternode, budget and other non-tx items shared between peers\n"
+            "    \"entries\": n,        (numeric) Number of cached items\n"
+            "    \"bytes\": n,          (numeric) Size of the cached items\n"
+            "    \"hits\": n,           (numeric) Requests served from the cache\n"
+            "    \"misses\": n,         (numeric) Requests that had to serialize the item\n"
+            "    \"hitrate\": x.xxx     (numeric) Fraction of requests served from the cache\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getnettotals", "")
@@ -415,6 +422,56 @@ Value getnettotals(const Array& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    size_t nEntries, nBytes;
+    uint64_t nHits, nMisses;
+    relayCache.GetStats(nEntries, nBytes, nHits, nMisses);
+    Object relay;
+    relay.push_back(Pair("entries", (uint64_t)nEntries));
+    relay.push_back(Pair("bytes", (uint64_t)nBytes));
+    relay.push_back(Pair("hits", nHits));
+    relay.push_back(Pair("misses", nMisses));
+    relay.push_back(Pair("hitrate", nHits + nMisses ? (double)nHits / (nHits + nMisses) : 0.0));
+    obj.push_back(Pair("relaycache", relay));
+    return obj;
+}
+
+Value getmessagestats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getmessagestats\n"
+            "\nReturns the time spent handling each received message command since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {          (json object) The message command\n"
+            "    \"count\": n,         (numeric) Number of messages handled\n"
+            "    \"workercount\": n,   (numeric) Number of those handled by a message worker\n"
+            "    \"totalmicros\": n,   (numeric) Total handling time in microseconds\n"
+            "    \"avgmicros\": n,     (numeric) Average handling time in microseconds\n"
+            "    \"maxmicros\": n      (numeric) Longest handling time in microseconds\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmessagestats", "")
+            + HelpExampleRpc("getmessagestats", "")
+       );
+
+    std::map<std::string, CMessageStats> mapStats;
+    GetMessageStats(mapStats);
+
+    Object obj;
+    for (std::map<std::string, CMessageStats>::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it) {
+        const CMessageStats& stats = it->second;
+        Object entry;
+        entry.push_back(Pair("count", stats.nCount));
+        entry.push_back(Pair("workercount", stats.nWorkerCount));
+        entry.push_back(Pair("totalmicros", stats.nTotalMicros));
+        entry.push_back(Pair("avgmicros", stats.nCount ? stats.nTotalMicros / (int64_t)stats.nCount : 0));
+        entry.push_back(Pair("maxmicros", stats.nMaxMicros));
+        obj.push_back(Pair(SanitizeString(it->first), entry));
+    }
     return obj;
 }
 
@@ -322,6 +322,7 @@ static const CRPCCommand vRPCCommands[] =
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      true,       false },
     { "network",            "getconnectioncount",     &getconnectioncount,     true,      false,      false },
     { "network",            "getnettotals",           &getnettotals,           true,      true,       false },
+    { "network",            "getmessagestats",        &getmessagestats,        true,      true,       false },
     { "network",            "getpeerinfo",            &getpeerinfo,            true,      false,      false },
     { "network",            "ping",                   &ping,                   true,      false,      false },
 
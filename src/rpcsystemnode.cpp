@@ -427,14 +427,15 @@ Value systemnodelist(const Array& params, bool fHelp)
 
     Object obj;
     if (strMode == "rank") {
-        std::vector<pair<int, CSystemnode> > vSystemnodeRanks = snodeman.GetSystemnodeRanks(chainActive.Tip()->nHeight);
-        BOOST_FOREACH(PAIRTYPE(int, CSystemnode)& s, vSystemnodeRanks) {
-            std::string strVin = s.second.vin.prevout.ToStringShort();
+        std::vector<pair<int, CTxIn> > vSystemnodeRanks = snodeman.GetSystemnodeRanks(chainActive.Tip()->nHeight);
+        BOOST_FOREACH(PAIRTYPE(int, CTxIn)& s, vSystemnodeRanks) {
+            std::string strVin = s.second.prevout.ToStringShort();
             if(strFilter !="" && strVin.find(strFilter) == string::npos) continue;
             obj.push_back(Pair(strVin,       s.first));
         }
     } else {
         std::vector<CSystemnode> vSystemnodes = snodeman.GetFullSystemnodeVector();
+        int nLastPaidDepth = snodeman.CountEnabled()*1.25;
         BOOST_FOREACH(CSystemnode& mn, vSystemnodes) {
             std::string strVin = mn.vin.prevout.ToStringShort();
             if (strMode == "activeseconds") {
@@ -456,7 +457,7 @@ Value systemnodelist(const Array& params, bool fHelp)
                                mn.addr.ToString() << " " <<
                                (int64_t)mn.lastPing.sigTime << " " << setw(8) <<
                                (int64_t)(mn.lastPing.sigTime - mn.sigTime) << " " <<
-                               (int64_t)mn.GetLastPaid();
+                               (int64_t)mn.GetLastPaid(nLastPaidDepth);
                 std::string output = stringStream.str();
                 stringStream << " " << strVin;
                 if(strFilter !="" && stringStream.str().find(strFilter) == string::npos &&
@@ -468,7 +469,7 @@ Value systemnodelist(const Array& params, bool fHelp)
             } else if (strMode == "lastpaid"){
                 if(strFilter !="" && mn.vin.prevout.hash.ToString().find(strFilter) == string::npos &&
                     strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,      (int64_t)mn.GetLastPaid()));
+                obj.push_back(Pair(strVin,      (int64_t)mn.GetLastPaid(nLastPaidDepth)));
             } else if (strMode == "protocol") {
                 if(strFilter !="" && strFilter != strprintf("%d", mn.protocolVersion) &&
                     strVin.find(strFilter) == string::npos) continue;
@@ -5,26 +5,31 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <cstring>
+
 #include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
 
 namespace {
 
 /**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
+ * We're hashing a nonce into the entries themselves, so every 32 bit word of
+ * an entry is already an independent hash.
  */
 class CSignatureCacheHasher
 {
 public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
     }
 };
 
@@ -32,21 +37,36 @@ public:
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * The entries are spread over independent shards so script check threads
+ * rarely wait for each other, and each shard is a fixed size cuckoo cache,
+ * so adding an entry never has to search for one to evict.
  */
 class CSignatureCache
 {
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
-
+    typedef CuckooCache::cache<uint256, CSignatureCacheHasher> map_type;
+    map_type setValid[SIGNATURE_CACHE_SHARDS];
+    boost::shared_mutex cs_sigcache[SIGNATURE_CACHE_SHARDS];
+    //! Cleared by -maxsigcachesize=0, set once before script checks start
+    bool fEnabled;
+
+    // The first byte is the least significant one of the first cuckoo hash, so
+    // using it to pick the shard hardly affects where entries go within a shard
+    static unsigned int GetShard(const uint256& entry)
+    {
+        return entry.begin()[0] % SIGNATURE_CACHE_SHARDS;
+    }
 
 public:
-    CSignatureCache()
+    CSignatureCache() : fEnabled(true)
     {
         GetRandBytes(nonce.begin(), 32);
+        // Minimal tables until InitSignatureCache sizes them
+        for (unsigned int i = 0; i < SIGNATURE_CACHE_SHARDS; i++)
+            setValid[i].setup(2);
     }
 
     void
@@ -56,52 +76,61 @@ public:
     }
 
     bool
-    Get(const uint256& entry)
+    Get(const uint256& entry, bool fErase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+        if (!fEnabled)
+            return false;
+        unsigned int nShard = GetShard(entry);
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache[nShard]);
+        return setValid[nShard].contains(entry, fErase);
     }
 
-    void Erase(const uint256& entry)
+    void Set(const uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        if (!fEnabled)
+            return;
+        unsigned int nShard = GetShard(entry);
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache[nShard]);
+        setValid[nShard].insert(entry);
     }
 
-    void Set(const uint256& entry)
+    size_t Setup(size_t nBytes)
     {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
+        // A cuckoo table always keeps a few slots, so an empty cache is switched off instead
+        fEnabled = nBytes > 0;
+        size_t nElems = 0;
+        for (unsigned int i = 0; i < SIGNATURE_CACHE_SHARDS; i++) {
+            boost::unique_lock<boost::shared_mutex> lock(cs_sigcache[i]);
+            nElems += setValid[i].setup_bytes(nBytes / SIGNATURE_CACHE_SHARDS);
         }
-
-        setValid.insert(entry);
+        return nElems;
     }
 };
 
+CSignatureCache signatureCache;
+
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+void InitSignatureCache()
 {
-    static CSignatureCache signatureCache;
+    size_t nMaxCacheSize = std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)) * ((size_t) 1 << 20);
+    size_t nElems = signatureCache.Setup(nMaxCacheSize);
+    if (nMaxCacheSize == 0) {
+        LogPrintf("Signature cache disabled\n");
+        return;
+    }
+    LogPrintf("Using %zu MiB for the signature cache, able to store %zu elements\n",
+              (nElems * sizeof(uint256)) >> 20, nElems);
+}
 
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    // Entries only needed once (when store is false) may be overwritten after the hit
+    if (signatureCache.Get(entry, !store))
         return true;
-    }
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
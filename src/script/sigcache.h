@@ -13,6 +13,8 @@
 // DoS prevention: limit cache size to less than 40MB (over 500000
 // entries on 64-bit systems).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Number of independently locked parts of the signature cache
+static const unsigned int SIGNATURE_CACHE_SHARDS = 16;
 
 class CPubKey;
 
@@ -27,4 +29,7 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Size the signature cache from -maxsigcachesize, drops all entries */
+void InitSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -20,6 +20,7 @@ class CSporkManager;
 
 CSporkManager sporkManager;
 
+CCriticalSection cs_mapSporks;
 std::map<uint256, CSporkMessage> mapSporks;
 std::map<int, CSporkMessage> mapSporksActive;
 
@@ -35,19 +36,27 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
         CSporkMessage spork;
         vRecv >> spork;
 
-        if(chainActive.Tip() == NULL) return;
+        int nHeight;
+        {
+            LOCK(cs_main);
+            if(chainActive.Tip() == NULL) return;
+            nHeight = chainActive.Tip()->nHeight;
+        }
 
         uint256 hash = spork.GetHash();
-        if(mapSporksActive.count(spork.nSporkID)) {
-            if(mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned){
-                if(fDebug) LogPrintf("spork - seen %s block %d \n", hash.ToString(), chainActive.Tip()->nHeight);
-                return;
-            } else {
-                if(fDebug) LogPrintf("spork - got updated spork %s block %d \n", hash.ToString(), chainActive.Tip()->nHeight);
+        {
+            LOCK(cs_mapSporks);
+            if(mapSporksActive.count(spork.nSporkID)) {
+                if(mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned){
+                    if(fDebug) LogPrintf("spork - seen %s block %d \n", hash.ToString(), nHeight);
+                    return;
+                } else {
+                    if(fDebug) LogPrintf("spork - got updated spork %s block %d \n", hash.ToString(), nHeight);
+                }
             }
         }
 
-        LogPrintf("spork - new %s ID %d Time %d bestHeight %d\n", hash.ToString(), spork.nSporkID, spork.nValue, chainActive.Tip()->nHeight);
+        LogPrintf("spork - new %s ID %d Time %d bestHeight %d\n", hash.ToString(), spork.nSporkID, spork.nValue, nHeight);
 
         if(!sporkManager.CheckSignature(spork)){
             LogPrintf("spork - invalid signature\n");
@@ -55,8 +64,15 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
             return;
         }
 
-        mapSporks[hash] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        {
+            LOCK(cs_mapSporks);
+            // another message worker may have stored a newer one meanwhile
+            if(mapSporksActive.count(spork.nSporkID) && mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned)
+                return;
+            mapSporks[hash] = spork;
+            mapSporksActive[spork.nSporkID] = spork;
+        }
+
         sporkManager.Relay(spork);
 
         //does a task if needed
@@ -64,9 +80,14 @@ void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
     }
     if (strCommand == "getsporks")
     {
-        std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
+        std::map<int, CSporkMessage> mapSporksCopy;
+        {
+            LOCK(cs_mapSporks);
+            mapSporksCopy = mapSporksActive;
+        }
+        std::map<int, CSporkMessage>::iterator it = mapSporksCopy.begin();
 
-        while(it != mapSporksActive.end()) {
+        while(it != mapSporksCopy.end()) {
             pfrom->PushMessage("spork", it->second);
             it++;
         }
@@ -79,6 +100,7 @@ bool IsSporkActive(int nSporkID)
 {
     int64_t r = -1;
 
+    LOCK(cs_mapSporks);
     if(mapSporksActive.count(nSporkID)){
         r = mapSporksActive[nSporkID].nValue;
     } else {
@@ -111,6 +133,7 @@ int64_t GetSporkValue(int nSporkID)
 {
     int64_t r = -1;
 
+    LOCK(cs_mapSporks);
     if(mapSporksActive.count(nSporkID)){
         r = mapSporksActive[nSporkID].nValue;
     } else {
@@ -243,6 +266,7 @@ bool CSporkManager::UpdateSpork(int nSporkID, int64_t nValue)
 
     if(Sign(msg)){
         Relay(msg);
+        LOCK(cs_mapSporks);
         mapSporks[msg.GetHash()] = msg;
         mapSporksActive[nSporkID] = msg;
         return true;
@@ -61,6 +61,8 @@ using namespace boost;
 class CSporkMessage;
 class CSporkManager;
 
+// Sporks are read by the message workers as well as the message handler
+extern CCriticalSection cs_mapSporks;
 extern std::map<uint256, CSporkMessage> mapSporks;
 extern std::map<int, CSporkMessage> mapSporksActive;
 extern CSporkManager sporkManager;
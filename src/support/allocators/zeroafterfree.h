@@ -9,6 +9,7 @@
 #include "support/cleanse.h"
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 template <typename T>
@@ -34,6 +35,19 @@ struct zero_after_free_allocator : public std::allocator<T> {
         typedef zero_after_free_allocator<_Other> other;
     };
 
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new ((void*)p) U(std::forward<Args>(args)...);
+    }
+    // Default rather than value initialization, so a resize without a fill value
+    // doesn't zero bytes that are about to be written over
+    template <typename U>
+    void construct(U* p)
+    {
+        ::new ((void*)p) U;
+    }
+
     void deallocate(T* p, std::size_t n)
     {
         if (p != NULL)
@@ -362,8 +362,14 @@ void CSystemnodePayments::CheckAndRemove()
         if(nHeight - winner.nBlockHeight > nLimit){
             LogPrint("snpayments", "CSystemnodePayments::CleanPaymentList - Removing old Systemnode payment - block %d\n", winner.nBlockHeight);
             systemnodeSync.mapSeenSyncSNW.erase((*it).first);
+            relayCache.Erase(CInv(MSG_SYSTEMNODE_WINNER, (*it).first));
             mapSystemnodePayeeVotes.erase(it++);
-            mapSystemnodeBlocks.erase(winner.nBlockHeight);
+
+            std::map<int, CSystemnodeBlockPayees>::iterator itBlock = mapSystemnodeBlocks.find(winner.nBlockHeight);
+            if(itBlock != mapSystemnodeBlocks.end()) {
+                RemovePaidHeights(itBlock->second);
+                mapSystemnodeBlocks.erase(itBlock);
+            }
         } else {
             ++it;
         }
@@ -508,11 +514,65 @@ bool CSystemnodePayments::AddWinningSystemnode(CSystemnodePaymentWinner& winnerI
 
     int n = 1;
     if(IsReferenceNode(winnerIn.vinSystemnode)) n = 100;
-    mapSystemnodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, n);
+
+    LOCK(cs_mapSystemnodeBlocks);
+    CSystemnodeBlockPayees& blockPayees = mapSystemnodeBlocks[winnerIn.nBlockHeight];
+    blockPayees.AddPayee(winnerIn.payee, n);
+    if(blockPayees.HasPayeeWithVotes(winnerIn.payee, SNPAYMENTS_PAID_VOTES_REQUIRED))
+        AddPaidHeight(winnerIn.payee, winnerIn.nBlockHeight);
 
     return true;
 }
 
+void CSystemnodePayments::AddPaidHeight(const CScript& payee, int nBlockHeight)
+{
+    AssertLockHeld(cs_mapSystemnodeBlocks);
+    mapPayeePaidHeights[payee].insert(nBlockHeight);
+}
+
+void CSystemnodePayments::RemovePaidHeights(const CSystemnodeBlockPayees& blockPayees)
+{
+    AssertLockHeld(cs_mapSystemnodeBlocks);
+
+    BOOST_FOREACH(const CSystemnodePayee& payee, blockPayees.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator it = mapPayeePaidHeights.find(payee.scriptPubKey);
+        if(it == mapPayeePaidHeights.end()) continue;
+
+        it->second.erase(blockPayees.nBlockHeight);
+        if(it->second.empty())
+            mapPayeePaidHeights.erase(it);
+    }
+}
+
+void CSystemnodePayments::RebuildPaidIndex()
+{
+    LOCK(cs_mapSystemnodeBlocks);
+
+    mapPayeePaidHeights.clear();
+    std::map<int, CSystemnodeBlockPayees>::iterator it = mapSystemnodeBlocks.begin();
+    for(; it != mapSystemnodeBlocks.end(); ++it) {
+        BOOST_FOREACH(const CSystemnodePayee& payee, it->second.vecPayments) {
+            if(payee.nVotes >= SNPAYMENTS_PAID_VOTES_REQUIRED)
+                AddPaidHeight(payee.scriptPubKey, it->first);
+        }
+    }
+}
+
+int CSystemnodePayments::GetLastPaidHeight(const CScript& payee, int nMaxHeight, int nMinHeight)
+{
+    LOCK(cs_mapSystemnodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator it = mapPayeePaidHeights.find(payee);
+    if(it == mapPayeePaidHeights.end()) return 0;
+
+    // the first paid height above nMaxHeight, step back once to get the most recent one in range
+    std::set<int>::const_iterator itHeight = it->second.upper_bound(nMaxHeight);
+    if(itHeight == it->second.begin()) return 0;
+    --itHeight;
+
+    return *itHeight >= nMinHeight ? *itHeight : 0;
+}
+
 void CSystemnodePaymentWinner::Relay()
 {
     CInv inv(MSG_SYSTEMNODE_WINNER, GetHash());
@@ -9,6 +9,7 @@
 #include "main.h"
 #include "systemnode.h"
 #include <boost/lexical_cast.hpp>
+#include <set>
 
 using namespace std;
 
@@ -24,6 +25,7 @@ extern CSystemnodePayments systemnodePayments;
 
 #define SNPAYMENTS_SIGNATURES_REQUIRED           6
 #define SNPAYMENTS_SIGNATURES_TOTAL              10
+#define SNPAYMENTS_PAID_VOTES_REQUIRED           2
 #define SN_PMT_SLOT                              2
 
 void SNFillBlockPayee(CMutableTransaction& txNew, int64_t nFees);
@@ -196,6 +198,13 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    // Heights at which each payee collected at least SNPAYMENTS_PAID_VOTES_REQUIRED winner votes,
+    // kept in step with mapSystemnodeBlocks so last paid lookups don't have to walk the chain
+    std::map<CScript, std::set<int> > mapPayeePaidHeights;
+
+    void AddPaidHeight(const CScript& payee, int nBlockHeight);
+    void RemovePaidHeights(const CSystemnodeBlockPayees& blockPayees);
+
 public:
     std::map<uint256, CSystemnodePaymentWinner> mapSystemnodePayeeVotes;
     std::map<int, CSystemnodeBlockPayees> mapSystemnodeBlocks;
@@ -210,7 +219,10 @@ public:
     void Clear() {
         LOCK2(cs_mapSystemnodeBlocks, cs_mapSystemnodePayeeVotes);
         mapSystemnodeBlocks.clear();
+        BOOST_FOREACH(const PAIRTYPE(const uint256, CSystemnodePaymentWinner)& item, mapSystemnodePayeeVotes)
+            relayCache.Erase(CInv(MSG_SYSTEMNODE_WINNER, item.first));
         mapSystemnodePayeeVotes.clear();
+        mapPayeePaidHeights.clear();
     }
 
     bool ProcessBlock(int nBlockHeight);
@@ -218,6 +230,9 @@ public:
     void ProcessMessageSystemnodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
     void Sync(CNode* node, int nCountNeeded);
     void CheckAndRemove();
+    /// Most recent height in [nMinHeight, nMaxHeight] at which payee was paid, 0 if there is none
+    int GetLastPaidHeight(const CScript& payee, int nMaxHeight, int nMinHeight);
+    void RebuildPaidIndex();
     bool IsTransactionValid(const CAmount& nValueCreated, const CTransaction& txNew, int nBlockHeight);
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsScheduled(CSystemnode& sn, int nNotBlockHeight);
@@ -232,6 +247,8 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(mapSystemnodePayeeVotes);
         READWRITE(mapSystemnodeBlocks);
+        if (ser_action.ForRead())
+            RebuildPaidIndex();
     }
 };
 
@@ -121,6 +121,7 @@ bool CSystemnodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled, bool fChec
             uint256 hash = snb.GetHash();
             if(snodeman.mapSeenSystemnodeBroadcast.count(hash)) {
                 snodeman.mapSeenSystemnodeBroadcast[hash].lastPing = *this;
+                relayCache.Erase(CInv(MSG_SYSTEMNODE_ANNOUNCE, hash));
             }
 
             psn->Check(true);
@@ -173,6 +174,7 @@ CSystemnode::CSystemnode()
     unitTest = false;
     protocolVersion = PROTOCOL_VERSION;
     lastTimeChecked = 0;
+    nCacheCollateralHeight = -1;
 }
 
 CSystemnode::CSystemnode(const CSystemnode& other)
@@ -189,6 +191,7 @@ CSystemnode::CSystemnode(const CSystemnode& other)
     lastPing = other.lastPing;
     unitTest = other.unitTest;
     protocolVersion = other.protocolVersion;
+    nCacheCollateralHeight = other.nCacheCollateralHeight;
     lastTimeChecked = 0;
 }
 
@@ -207,6 +210,7 @@ CSystemnode::CSystemnode(const CSystemnodeBroadcast& snb)
     unitTest = false;
     protocolVersion = snb.protocolVersion;
     lastTimeChecked = 0;
+    nCacheCollateralHeight = -1;
 }
 
 bool CSystemnode::IsValidNetAddr()
@@ -229,7 +233,7 @@ arith_uint256 CSystemnode::CalculateScore(int64_t nBlockHeight) const
         return arith_uint256();
 
     // Find the block hash where tx got SYSTEMNODE_MIN_CONFIRMATIONS
-    CBlockIndex *pblockIndex = chainActive[GetInputHeight(vin) + SYSTEMNODE_MIN_CONFIRMATIONS - 1];
+    CBlockIndex *pblockIndex = chainActive[GetCollateralHeight() + SYSTEMNODE_MIN_CONFIRMATIONS - 1];
     if (!pblockIndex)
         return arith_uint256();
     uint256 collateralMinConfBlockHash = pblockIndex->GetBlockHash();
@@ -246,6 +250,19 @@ arith_uint256 CSystemnode::CalculateScore(int64_t nBlockHeight) const
     return UintToArith256(ss.GetHash());
 }
 
+int CSystemnode::GetCollateralHeight() const
+{
+    if(nCacheCollateralHeight >= 0)
+        return nCacheCollateralHeight;
+
+    int nHeight = GetInputHeight(vin);
+    // only a confirmed collateral has a height that won't change until a reorg
+    if(nHeight >= 0 && nHeight != MEMPOOL_HEIGHT)
+        nCacheCollateralHeight = nHeight;
+
+    return nHeight;
+}
+
 //
 // When a new systemnode broadcast is sent, update our information
 //
@@ -310,12 +327,9 @@ void CSystemnode::Check(bool forceCheck)
     activeState = SYSTEMNODE_ENABLED; // OK
 }
 
-int64_t CSystemnode::SecondsSincePayment() const
+int64_t CSystemnode::SecondsSincePayment(int nMaxBlocksAgo) const
 {
-    CScript pubkeyScript;
-    pubkeyScript = GetScriptForDestination(pubkey.GetID());
-
-    int64_t sec = (GetAdjustedTime() - GetLastPaid());
+    int64_t sec = (GetAdjustedTime() - GetLastPaid(nMaxBlocksAgo));
     int64_t month = 60*60*24*30;
     if(sec < month) return sec; //if it's less than 30 days, give seconds
 
@@ -328,7 +342,7 @@ int64_t CSystemnode::SecondsSincePayment() const
     return month + UintToArith256(hash).GetCompact(false);
 }
 
-int64_t CSystemnode::GetLastPaid() const
+int64_t CSystemnode::GetLastPaid(int nMaxBlocksAgo) const
 {
     CBlockIndex* pindexPrev = chainActive.Tip();
     if(pindexPrev == NULL) return false;
@@ -344,33 +358,19 @@ int64_t CSystemnode::GetLastPaid() const
     // use a deterministic offset to break a tie -- 2.5 minutes
     int64_t nOffset = UintToArith256(hash).GetCompact(false) % 150; 
 
-    if (chainActive.Tip() == NULL) return false;
-
-    const CBlockIndex *BlockReading = chainActive.Tip();
+    if(nMaxBlocksAgo < 0)
+        nMaxBlocksAgo = snodeman.CountEnabled()*1.25;
 
-    int nMnCount = snodeman.CountEnabled()*1.25;
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if(n >= nMnCount){
-            return 0;
-        }
-        n++;
-
-        if(systemnodePayments.mapSystemnodeBlocks.count(BlockReading->nHeight)){
-            /*
-                Search for this payee, with at least 2 votes. This will aid in consensus allowing the network 
-                to converge on the same payees quickly, then keep the same schedule.
-            */
-            if(systemnodePayments.mapSystemnodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(snpayee, 2)){
-                return BlockReading->nTime + nOffset;
-            }
-        }
-
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
-    }
+    /*
+        Search for this payee, with at least 2 votes. This will aid in consensus allowing the network 
+        to converge on the same payees quickly, then keep the same schedule.
+    */
+    int nMinHeight = std::max(pindexPrev->nHeight - nMaxBlocksAgo + 1, 1);
+    int nPaidHeight = systemnodePayments.GetLastPaidHeight(snpayee, pindexPrev->nHeight, nMinHeight);
+    if(nPaidHeight == 0)
+        return 0;
 
-    return 0;
+    return chainActive[nPaidHeight]->nTime + nOffset;
 }
 
 // Find all blocks where SN received reward within defined block depth
@@ -532,7 +532,7 @@ bool CSystemnodeBroadcast::CheckAndUpdate(int& nDos) const
     if(psn->pubkey == pubkey && !psn->IsBroadcastedWithin(SYSTEMNODE_MIN_SNB_SECONDS)) {
         //take the newest entry
         LogPrintf("snb - Got updated entry for %s\n", addr.ToString());
-        if(psn->UpdateFromNewBroadcast((*this))){
+        if(snodeman.UpdateFromNewBroadcast(*psn, *this)){
             psn->Check();
             if(psn->IsEnabled()) Relay();
         }
@@ -576,6 +576,7 @@ bool CSystemnodeBroadcast::CheckInputsAndAdd(int& nDoS) const
             // not snb fault, let it to be checked again later
             snodeman.mapSeenSystemnodeBroadcast.erase(GetHash());
             systemnodeSync.mapSeenSyncSNB.erase(GetHash());
+            relayCache.Erase(CInv(MSG_SYSTEMNODE_ANNOUNCE, GetHash()));
             return false;
         }
 
@@ -593,6 +594,7 @@ bool CSystemnodeBroadcast::CheckInputsAndAdd(int& nDoS) const
         // maybe we miss few blocks, let this snb to be checked again later
         snodeman.mapSeenSystemnodeBroadcast.erase(GetHash());
         systemnodeSync.mapSeenSyncSNB.erase(GetHash());
+        relayCache.Erase(CInv(MSG_SYSTEMNODE_ANNOUNCE, GetHash()));
         return false;
     }
 
@@ -109,6 +109,8 @@ private:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
     int64_t lastTimeChecked;
+    // height of the block that confirmed vin, -1 while unknown
+    mutable int nCacheCollateralHeight;
 public:
     enum state
     {
@@ -126,8 +128,6 @@ public:
     std::vector<unsigned char> sig;
     int activeState;
     int64_t sigTime; //snb message time
-    int cacheInputAge;
-    int cacheInputAgeBlock;
     bool unitTest;
     int protocolVersion;
     CSystemnodePing lastPing;
@@ -155,6 +155,7 @@ public:
         swap(first.unitTest, second.unitTest);
         swap(first.protocolVersion, second.protocolVersion);
         swap(first.vchSignover, second.vchSignover);
+        swap(first.nCacheCollateralHeight, second.nCacheCollateralHeight);
     }
 
     CSystemnode& operator=(CSystemnode from)
@@ -193,7 +194,7 @@ public:
         READWRITE(vchSignover);
     }
 
-    int64_t SecondsSincePayment() const;
+    int64_t SecondsSincePayment(int nMaxBlocksAgo = -1) const;
     bool UpdateFromNewBroadcast(const CSystemnodeBroadcast& snb);
     void Check(bool forceCheck = false);
     bool IsBroadcastedWithin(int seconds) const
@@ -205,16 +206,21 @@ public:
         return activeState == SYSTEMNODE_ENABLED;
     }
     bool IsValidNetAddr();
-    int GetSystemnodeInputAge()
+    int GetSystemnodeInputAge() const
     {
         if(chainActive.Tip() == NULL) return 0;
 
-        if(cacheInputAge == 0){
-            cacheInputAge = GetInputAge(vin);
-            cacheInputAgeBlock = chainActive.Tip()->nHeight;
-        }
+        int nCollateralHeight = GetCollateralHeight();
+        if(nCollateralHeight < 0 || nCollateralHeight == MEMPOOL_HEIGHT) return 0;
+
+        return (chainActive.Tip()->nHeight + 1) - nCollateralHeight;
+    }
 
-        return cacheInputAge+(chainActive.Tip()->nHeight-cacheInputAgeBlock);
+    /// Height of the block that confirmed vin, looked up once and kept until that block is disconnected
+    int GetCollateralHeight() const;
+    void BlockDisconnected(int nHeight)
+    {
+        if(nCacheCollateralHeight >= nHeight) nCacheCollateralHeight = -1;
     }
     bool IsPingedWithin(int seconds, int64_t now = -1) const
     {
@@ -236,7 +242,8 @@ public:
 
         return strStatus;
     }
-    int64_t GetLastPaid() const;
+    /// Time of the last payment within nMaxBlocksAgo blocks of the tip, defaults to 1.25 times the enabled node count
+    int64_t GetLastPaid(int nMaxBlocksAgo = -1) const;
 
     bool GetRecentPaymentBlocks(std::vector<const CBlockIndex*>& vPaymentBlocks, bool limitMostRecent = false) const;
 };
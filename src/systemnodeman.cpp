@@ -33,43 +33,23 @@ struct CompareScoreTxIn
     }
 };
 
-struct CompareScoreSN
+std::vector<pair<int, CTxIn> > CSystemnodeMan::GetSystemnodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    bool operator()(const pair<int64_t, CSystemnode>& t1,
-                    const pair<int64_t, CSystemnode>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
-
-std::vector<pair<int, CSystemnode> > CSystemnodeMan::GetSystemnodeRanks(int64_t nBlockHeight, int minProtocol)
-{
-    std::vector<pair<int64_t, CSystemnode> > vecSystemnodeScores;
-    std::vector<pair<int, CSystemnode> > vecSystemnodeRanks;
-
-    //make sure we know about this block
-    uint256 hash = uint256();
-    if(!GetBlockHash(hash, nBlockHeight)) return vecSystemnodeRanks;
+    LOCK(cs);
 
-    // scan for winner
-    for (auto& sn : vSystemnodes)
-    {
-        sn.Check();
+    std::vector<pair<int, CTxIn> > vecSystemnodeRanks;
 
-        if(sn.protocolVersion < minProtocol) continue;
-        if(!sn.IsEnabled()) {
-            continue;
-        }
+    const std::vector<pair<int64_t, CTxIn> >* pvecScores = GetScores(nBlockHeight);
+    if(pvecScores == NULL) return vecSystemnodeRanks;
 
-        int64_t n2 = sn.CalculateScore(nBlockHeight).GetCompact(false);
-
-        vecSystemnodeScores.push_back(make_pair(n2, sn));
-    }
+    int rank = 0;
+    BOOST_FOREACH(const PAIRTYPE(int64_t, CTxIn)& s, *pvecScores) {
+        CSystemnode* psn = Find(s.second);
+        if(psn == NULL) continue;
 
-    sort(vecSystemnodeScores.rbegin(), vecSystemnodeScores.rend(), CompareScoreSN());
+        psn->Check();
+        if(psn->protocolVersion < minProtocol || !psn->IsEnabled()) continue;
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CSystemnode)& s, vecSystemnodeScores){
         rank++;
         vecSystemnodeRanks.push_back(make_pair(rank, s.second));
     }
@@ -267,36 +247,24 @@ CSystemnode *CSystemnodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CSystemnode& sn, vSystemnodes)
-    {
-        if(sn.vin.prevout == vin.prevout)
-            return &sn;
-    }
-    return NULL;
+    int nPos = indexSystemnodes.Find(vin.prevout);
+    return nPos < 0 ? NULL : &vSystemnodes[nPos];
 }
 
 CSystemnode *CSystemnodeMan::Find(const CPubKey &pubKeySystemnode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CSystemnode& mn, vSystemnodes)
-    {
-        if(mn.pubkey2 == pubKeySystemnode)
-            return &mn;
-    }
-    return NULL;
+    int nPos = indexSystemnodes.Find(pubKeySystemnode);
+    return nPos < 0 ? NULL : &vSystemnodes[nPos];
 }
 
 CSystemnode *CSystemnodeMan::Find(const CService& addr)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CSystemnode& sn, vSystemnodes)
-    {
-        if(sn.addr == addr)
-            return &sn;
-    }
-    return NULL;
+    int nPos = indexSystemnodes.Find(addr);
+    return nPos < 0 ? NULL : &vSystemnodes[nPos];
 }
 
 // 
@@ -314,6 +282,7 @@ CSystemnode* CSystemnodeMan::GetNextSystemnodeInQueueForPayment(int nBlockHeight
     */
 
     int nSnCount = CountEnabled();
+    int nLastPaidDepth = nSnCount*1.25;
     BOOST_FOREACH(CSystemnode &sn, vSystemnodes)
     {
         sn.Check();
@@ -332,7 +301,7 @@ CSystemnode* CSystemnodeMan::GetNextSystemnodeInQueueForPayment(int nBlockHeight
         //make sure it has as many confirmations as there are systemnodes
         if(sn.GetSystemnodeInputAge() < nSnCount) continue;
 
-        vecSystemnodeLastPaid.push_back(make_pair(sn.SecondsSincePayment(), sn.vin));
+        vecSystemnodeLastPaid.push_back(make_pair(sn.SecondsSincePayment(nLastPaidDepth), sn.vin));
     }
 
     nCount = (int)vecSystemnodeLastPaid.size();
@@ -347,7 +316,7 @@ CSystemnode* CSystemnodeMan::GetNextSystemnodeInQueueForPayment(int nBlockHeight
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = CountEnabled()/10;
+    int nTenthNetwork = nSnCount/10;
     int nCountTenth = 0; 
     arith_uint256 nHigh = 0;
     BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn)& s, vecSystemnodeLastPaid) {
@@ -377,6 +346,8 @@ bool CSystemnodeMan::Add(CSystemnode &sn)
     {
         LogPrint("systemnode", "CSystemnodeMan: Adding new Systemnode %s - %i now\n", sn.addr.ToString(), size() + 1);
         vSystemnodes.push_back(sn);
+        indexSystemnodes.Add(vSystemnodes.back(), vSystemnodes.size() - 1);
+        mapRankCache.clear();
         return true;
     }
 
@@ -396,10 +367,24 @@ void CSystemnodeMan::UpdateSystemnodeList(CSystemnodeBroadcast snb) {
         CSystemnode sn(snb);
         Add(sn);
     } else {
-        psn->UpdateFromNewBroadcast(snb);
+        UpdateFromNewBroadcast(*psn, snb);
     }
 }
 
+bool CSystemnodeMan::UpdateFromNewBroadcast(CSystemnode& sn, const CSystemnodeBroadcast& snb)
+{
+    LOCK(cs);
+
+    CPubKey pubkey2Old = sn.pubkey2;
+    CService addrOld = sn.addr;
+    if(!sn.UpdateFromNewBroadcast(snb)) return false;
+
+    if(sn.pubkey2 != pubkey2Old || sn.addr != addrOld)
+        indexSystemnodes.Rebuild(vSystemnodes);
+
+    return true;
+}
+
 void CSystemnodeMan::Remove(CTxIn vin)
 {
     LOCK(cs);
@@ -409,6 +394,8 @@ void CSystemnodeMan::Remove(CTxIn vin)
         if((*it).vin == vin){
             LogPrint("systemnode", "CSystemnodeMan: Removing Systemnode %s - %i now\n", (*it).addr.ToString(), size() - 1);
             vSystemnodes.erase(it);
+            indexSystemnodes.Rebuild(vSystemnodes);
+            mapRankCache.clear();
             break;
         }
         ++it;
@@ -467,13 +454,27 @@ void CSystemnodeMan::Clear()
 {
     LOCK(cs);
     vSystemnodes.clear();
+    indexSystemnodes.Clear();
+    mapRankCache.clear();
     mAskedUsForSystemnodeList.clear();
     mWeAskedForSystemnodeList.clear();
     mWeAskedForSystemnodeListEntry.clear();
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CSystemnodeBroadcast)& item, mapSeenSystemnodeBroadcast)
+        relayCache.Erase(CInv(MSG_SYSTEMNODE_ANNOUNCE, item.first));
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CSystemnodePing)& item, mapSeenSystemnodePing)
+        relayCache.Erase(CInv(MSG_SYSTEMNODE_PING, item.first));
     mapSeenSystemnodeBroadcast.clear();
     mapSeenSystemnodePing.clear();
 }
 
+void CSystemnodeMan::BlockDisconnected(int nHeight)
+{
+    LOCK(cs);
+    BOOST_FOREACH(CSystemnode& sn, vSystemnodes)
+        sn.BlockDisconnected(nHeight);
+    mapRankCache.clear();
+}
+
 void CSystemnodeMan::Check()
 {
     LOCK(cs);
@@ -485,51 +486,82 @@ void CSystemnodeMan::Check()
 
 CSystemnode* CSystemnodeMan::GetCurrentSystemNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
-    int64_t score = 0;
-    CSystemnode* winner = NULL;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CSystemnode& mn, vSystemnodes) {
-        mn.Check();
-        if(mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
+    const std::vector<pair<int64_t, CTxIn> >* pvecScores = GetScores(nBlockHeight);
+    if(pvecScores == NULL) return NULL;
 
-        // calculate the score for each Systemnode
-        int64_t n2 = mn.CalculateScore(nBlockHeight).GetCompact(false);
+    // the first enabled entry with a non zero score is the winner
+    BOOST_FOREACH(const PAIRTYPE(int64_t, CTxIn)& s, *pvecScores) {
+        if(s.first <= 0) break;
 
-        // determine the winner
-        if(n2 > score){
-            score = n2;
-            winner = &mn;
-        }
+        CSystemnode* psn = Find(s.second);
+        if(psn == NULL) continue;
+
+        psn->Check();
+        if(psn->protocolVersion < minProtocol || !psn->IsEnabled()) continue;
+
+        return psn;
     }
 
-    return winner;
+    return NULL;
 }
 
-int CSystemnodeMan::GetSystemnodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const std::vector<pair<int64_t, CTxIn> >* CSystemnodeMan::GetScores(int64_t nBlockHeight)
 {
-    std::vector<pair<int64_t, CTxIn> > vecSystemnodeScores;
+    LOCK(cs);
+
+    if(chainActive.Tip() == NULL) return NULL;
+
+    // scores depend on the chain, start over whenever the tip moves
+    if(hashRankCacheTip != chainActive.Tip()->GetBlockHash()) {
+        mapRankCache.clear();
+        hashRankCacheTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    // height 0 stands for the tip when calculating scores
+    if(nBlockHeight == 0) nBlockHeight = chainActive.Tip()->nHeight;
+
+    std::map<int64_t, std::vector<pair<int64_t, CTxIn> > >::const_iterator it = mapRankCache.find(nBlockHeight);
+    if(it != mapRankCache.end()) return &it->second;
 
     //make sure we know about this block
     uint256 hash = uint256();
-    if(!GetBlockHash(hash, nBlockHeight)) return -1;
+    if(!GetBlockHash(hash, nBlockHeight)) return NULL;
 
-    // scan for winner
+    std::vector<pair<int64_t, CTxIn> > vecScores;
+    vecScores.reserve(vSystemnodes.size());
     BOOST_FOREACH(CSystemnode& sn, vSystemnodes) {
-        if(sn.protocolVersion < minProtocol) continue;
-        if(fOnlyActive) {
-            sn.Check();
-            if(!sn.IsEnabled()) continue;
-        }
         int64_t n2 = sn.CalculateScore(nBlockHeight).GetCompact(false);
-
-        vecSystemnodeScores.push_back(make_pair(n2, sn.vin));
+        vecScores.push_back(make_pair(n2, sn.vin));
     }
 
-    sort(vecSystemnodeScores.rbegin(), vecSystemnodeScores.rend(), CompareScoreTxIn());
+    sort(vecScores.rbegin(), vecScores.rend(), CompareScoreTxIn());
+
+    if(mapRankCache.size() >= SYSTEMNODES_RANK_CACHE_HEIGHTS)
+        mapRankCache.erase(mapRankCache.begin());
+
+    std::vector<pair<int64_t, CTxIn> >& vecCached = mapRankCache[nBlockHeight];
+    vecCached.swap(vecScores);
+    return &vecCached;
+}
+
+int CSystemnodeMan::GetSystemnodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    LOCK(cs);
+
+    const std::vector<pair<int64_t, CTxIn> >* pvecScores = GetScores(nBlockHeight);
+    if(pvecScores == NULL) return -1;
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn)& s, vecSystemnodeScores){
+    BOOST_FOREACH(const PAIRTYPE(int64_t, CTxIn)& s, *pvecScores) {
+        CSystemnode* psn = Find(s.second);
+        if(psn == NULL || psn->protocolVersion < minProtocol) continue;
+        if(fOnlyActive) {
+            psn->Check();
+            if(!psn->IsEnabled()) continue;
+        }
+
         rank++;
         if(s.second.prevout == vin.prevout) {
             return rank;
@@ -546,6 +578,7 @@ void CSystemnodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
+    bool fRemoved = false;
     vector<CSystemnode>::iterator it = vSystemnodes.begin();
     while(it != vSystemnodes.end()){
         if((*it).activeState == CSystemnode::SYSTEMNODE_REMOVE ||
@@ -561,6 +594,7 @@ void CSystemnodeMan::CheckAndRemove(bool forceExpiredRemoval)
             while(it3 != mapSeenSystemnodeBroadcast.end()){
                 if((*it3).second.vin == (*it).vin){
                     systemnodeSync.mapSeenSyncSNB.erase((*it3).first);
+                    relayCache.Erase(CInv(MSG_SYSTEMNODE_ANNOUNCE, (*it3).first));
                     mapSeenSystemnodeBroadcast.erase(it3++);
                 } else {
                     ++it3;
@@ -578,11 +612,17 @@ void CSystemnodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vSystemnodes.erase(it);
+            fRemoved = true;
         } else {
             ++it;
         }
     }
 
+    if(fRemoved) {
+        indexSystemnodes.Rebuild(vSystemnodes);
+        mapRankCache.clear();
+    }
+
     // check who's asked for the Systemnode list
     map<CNetAddr, int64_t>::iterator it1 = mAskedUsForSystemnodeList.begin();
     while(it1 != mAskedUsForSystemnodeList.end()){
@@ -619,6 +659,7 @@ void CSystemnodeMan::CheckAndRemove(bool forceExpiredRemoval)
         if((*it3).second.lastPing.sigTime < GetTime() - SYSTEMNODE_REMOVAL_SECONDS*2){
             LogPrint("systemnode", "CSystemnodeMan::CheckAndRemove - Removing expired Systemnode broadcast %s\n", (*it3).second.GetHash().ToString());
             systemnodeSync.mapSeenSyncSNB.erase((*it3).second.GetHash());
+            relayCache.Erase(CInv(MSG_SYSTEMNODE_ANNOUNCE, (*it3).first));
             mapSeenSystemnodeBroadcast.erase(it3++);
         } else {
             ++it3;
@@ -629,6 +670,7 @@ void CSystemnodeMan::CheckAndRemove(bool forceExpiredRemoval)
     map<uint256, CSystemnodePing>::iterator it4 = mapSeenSystemnodePing.begin();
     while(it4 != mapSeenSystemnodePing.end()){
         if((*it4).second.sigTime < GetTime()-(SYSTEMNODE_REMOVAL_SECONDS*2)){
+            relayCache.Erase(CInv(MSG_SYSTEMNODE_PING, (*it4).first));
             mapSeenSystemnodePing.erase(it4++);
         } else {
             ++it4;
@@ -12,9 +12,11 @@
 #include "base58.h"
 #include "main.h"
 #include "systemnode.h"
+#include "nodeindex.h"
 
 #define SYSTEMNODES_DUMP_SECONDS               (15*60)
 #define SYSTEMNODES_DSEG_SECONDS               (3*60*60)
+#define SYSTEMNODES_RANK_CACHE_HEIGHTS        16
 
 using namespace std;
 
@@ -33,6 +35,12 @@ private:
 
     // map to hold all SNs
     std::vector<CSystemnode> vSystemnodes;
+    // lookup tables into vSystemnodes, rebuilt whenever an entry is removed
+    CNodeIndex<CSystemnode> indexSystemnodes;
+    // scores of every entry for recently requested heights, sorted high to low and
+    // shared by all rank lookups until the tip or the list changes
+    std::map<int64_t, std::vector<pair<int64_t, CTxIn> > > mapRankCache;
+    uint256 hashRankCacheTip;
     // who's asked for the Systemnode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForSystemnodeList;
     // who we asked for the Systemnode list and the last time
@@ -52,6 +60,10 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         LOCK(cs);
         READWRITE(vSystemnodes);
+        if (ser_action.ForRead()) {
+            indexSystemnodes.Rebuild(vSystemnodes);
+            mapRankCache.clear();
+        }
         READWRITE(mAskedUsForSystemnodeList);
         READWRITE(mWeAskedForSystemnodeList);
         READWRITE(mWeAskedForSystemnodeListEntry);
@@ -78,6 +90,9 @@ public:
     /// Clear Systemnode vector
     void Clear();
 
+    /// Forget cached collateral heights at or above a disconnected block
+    void BlockDisconnected(int nHeight);
+
     int CountEnabled(int protocolVersion = -1);
 
     void DsegUpdate(CNode* pnode);
@@ -95,7 +110,10 @@ public:
 
     std::vector<CSystemnode> GetFullSystemnodeVector() { Check(); return vSystemnodes; }
     
-    std::vector<pair<int, CSystemnode> > GetSystemnodeRanks(int64_t nBlockHeight, int minProtocol=0);
+    /// Scores of all entries at nBlockHeight sorted high to low, NULL if the block is unknown
+    const std::vector<pair<int64_t, CTxIn> >* GetScores(int64_t nBlockHeight);
+
+    std::vector<pair<int, CTxIn> > GetSystemnodeRanks(int64_t nBlockHeight, int minProtocol=0);
     int GetSystemnodeRank(const CTxIn &vin, int64_t nBlockHeight, int minProtocol=0, bool fOnlyActive=true);
 
     void ProcessSystemnodeConnections();
@@ -109,6 +127,9 @@ public:
 
     void Remove(CTxIn vin);
 
+    /// Update an entry from a newer broadcast, keeping the lookup tables in sync
+    bool UpdateFromNewBroadcast(CSystemnode& sn, const CSystemnodeBroadcast& snb);
+
     /// Update systemnode list and maps using provided CSystemnodeBroadcast
     void UpdateSystemnodeList(CSystemnodeBroadcast snb);
 
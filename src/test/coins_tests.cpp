@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
@@ -41,7 +42,7 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CCoinsStats& statsDelta)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             map_[it->first] = it->second.coins;
@@ -70,12 +71,91 @@ public:
         size_t ret = memusage::DynamicUsage(cacheCoins);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
             ret += it->second.coins.DynamicMemoryUsage();
+            ret += memusage::DynamicUsage(it->second.vBaseUnspent);
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
 };
 
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    //! Store coins in the per transaction format of older databases
+    void WriteOldFormat(const uint256& txid, const CCoins& coins)
+    {
+        db.Write(std::make_pair('c', txid), coins);
+        fUpgrading = true;
+    }
+};
+
+CCoins RandomCoins()
+{
+    CCoins coins;
+    coins.fBlockReward = insecure_rand() % 2;
+    coins.nHeight = insecure_rand() % 100000;
+    coins.nVersion = 1 + insecure_rand() % 2;
+    coins.vout.resize(1 + insecure_rand() % 40);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = insecure_rand() % 1000000;
+        coins.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return coins;
+}
+
+void CheckSameStats(const CCoinsStats& stats, const CCoinsStats& statsExpected)
+{
+    BOOST_CHECK_EQUAL(stats.nTransactions, statsExpected.nTransactions);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, statsExpected.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nSerializedSize, statsExpected.nSerializedSize);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, statsExpected.nTotalAmount);
+    BOOST_CHECK(stats.GetHash() == statsExpected.GetHash());
+}
+
+//! Add transactions and spend or restore outputs of earlier ones, keeping the statistics delta up to date
+void RandomlyModifyCoins(CCoinsViewCache& cache, std::vector<uint256>& txids, std::map<uint256, CCoins>& original)
+{
+    for (int i = 0; i < 50; i++) {
+        if (txids.empty() || insecure_rand() % 5 == 0) {
+            uint256 txid = GetRandHash();
+            txids.push_back(txid);
+            original[txid] = RandomCoins();
+            original[txid].nHeight = txids.size();
+            CCoinsModifier entry = cache.ModifyNewCoins(txid);
+            *entry = original[txid];
+            cache.GetStatsDelta().AddCoins(txid, *entry);
+            continue;
+        }
+
+        const uint256& txid = txids[insecure_rand() % txids.size()];
+        uint32_t n = insecure_rand() % original[txid].vout.size();
+        CCoinsModifier entry = cache.ModifyCoins(txid);
+        if (insecure_rand() % 3) {
+            if (!entry->IsAvailable(n))
+                continue;
+            cache.GetStatsDelta().RemoveOutput(txid, n, *entry);
+            entry->Spend(n);
+            if (entry->IsPruned())
+                cache.GetStatsDelta().nTransactions--;
+        } else {
+            if (entry->IsAvailable(n))
+                continue;
+            if (entry->IsPruned()) {
+                entry->fBlockReward = original[txid].fBlockReward;
+                entry->nHeight = original[txid].nHeight;
+                entry->nVersion = original[txid].nVersion;
+                cache.GetStatsDelta().nTransactions++;
+            }
+            if (entry->vout.size() <= n)
+                entry->vout.resize(n + 1);
+            entry->vout[n] = original[txid].vout[n];
+            cache.GetStatsDelta().AddOutput(txid, n, *entry);
+        }
+    }
+}
+
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -196,4 +276,168 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+// Spends, restores and creates outputs in caches flushed to the per output
+// coin database, part of which starts out in the old per transaction format
+// and is upgraded a few transactions at a time along the way.
+BOOST_AUTO_TEST_CASE(coins_db_per_output)
+{
+    CCoinsViewDBTest db;
+    std::map<uint256, CCoins> result;
+    std::map<uint256, CCoins> original;
+
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 100; i++) {
+            uint256 txid = GetRandHash();
+            CCoins coins = RandomCoins();
+            original[txid] = result[txid] = coins;
+            if (i % 2) {
+                db.WriteOldFormat(txid, coins);
+            } else {
+                CCoinsModifier entry = cache.ModifyNewCoins(txid);
+                *entry = coins;
+            }
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.IsUpgrading());
+
+    for (int nRound = 0; nRound < 40; nRound++) {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 50; i++) {
+            std::map<uint256, CCoins>::iterator it = result.begin();
+            std::advance(it, insecure_rand() % result.size());
+            uint32_t n = insecure_rand() % original[it->first].vout.size();
+            CCoinsModifier entry = cache.ModifyCoins(it->first);
+            if (insecure_rand() % 4) {
+                // Spend, as when connecting a block
+                entry->Spend(n);
+                it->second.Spend(n);
+            } else {
+                // Restore from the original, as when disconnecting one
+                if (entry->IsPruned()) {
+                    entry->fBlockReward = original[it->first].fBlockReward;
+                    entry->nHeight = original[it->first].nHeight;
+                    entry->nVersion = original[it->first].nVersion;
+                }
+                if (entry->vout.size() <= n)
+                    entry->vout.resize(n + 1);
+                entry->vout[n] = original[it->first].vout[n];
+                it->second = *entry;
+                it->second.Cleanup();
+            }
+        }
+        BOOST_CHECK(cache.Flush());
+        if (nRound % 3 == 0)
+            db.UpgradeCoins(10);
+
+        for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
+            CCoins coins;
+            bool fFound = db.GetCoins(it->first, coins);
+            BOOST_CHECK_EQUAL(fFound, !it->second.IsPruned());
+            BOOST_CHECK(!fFound || coins == it->second);
+            BOOST_CHECK_EQUAL(db.HaveCoins(it->first), fFound);
+        }
+    }
+
+    while (db.UpgradeCoins(10));
+    BOOST_CHECK(!db.IsUpgrading());
+    for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
+        CCoins coins;
+        BOOST_CHECK(!db.GetCoins(it->first, coins) ? it->second.IsPruned() : coins == it->second);
+    }
+}
+
+// Adds transactions and spends and restores outputs through a stack of two
+// caches, updating the statistics the way UpdateCoins and DisconnectBlock do,
+// and compares the statistics kept by the coin database with a full count.
+BOOST_AUTO_TEST_CASE(coins_stats_incremental)
+{
+    CCoinsViewDBTest db;
+    std::vector<uint256> txids;
+    std::map<uint256, CCoins> original;
+
+    CCoinsStats statsEmpty;
+    BOOST_CHECK(db.GetStats(statsEmpty));
+    BOOST_CHECK_EQUAL(statsEmpty.nTransactionOutputs, 0U);
+    BOOST_CHECK(statsEmpty.GetHash() == CCoinsStats().GetHash());
+
+    for (int nRound = 0; nRound < 20; nRound++) {
+        CCoinsViewCache cacheBase(&db);
+        CCoinsViewCache cache(&cacheBase);
+        RandomlyModifyCoins(cache, txids, original);
+
+        // The statistics look the same from every layer, flushed or not
+        CCoinsStats statsCache, statsBase, stats, statsCounted;
+        BOOST_CHECK(cache.GetStats(statsCache));
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(cacheBase.GetStats(statsBase));
+        CheckSameStats(statsBase, statsCache);
+        BOOST_CHECK(cacheBase.Flush());
+        BOOST_CHECK(db.GetStats(stats));
+        CheckSameStats(stats, statsCache);
+
+        BOOST_CHECK(db.ComputeStats(statsCounted));
+        CheckSameStats(stats, statsCounted);
+        BOOST_CHECK(stats.nTransactionOutputs > 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_background_flush)
+{
+    CCoinsViewDBTest db;
+    // Batches are written by the calls to WaitAndWritePending below instead of a thread
+    db.SetBackgroundWriter(true);
+    std::vector<uint256> txids;
+    std::map<uint256, CCoins> original;
+
+    CCoinsViewCache cache(&db);
+    for (int nRound = 0; nRound < 20; nRound++) {
+        RandomlyModifyCoins(cache, txids, original);
+        uint256 hashBlock = GetRandHash();
+        cache.SetBestBlock(hashBlock);
+
+        std::map<uint256, CCoins> expected;
+        BOOST_FOREACH(const uint256& txid, txids) {
+            const CCoins* coins = cache.AccessCoins(txid);
+            if (coins && !coins->IsPruned())
+                expected[txid] = *coins;
+        }
+        CCoinsStats statsCache;
+        BOOST_CHECK(cache.GetStats(statsCache));
+
+        BOOST_CHECK(cache.Sync());
+        // Even before it is stored, the database answers with what the cache had, and so does the trimmed cache
+        if (nRound % 2)
+            BOOST_CHECK(db.WaitAndWritePending());
+        cache.Trim(cache.DynamicMemoryUsage() / 2);
+        BOOST_FOREACH(const uint256& txid, txids) {
+            CCoins coins;
+            bool fExpected = expected.count(txid);
+            BOOST_CHECK_EQUAL(db.GetCoins(txid, coins), fExpected);
+            BOOST_CHECK_EQUAL(db.HaveCoins(txid), fExpected);
+            if (fExpected)
+                BOOST_CHECK(coins == expected[txid]);
+            const CCoins* pcoins = cache.AccessCoins(txid);
+            BOOST_CHECK_EQUAL(pcoins && !pcoins->IsPruned(), fExpected);
+            if (fExpected)
+                BOOST_CHECK(*pcoins == expected[txid]);
+        }
+        BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+        CCoinsStats stats;
+        BOOST_CHECK(db.GetStats(stats));
+        CheckSameStats(stats, statsCache);
+        BOOST_CHECK(cache.GetStats(stats));
+        CheckSameStats(stats, statsCache);
+    }
+
+    // A flush stores the batch still waiting first
+    BOOST_CHECK(cache.Flush());
+    CCoinsStats stats, statsCounted;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK(db.ComputeStats(statsCounted));
+    CheckSameStats(stats, statsCounted);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
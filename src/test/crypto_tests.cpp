@@ -8,6 +8,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 
@@ -130,6 +131,80 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < i; ++j) {
+            unsigned char hash[CSHA256::OUTPUT_SIZE];
+            CSHA256().Write(in + 64 * j, 64).Finalize(hash);
+            CSHA256().Write(hash, sizeof(hash)).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64_testvectors)
+{
+    std::vector<unsigned char> in1(64), in2(64, 0);
+    for (int i = 0; i < 64; ++i)
+        in1[i] = i;
+    std::string str3 = "abcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcxyz";
+    std::vector<unsigned char> in3(str3.begin(), str3.begin() + 64);
+    const std::string out1 = "01c9f464780a1b6af4eb400fe2f2896cfb2169f5a65701439e4c2c4e213903ef";
+    const std::string out2 = "e2f61c3f71d1defd3fa999dfa36953755c690689799962b48bebd836974e8cf9";
+
+    // Enough inputs to go through every lane of the widest implementation and the ones after it
+    std::vector<unsigned char> in, out(32 * 19), expected;
+    for (int i = 0; i < 19; ++i) {
+        const std::vector<unsigned char>& blob = (i % 2) ? in2 : in1;
+        in.insert(in.end(), blob.begin(), blob.end());
+        std::vector<unsigned char> hash = ParseHex((i % 2) ? out2 : out1);
+        expected.insert(expected.end(), hash.begin(), hash.end());
+    }
+    SHA256D64(&out[0], &in[0], 19);
+    BOOST_CHECK(out == expected);
+
+    unsigned char hash[32];
+    SHA256D64(hash, &in3[0], 1);
+    unsigned char first[CSHA256::OUTPUT_SIZE], second[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(&in3[0], 64).Finalize(first);
+    CSHA256().Write(first, sizeof(first)).Finalize(second);
+    BOOST_CHECK(memcmp(hash, second, 32) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(sha256_finalize_double_tails)
+{
+    std::vector<unsigned char> prefix(130), tails(40 * 19);
+    for (size_t i = 0; i < prefix.size(); ++i)
+        prefix[i] = insecure_rand();
+    for (size_t i = 0; i < tails.size(); ++i)
+        tails[i] = insecure_rand();
+
+    // Prefixes that leave the tails room in the last chunk and ones that do not
+    for (size_t nPrefix = 0; nPrefix <= prefix.size(); nPrefix += 13) {
+        for (size_t nLen = 0; nLen <= 40; nLen += 8) {
+            for (size_t nCount = 0; nCount <= 19; nCount += 3) {
+                CSHA256 hasher;
+                hasher.Write(&prefix[0], nPrefix);
+                std::vector<unsigned char> out(32 * nCount + 1), expected(32 * nCount + 1);
+                hasher.FinalizeDoubleTails(&tails[0], nLen, nCount, &out[0]);
+                for (size_t i = 0; i < nCount; ++i) {
+                    unsigned char first[CSHA256::OUTPUT_SIZE];
+                    CSHA256(hasher).Write(&tails[nLen * i], nLen).Finalize(first);
+                    CSHA256().Write(first, sizeof(first)).Finalize(&expected[32 * i]);
+                }
+                BOOST_CHECK(out == expected);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -247,4 +322,59 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+void TestMuHash(const MuHash3072 &muhash, const std::string &hexout) {
+    unsigned char hash[MuHash3072::OUTPUT_SIZE];
+    muhash.Finalize(hash);
+    BOOST_CHECK(std::vector<unsigned char>(hash, hash + sizeof(hash)) == ParseHex(hexout));
+}
+
+MuHash3072 MuHashOf(const std::string &in) {
+    return MuHash3072().Insert((const unsigned char*)in.data(), in.size());
+}
+
+BOOST_AUTO_TEST_CASE(num3072_inverse) {
+    unsigned char bytesOne[Num3072::BYTE_SIZE];
+    Num3072().ToBytes(bytesOne);
+    unsigned char bytes[Num3072::BYTE_SIZE];
+
+    // The prime minus one is its own inverse
+    Num3072 minusOne;
+    for (int i = 0; i < Num3072::LIMBS; i++)
+        minusOne.limbs[i] = ~(Num3072::limb_t)0;
+    minusOne.limbs[0] -= Num3072::MAX_PRIME_DIFF;
+    Num3072 square = minusOne;
+    square.Multiply(minusOne);
+    square.ToBytes(bytes);
+    BOOST_CHECK(memcmp(bytes, bytesOne, sizeof(bytes)) == 0);
+
+    for (int i = 0; i < 4; i++) {
+        unsigned char data[Num3072::BYTE_SIZE];
+        for (unsigned int j = 0; j < sizeof(data); j++)
+            data[j] = insecure_rand();
+        Num3072 x(data);
+        Num3072 product = x.GetInverse();
+        product.Multiply(x);
+        product.ToBytes(bytes);
+        BOOST_CHECK(memcmp(bytes, bytesOne, sizeof(bytes)) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(muhash_testvectors) {
+    TestMuHash(MuHash3072(), "c85525462fdcf30a2c18d6f4b92923000974355c2477f59594d2c205a1d25add");
+    TestMuHash(MuHashOf("crown") *= MuHashOf("muhash"), "1a6624936f2c57b1aff0faecc3efb973eac537fd813fbea504a1230fee19200b");
+
+    // The order of inserts and removes doesn't matter
+    MuHash3072 muhash;
+    muhash.Insert((const unsigned char*)"x", 1).Insert((const unsigned char*)"muhash", 6);
+    muhash.Remove((const unsigned char*)"x", 1).Insert((const unsigned char*)"crown", 5);
+    TestMuHash(muhash, "1a6624936f2c57b1aff0faecc3efb973eac537fd813fbea504a1230fee19200b");
+
+    // Neither does storing the unfinished state
+    unsigned char state[MuHash3072::STATE_SIZE];
+    muhash.GetState(state);
+    MuHash3072 muhashLoaded;
+    muhashLoaded.SetState(state);
+    TestMuHash(muhashLoaded, "1a6624936f2c57b1aff0faecc3efb973eac537fd813fbea504a1230fee19200b");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,49 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "legacysigner.h"
+#include "hash.h"
+#include "key.h"
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(legacysigner_tests)
+
+BOOST_AUTO_TEST_CASE(legacy_signature_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CKey otherKey;
+    otherKey.MakeNewKey(true);
+
+    std::string strMessage = "legacy signature cache test";
+    std::string strError;
+    std::vector<unsigned char> vchSig;
+    BOOST_REQUIRE(legacySigner.SignMessage(strMessage, strError, vchSig, key));
+
+    // The first check recovers the key, the second one is answered by the cache
+    CLegacySignatureCacheStats before = GetLegacySignatureCacheStats();
+    BOOST_CHECK(legacySigner.VerifyMessage(pubkey, vchSig, strMessage, strError));
+    BOOST_CHECK(legacySigner.VerifyMessage(pubkey, vchSig, strMessage, strError));
+    CLegacySignatureCacheStats after = GetLegacySignatureCacheStats();
+    BOOST_CHECK_EQUAL(after.nMisses - before.nMisses, 1U);
+    BOOST_CHECK_EQUAL(after.nHits - before.nHits, 1U);
+
+    // A cached signature doesn't validate another key or message
+    BOOST_CHECK(!legacySigner.VerifyMessage(otherKey.GetPubKey(), vchSig, strMessage, strError));
+    BOOST_CHECK(!legacySigner.VerifyMessage(pubkey, vchSig, strMessage + " ", strError));
+
+    // Hash signatures share the cache
+    uint256 hash = Hash(strMessage.begin(), strMessage.end());
+    BOOST_REQUIRE(CHashSigner::SignHash(hash, key, vchSig));
+    before = GetLegacySignatureCacheStats();
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, pubkey, vchSig, strError));
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, pubkey.GetID(), vchSig, strError));
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, otherKey.GetPubKey(), vchSig, strError));
+    after = GetLegacySignatureCacheStats();
+    BOOST_CHECK_EQUAL(after.nHits - before.nHits, 1U);
+    BOOST_CHECK_EQUAL(after.nMisses - before.nMisses, 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,8 +4,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "primitives/transaction.h"
+#include "checkpoints.h"
 #include "main.h"
+#include "txdb.h"
+#include "util.h"
 
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_AUTO_TEST_SUITE(main_tests)
@@ -23,4 +27,184 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test, * boost::unit_test::disabled())
     BOOST_CHECK(nSum == 1350824726649000ULL);
 }
 */
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_test)
+{
+    LOCK(cs_main);
+    BOOST_REQUIRE(chainActive.Tip() != NULL);
+    uint256 hashTip = chainActive.Tip()->GetBlockHash();
+    arith_uint256 nChainWork = chainActive.Tip()->nChainWork;
+    size_t nEntries = mapBlockIndex.size();
+    boost::filesystem::path pathSnapshot = GetDataDir() / "blocks" / "index.snapshot";
+
+    // The snapshot is used once and removed
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    BOOST_CHECK(boost::filesystem::exists(pathSnapshot));
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex());
+    BOOST_CHECK(!boost::filesystem::exists(pathSnapshot));
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), nEntries);
+    BOOST_REQUIRE(chainActive.Tip() != NULL);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashTip);
+    BOOST_CHECK(chainActive.Tip()->nChainWork == nChainWork);
+
+    // A snapshot the block tree database does not know about is ignored
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    BOOST_CHECK(pblocktree->WriteBlockIndexSnapshotId(uint256()));
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex());
+    BOOST_CHECK(!boost::filesystem::exists(pathSnapshot));
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), nEntries);
+    BOOST_REQUIRE(chainActive.Tip() != NULL);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashTip);
+    BOOST_CHECK(chainActive.Tip()->nChainWork == nChainWork);
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_read_test)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex != NULL);
+    BOOST_REQUIRE(pindex->nStatus & BLOCK_HAVE_DATA);
+
+    // The raw bytes are the network serialization of the block
+    CDataStream ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ssExpected << Params().GenesisBlock();
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssBlock, pindex->GetBlockPos(), pindex->GetBlockHash()));
+    BOOST_CHECK(ssBlock.str() == ssExpected.str());
+
+    // A block that doesn't hash to the expected hash is rejected
+    CDataStream ssWrong(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(!ReadRawBlockFromDisk(ssWrong, pindex->GetBlockPos(), uint256()));
+}
+
+BOOST_AUTO_TEST_CASE(flush_over_limit_keeps_cache_test)
+{
+    size_t nCoinCacheUsageOld = nCoinCacheUsage;
+    nCoinCacheUsage = pcoinsTip->DynamicMemoryUsage() + 256 * 1024;
+
+    // Coins of ever newer transactions until the cache is over its limit
+    std::vector<uint256> txids;
+    while (pcoinsTip->DynamicMemoryUsage() <= nCoinCacheUsage) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+        txids.push_back(tx.GetHash());
+        pcoinsTip->ModifyNewCoins(tx.GetHash())->FromTx(tx, txids.size());
+    }
+
+    // The cache is written out and trimmed to half its limit rather than wiped
+    CValidationState state;
+    BOOST_CHECK(FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED));
+    BOOST_CHECK(pcoinsTip->GetCacheSize() > 0);
+    BOOST_CHECK(pcoinsTip->DynamicMemoryUsage() <= nCoinCacheUsage / 2);
+
+    // Trimmed coins are read back from the database
+    BOOST_FOREACH(const uint256& txid, txids)
+        BOOST_CHECK(pcoinsTip->HaveCoins(txid));
+
+    nCoinCacheUsage = nCoinCacheUsageOld;
+}
+
+BOOST_AUTO_TEST_CASE(reorg_cache_disconnect_test)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    BOOST_REQUIRE(pindexPrev != NULL);
+
+    // A block on top of the tip spending a coin that only exists in a view over pcoinsTip
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFund.vout.push_back(CTxOut(COIN, scriptPubKey));
+    CCoinsViewCache viewBase(pcoinsTip);
+    viewBase.ModifyCoins(txFund.GetHash())->FromTx(txFund, pindexPrev->nHeight);
+    const CCoins coinsFund = *viewBase.AccessCoins(txFund.GetHash());
+
+    CBlock block;
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].scriptSig = CScript() << (pindexPrev->nHeight + 1) << OP_0;
+    txCoinbase.vout.push_back(CTxOut(0, scriptPubKey));
+    block.vtx.push_back(txCoinbase);
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    txSpend.vout.push_back(CTxOut(COIN - 1000, scriptPubKey));
+    block.vtx.push_back(txSpend);
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.nTime = pindexPrev->GetBlockTime() + 60;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    uint256 hashBlock = block.GetHash();
+    CBlockIndex index(block, false);
+    index.phashBlock = &hashBlock;
+    index.pprev = pindexPrev;
+    index.nHeight = pindexPrev->nHeight + 1;
+    index.nFile = pindexPrev->nFile;
+
+    // During the initial block download the block isn't cached, its undo data comes from disk
+    BOOST_REQUIRE(IsInitialBlockDownload());
+    CReorgCacheStats statsBefore, stats;
+    GetReorgCacheStats(statsBefore);
+    CCoinsViewCache viewDisk(&viewBase);
+    CValidationState state;
+    BOOST_CHECK(ConnectBlock(block, state, &index, viewDisk));
+    GetReorgCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nBlocks, statsBefore.nBlocks);
+    BOOST_CHECK(!viewDisk.HaveCoins(txFund.GetHash()));
+    BOOST_CHECK(DisconnectBlock(block, state, &index, viewDisk));
+    GetReorgCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nUndoHits, statsBefore.nUndoHits);
+    BOOST_CHECK_EQUAL(stats.nUndoMisses, statsBefore.nUndoMisses + 1);
+
+    // Caught up with the network the block is cached and disconnected without reading the undo file
+    Checkpoints::fEnabled = false;
+    SetMockTime(block.GetBlockTime());
+    BOOST_REQUIRE(!IsInitialBlockDownload());
+    GetReorgCacheStats(statsBefore);
+    CCoinsViewCache viewCached(&viewBase);
+    BOOST_CHECK(ConnectBlock(block, state, &index, viewCached));
+    GetReorgCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nBlocks, std::min(statsBefore.nBlocks + 1, nReorgCacheBlocks));
+    BOOST_CHECK(DisconnectBlock(block, state, &index, viewCached));
+    GetReorgCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nUndoHits, statsBefore.nUndoHits + 1);
+    BOOST_CHECK_EQUAL(stats.nUndoMisses, statsBefore.nUndoMisses);
+    SetMockTime(0);
+    Checkpoints::fEnabled = true;
+
+    // Both ways restore the spent coin as it was and remove the block's outputs
+    BOOST_CHECK(*viewDisk.AccessCoins(txFund.GetHash()) == coinsFund);
+    BOOST_CHECK(*viewCached.AccessCoins(txFund.GetHash()) == coinsFund);
+    BOOST_CHECK(!viewDisk.HaveCoins(txSpend.GetHash()));
+    BOOST_CHECK(!viewCached.HaveCoins(txSpend.GetHash()));
+    BOOST_CHECK(viewDisk.GetBestBlock() == pindexPrev->GetBlockHash());
+    BOOST_CHECK(viewCached.GetBestBlock() == pindexPrev->GetBlockHash());
+
+    // The index isn't in mapBlockIndex, write it out while it is still alive
+    BOOST_CHECK(FlushStateToDisk(state, FLUSH_STATE_ALWAYS));
+}
+
+BOOST_AUTO_TEST_CASE(budget_fee_tx_index_test)
+{
+    // Fee transactions are found without their block, which pruning may have deleted
+    CMutableTransaction txFee;
+    txFee.vin.resize(1);
+    txFee.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFee.vout.push_back(CTxOut(25 * COIN, CScript() << OP_RETURN << ToByteVector(GetRandHash())));
+    uint256 hashBlock = GetRandHash();
+    BOOST_CHECK(pblocktree->WriteBudgetFeeTxs(std::vector<CTransaction>(1, txFee), hashBlock));
+
+    CTransaction tx;
+    uint256 hashBlockOut;
+    BOOST_CHECK(GetBudgetFeeTransaction(txFee.GetHash(), tx, hashBlockOut));
+    BOOST_CHECK(tx.GetHash() == txFee.GetHash());
+    BOOST_CHECK(hashBlockOut == hashBlock);
+    BOOST_CHECK(!GetBudgetFeeTransaction(GetRandHash(), tx, hashBlockOut));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,134 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-payments.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "streams.h"
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+    const int nMasternodes = 5000;
+    const int nChainLength = 7000;
+
+    CScript GetPayee(int n)
+    {
+        return GetScriptForDestination(CKeyID(Hash160(BEGIN(n), END(n))));
+    }
+
+    CMasternodePaymentWinner CreateWinner(int nBlockHeight, const CScript& payee, int nVoter)
+    {
+        CMasternodePaymentWinner winner(CTxIn(COutPoint(ArithToUint256(nVoter + 1), 0)));
+        winner.nBlockHeight = nBlockHeight;
+        winner.AddPayee(payee);
+        return winner;
+    }
+
+    // The chain walk the last paid index replaces
+    int WalkLastPaidHeight(CMasternodePayments& payments, const CScript& payee, int nMaxBlocksAgo)
+    {
+        const CBlockIndex* pindex = chainActive.Tip();
+        for (int n = 0; pindex && pindex->nHeight > 0 && n < nMaxBlocksAgo; ++n, pindex = pindex->pprev)
+        {
+            if (payments.mapMasternodeBlocks.count(pindex->nHeight) &&
+                payments.mapMasternodeBlocks[pindex->nHeight].HasPayeeWithVotes(payee, MNPAYMENTS_PAID_VOTES_REQUIRED))
+                return pindex->nHeight;
+        }
+        return 0;
+    }
+
+    struct LastPaidFixture
+    {
+        std::vector<uint256> hashes;
+        std::vector<CBlockIndex> blocks;
+        CBlockIndex* pindexOldTip;
+
+        LastPaidFixture()
+            : hashes(nChainLength)
+            , blocks(nChainLength)
+            , pindexOldTip(chainActive.Tip())
+        {
+            for (int i = 0; i < nChainLength; ++i)
+            {
+                hashes[i] = ArithToUint256(i);
+                blocks[i].nHeight = i;
+                blocks[i].nTime = 1000000 + i * 60;
+                blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+                blocks[i].phashBlock = &hashes[i];
+                blocks[i].BuildSkip();
+            }
+            chainActive.SetTip(&blocks.back());
+            mapCacheBlockHashes.clear();
+            masternodePayments.Clear();
+
+            // Every height pays the next synthetic masternode in turn, with two votes each.
+            // Every third height only gets a single vote, which doesn't count as paid.
+            for (int h = 101; h < nChainLength; ++h)
+            {
+                CScript payee = GetPayee(h % nMasternodes);
+                CMasternodePaymentWinner first = CreateWinner(h, payee, 0);
+                BOOST_REQUIRE(masternodePayments.AddWinningMasternode(first));
+                if (h % 3 == 0) continue;
+                CMasternodePaymentWinner second = CreateWinner(h, payee, 1);
+                BOOST_REQUIRE(masternodePayments.AddWinningMasternode(second));
+            }
+        }
+
+        ~LastPaidFixture()
+        {
+            masternodePayments.Clear();
+            mapCacheBlockHashes.clear();
+            chainActive.SetTip(pindexOldTip);
+        }
+    };
+}
+
+BOOST_FIXTURE_TEST_SUITE(mnpayments_tests, LastPaidFixture)
+
+BOOST_AUTO_TEST_CASE(last_paid_index_matches_chain_walk)
+{
+    const int nMaxBlocksAgo = nMasternodes * 1.25;
+    const int nTip = chainActive.Height();
+
+    for (int i = 0; i < nMasternodes; ++i) {
+        CScript payee = GetPayee(i);
+        BOOST_CHECK_EQUAL(WalkLastPaidHeight(masternodePayments, payee, nMaxBlocksAgo),
+                          masternodePayments.GetLastPaidHeight(payee, nTip, nTip - nMaxBlocksAgo + 1));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(last_paid_index_bounds)
+{
+    CScript payee = GetPayee(6001 % nMasternodes);
+
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(payee, nChainLength - 1, 1), 6001);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(payee, 6000, 1), 1001);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(payee, 6000, 1002), 0);
+
+    // A single vote isn't a payment
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(GetPayee(6003 % nMasternodes), nChainLength - 1, 1), 1003);
+
+    // Votes ahead of the tip don't count until the block is connected
+    chainActive.SetTip(&blocks[6000]);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(payee, chainActive.Height(), 1), 1001);
+}
+
+BOOST_AUTO_TEST_CASE(last_paid_index_follows_removal_and_reload)
+{
+    CScript payee = GetPayee(1001);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << masternodePayments;
+    CMasternodePayments loaded;
+    ss >> loaded;
+    BOOST_CHECK_EQUAL(loaded.GetLastPaidHeight(payee, 6000, 1), 1001);
+
+    // Old winners are pruned together with their paid heights
+    masternodePayments.CheckAndRemove();
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(payee, 6000, 1), 0);
+    BOOST_CHECK_EQUAL(masternodePayments.GetLastPaidHeight(payee, nChainLength - 1, 1), 6001);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
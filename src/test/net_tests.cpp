@@ -0,0 +1,100 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "hash.h"
+#include "net.h"
+#include "protocol.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+BOOST_AUTO_TEST_CASE(relaycache_test)
+{
+    CRelayCache cache;
+    CInv inv(MSG_MASTERNODE_ANNOUNCE, uint256S("0x1234"));
+
+    boost::shared_ptr<CRelayCache::Entry> pentry(new CRelayCache::Entry());
+    pentry->strCommand = "mnb_new";
+    pentry->ss << std::string("broadcast");
+
+    // A miss until it is added, then the same bytes for every request
+    BOOST_CHECK(!cache.Get(inv, false));
+    cache.Add(inv, false, pentry);
+    boost::shared_ptr<const CRelayCache::Entry> pcached = cache.Get(inv, false);
+    BOOST_REQUIRE(pcached);
+    BOOST_CHECK(pcached.get() == pentry.get());
+    BOOST_CHECK(cache.Get(inv, false) == pcached);
+
+    // The legacy format is kept apart
+    BOOST_CHECK(!cache.Get(inv, true));
+
+    size_t nEntries, nBytes;
+    uint64_t nHits, nMisses;
+    cache.GetStats(nEntries, nBytes, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntries, 1U);
+    BOOST_CHECK_EQUAL(nBytes, pentry->ss.size());
+    BOOST_CHECK_EQUAL(nHits, 2U);
+    BOOST_CHECK_EQUAL(nMisses, 2U);
+
+    // An item that changed is dropped in both formats
+    cache.Add(inv, true, pentry);
+    cache.Erase(inv);
+    BOOST_CHECK(!cache.Get(inv, false));
+    BOOST_CHECK(!cache.Get(inv, true));
+    cache.GetStats(nEntries, nBytes, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntries, 0U);
+    BOOST_CHECK_EQUAL(nBytes, 0U);
+}
+
+// Feed a whole message to msg in chunks of nChunk bytes
+static void ReceiveMessage(CNetMessage& msg, const std::vector<char>& vMessage, unsigned int nChunk)
+{
+    unsigned int nPos = 0;
+    while (nPos < vMessage.size()) {
+        unsigned int nBytes = std::min(nChunk, (unsigned int)vMessage.size() - nPos);
+        int nHandled = msg.in_data ? msg.readData(&vMessage[nPos], nBytes) : msg.readHeader(&vMessage[nPos], nBytes);
+        BOOST_REQUIRE(nHandled > 0);
+        nPos += nHandled;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(netmessage_receive_test)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    for (unsigned int nSize = 0; nSize <= 2 * RECV_BUFFER_POOL_MIN; nSize += RECV_BUFFER_POOL_MIN) {
+        std::vector<char> vData(nSize);
+        for (unsigned int i = 0; i < nSize; i++)
+            vData[i] = (char)(i * 7);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << CMessageHeader(Params().MessageStart(), "block", nSize);
+        std::vector<char> vMessage(ss.begin(), ss.end());
+        vMessage.insert(vMessage.end(), vData.begin(), vData.end());
+
+        // The second round of large messages gets the buffers the first one kept
+        for (int nRound = 0; nRound < 2; nRound++) {
+            CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+            ReceiveMessage(msg, vMessage, 1000);
+            BOOST_REQUIRE(msg.complete());
+            BOOST_CHECK_EQUAL(msg.hdr.nMessageSize, nSize);
+            BOOST_CHECK(msg.GetMessageHash() == Hash(vData.begin(), vData.end()));
+            BOOST_CHECK(std::equal(vData.begin(), vData.end(), msg.vRecv.begin()));
+        }
+
+        // Data received straight into the message buffer
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+        ReceiveMessage(msg, std::vector<char>(vMessage.begin(), vMessage.begin() + 24), 24);
+        while (!msg.complete()) {
+            char* pch;
+            unsigned int nBytes = std::min(msg.GetDataBuffer(pch), 5000u);
+            memcpy(pch, &vData[msg.nDataPos], nBytes);
+            BOOST_REQUIRE_EQUAL(msg.readData(pch, nBytes), (int)nBytes);
+        }
+        BOOST_CHECK(msg.GetMessageHash() == Hash(vData.begin(), vData.end()));
+        BOOST_CHECK(std::equal(vData.begin(), vData.end(), msg.vRecv.begin()));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
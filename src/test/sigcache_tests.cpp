@@ -0,0 +1,113 @@
+// Copyright (c) 2014-2018 The Crown developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "key.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "util.h"
+
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+namespace
+{
+    struct TestHasher
+    {
+        template <uint8_t hash_select>
+        uint32_t operator()(const uint256& key) const
+        {
+            uint32_t u;
+            std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+            return u;
+        }
+    };
+
+    struct SignedHash
+    {
+        uint256 hash;
+        CPubKey pubkey;
+        std::vector<unsigned char> vchSig;
+    };
+
+    void LookupSignatures(const std::vector<SignedHash>& vSigned, int nLookups, char* pfOk)
+    {
+        CachingTransactionSignatureChecker checker(NULL, 0);
+        for (int i = 0; i < nLookups; i++) {
+            const SignedHash& sig = vSigned[i % vSigned.size()];
+            if (!checker.VerifySignature(sig.vchSig, sig.pubkey, sig.hash))
+                *pfOk = false;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_keeps_entries)
+{
+    CuckooCache::cache<uint256, TestHasher> cache;
+    uint32_t nSize = cache.setup(1 << 16);
+
+    // At half load nearly everything has to be found again
+    std::vector<uint256> vEntries;
+    for (uint32_t i = 0; i < nSize / 2; i++) {
+        vEntries.push_back(GetRandHash());
+        cache.insert(vEntries.back());
+    }
+    uint32_t nFound = 0;
+    BOOST_FOREACH(const uint256& entry, vEntries)
+        nFound += cache.contains(entry, false);
+    BOOST_CHECK(nFound >= vEntries.size() * 99 / 100);
+    BOOST_CHECK(!cache.contains(GetRandHash(), false));
+
+    // Erased and old entries make room for new ones, the newest ones stay
+    BOOST_FOREACH(const uint256& entry, vEntries)
+        cache.contains(entry, true);
+    std::vector<uint256> vNewEntries;
+    for (uint32_t i = 0; i < nSize; i++) {
+        vNewEntries.push_back(GetRandHash());
+        cache.insert(vNewEntries.back());
+    }
+    nFound = 0;
+    for (uint32_t i = nSize - nSize / 4; i < nSize; i++)
+        nFound += cache.contains(vNewEntries[i], false);
+    BOOST_CHECK(nFound >= (nSize / 4) * 95 / 100);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_lookups)
+{
+    // Signatures that are all cached after the first round
+    std::vector<SignedHash> vSigned(64);
+    CKey key;
+    for (unsigned int i = 0; i < vSigned.size(); i++) {
+        if (i % 16 == 0)
+            key.MakeNewKey(true);
+        vSigned[i].hash = GetRandHash();
+        vSigned[i].pubkey = key.GetPubKey();
+        BOOST_REQUIRE(key.Sign(vSigned[i].hash, vSigned[i].vchSig));
+    }
+    char fOk = true;
+    LookupSignatures(vSigned, vSigned.size(), &fOk);
+    BOOST_CHECK(fOk);
+
+    // Shards are shared between script check threads
+    const int nThreads = 4;
+    std::vector<char> vOk(nThreads, true);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&LookupSignatures, boost::cref(vSigned), 1000, &vOk[i]));
+    threads.join_all();
+    BOOST_CHECK(std::count(vOk.begin(), vOk.end(), true) == nThreads);
+
+    // Cached signatures are bound to their hash and key
+    CachingTransactionSignatureChecker checker(NULL, 0);
+    BOOST_CHECK(!checker.VerifySignature(vSigned[0].vchSig, vSigned[0].pubkey, vSigned[1].hash));
+    BOOST_CHECK(!checker.VerifySignature(vSigned[0].vchSig, vSigned[16].pubkey, vSigned[0].hash));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
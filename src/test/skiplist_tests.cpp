@@ -99,4 +99,30 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blockindex_arena_test)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vIndex;
+
+    // Span several slabs so that entries from different slabs are linked.
+    for (int i = 0; i < 10000; i++) {
+        CBlockIndex entry;
+        entry.nHeight = i;
+        entry.pprev = (i == 0) ? NULL : vIndex.back();
+        vIndex.push_back(arena.Allocate(entry));
+        vIndex.back()->BuildSkip();
+    }
+    BOOST_CHECK_EQUAL(arena.Size(), 10000U);
+    BOOST_CHECK(arena.DynamicMemoryUsage() >= 10000 * sizeof(CBlockIndex));
+
+    for (int i = 0; i < 10000; i++) {
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, i);
+        BOOST_CHECK(vIndex[9999]->GetAncestor(i) == vIndex[i]);
+    }
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.Size(), 0U);
+    BOOST_CHECK_EQUAL(arena.DynamicMemoryUsage(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,4 +1,5 @@
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 #include <iostream>
 
 #include "amount.h"
@@ -6,6 +7,8 @@
 #include "key.h"
 #include "utiltime.h"
 #include "primitives/block.h"
+#include "hash.h"
+#include "streams.h"
 
 #include "mn-pos/kernel.h"
 #include "mn-pos/stakeminer.h"
@@ -43,6 +46,72 @@ BOOST_AUTO_TEST_CASE(stakeminer)
     BOOST_CHECK_MESSAGE(kernel.IsValidProof(nTarget), "did not find a valid kernel");
 }
 
+BOOST_AUTO_TEST_CASE(stake_hash_midstate)
+{
+    std::pair<uint256, unsigned int> outpoint = std::make_pair(uint256S("99999"), 7);
+    uint256 nModifier = uint256S("123456");
+    uint64_t nTimeBlockFrom = 100000;
+    uint64_t nTimeStake = nTimeBlockFrom + (60*60*48);
+    Kernel kernel(outpoint, 10000 * COIN, nModifier, nTimeBlockFrom, nTimeStake);
+
+    //Hash a whole batch plus a few, and compare with hashing the full serialized kernel
+    const unsigned int nCount = Kernel::HASH_BATCH_SIZE + 3;
+    uint256 vHashes[nCount];
+    kernel.GetStakeHashes(nTimeStake, nCount, vHashes);
+    for (unsigned int i = 0; i < nCount; i++) {
+        CDataStream ss(SER_GETHASH, 0);
+        ss << outpoint.first << outpoint.second << nModifier << nTimeBlockFrom << (nTimeStake + i);
+        BOOST_CHECK(vHashes[i] == Hash(ss.begin(), ss.end()));
+    }
+    BOOST_CHECK(kernel.GetTime() == nTimeStake);
+    BOOST_CHECK(kernel.GetStakeHash() == vHashes[0]);
+    kernel.SetStakeTime(nTimeStake + 5);
+    BOOST_CHECK(kernel.GetStakeHash() == vHashes[5]);
+}
+
+BOOST_AUTO_TEST_CASE(search_stake_kernels)
+{
+    //A target that about a quarter of the kernels reach within the time span
+    arith_uint256 aTarget;
+    aTarget = ~aTarget;
+    aTarget >>= 20;
+    uint256 nTarget = ArithToUint256(aTarget);
+    uint32_t nTimeStart = 1500000000;
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < DEFAULT_STAKE_KERNEL_THREADS; i++)
+        threadGroup.create_thread(&ThreadStakeKernelCheck);
+
+    for (int nRound = 0; nRound < 20; nRound++) {
+        std::vector<Kernel> vKernels;
+        for (int i = 0; i < 16; i++) {
+            std::pair<uint256, unsigned int> outpoint = std::make_pair(ArithToUint256(nRound * 16 + i + 1), i);
+            vKernels.push_back(Kernel(outpoint, 10000, uint256S("123456"), 100000, nTimeStart));
+        }
+
+        //The first kernel that a sequential search finds is the one expected
+        int nExpected = -1;
+        uint64_t nExpectedTime = 0;
+        for (unsigned int i = 0; i < vKernels.size() && nExpected < 0; i++) {
+            Kernel kernel = vKernels[i];
+            if (SearchTimeSpan(kernel, nTimeStart, nTimeStart + 30, nTarget)) {
+                nExpected = i;
+                nExpectedTime = kernel.GetTime();
+            }
+        }
+
+        int nFound = SearchStakeKernels(vKernels, nTimeStart, nTimeStart + 30, nTarget);
+        BOOST_CHECK_EQUAL(nFound, nExpected);
+        if (nFound >= 0) {
+            BOOST_CHECK(vKernels[nFound].GetTime() == nExpectedTime);
+            BOOST_CHECK(vKernels[nFound].IsValidProof(nTarget));
+        }
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
 BOOST_AUTO_TEST_CASE(proof_validity)
 {
     uint64_t nAmount = 10000 * COIN; //10,000 coins is the amount for a masternode
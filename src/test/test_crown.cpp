@@ -4,9 +4,11 @@
 
 #define BOOST_TEST_MODULE Crown Test Suite
 
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -33,12 +35,14 @@ struct TestingSetup {
     boost::thread_group threadGroup;
 
     TestingSetup() {
+        SHA256AutoDetect();
         ECC_Start();
         SetupEnvironment();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::UNITTEST);
         noui_connect();
+        InitSignatureCache();
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
 #endif
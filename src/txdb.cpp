@@ -14,55 +14,388 @@
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+static const char DB_COINS = 'c';
+static const char DB_COIN_OUTPUT = 'C';
+static const char DB_BEST_BLOCK = 'B';
+static const char DB_UPGRADE_CURSOR = 'M';
+static const char DB_COIN_STATS = 'S';
+
+namespace {
+
+/** Key of one unspent output: DB_COIN_OUTPUT, txid, VARINT(n). VARINT keeps the outputs of a transaction in order. */
+struct CoinOutputKey
+{
+    uint256 txid;
+    uint32_t n;
+
+    CoinOutputKey() : n(0) {}
+    CoinOutputKey(const uint256& txidIn, uint32_t nIn) : txid(txidIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = DB_COIN_OUTPUT;
+        READWRITE(chType);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/** Value of one unspent output: VARINT(nHeight * 2 + fBlockReward), VARINT(nVersion), the compressed output */
+struct CoinOutputValue
+{
+    int nHeight;
+    bool fBlockReward;
+    int nVersion;
+    CTxOut txout;
+
+    CoinOutputValue() : nHeight(0), fBlockReward(false), nVersion(0) {}
+    CoinOutputValue(const CCoins& coins, uint32_t n) :
+        nHeight(coins.nHeight), fBlockReward(coins.fBlockReward), nVersion(coins.nVersion), txout(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionSer) {
+        uint32_t nCode = nHeight * 2 + (fBlockReward ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode >> 1;
+            fBlockReward = nCode & 1;
+        }
+        READWRITE(VARINT(nVersion));
+        READWRITE(REF(CTxOutCompressor(txout)));
+    }
+};
+
+bool IsCoinOutputOf(const leveldb::Slice& slKey, const uint256& txid)
+{
+    return slKey.size() > 1 + txid.size() && slKey[0] == DB_COIN_OUTPUT &&
+           memcmp(slKey.data() + 1, txid.begin(), txid.size()) == 0;
+}
+
+void SeekCoinOutputs(leveldb::Iterator* pcursor, const uint256& txid)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << CoinOutputKey(txid, 0);
+    pcursor->Seek(ssKey.str());
+}
+
+void BatchWriteCoinOutputs(CLevelDBBatch &batch, const uint256 &txid, const CCoins &coins) {
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            batch.Write(CoinOutputKey(txid, i), CoinOutputValue(coins, i));
+    }
+}
+
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
-    batch.Write('B', hash);
+    batch.Write(DB_BEST_BLOCK, hash);
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe), fPending(false), fBackgroundWriter(false) {
+    // Any record of the old format left means the upgrade hasn't finished
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair(DB_COINS, uint256());
+    pcursor->Seek(ssKey.str());
+    fUpgrading = pcursor->Valid() && pcursor->key().size() > 0 && pcursor->key()[0] == DB_COINS;
+
+    // Databases written before the statistics were kept have to be counted once
+    if (!db.Read(DB_COIN_STATS, stats) && !ReadBestBlock().IsNull()) {
+        LogPrintf("Calculating the statistics of the coin database...\n");
+        int64_t nStart = GetTimeMillis();
+        if (ComputeStats(stats))
+            db.Write(DB_COIN_STATS, stats);
+        LogPrintf("Counted %u unspent outputs in %dms\n", stats.nTransactionOutputs, GetTimeMillis() - nStart);
+    }
+    stats.hashBlock = ReadBestBlock();
+}
+
+bool CCoinsViewDB::ReadCoins(leveldb::Iterator* pcursor, const uint256 &txid, CCoins &coins) const {
+    // The cursor is expected at the first output of txid, and is left after its last one
+    bool fFound = false;
+    for (; pcursor->Valid() && IsCoinOutputOf(pcursor->key(), txid); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        CoinOutputKey key;
+        ssKey >> key;
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        CoinOutputValue value;
+        ssValue >> value;
+
+        if (!fFound) {
+            coins.Clear();
+            coins.fBlockReward = value.fBlockReward;
+            coins.nHeight = value.nHeight;
+            coins.nVersion = value.nVersion;
+            fFound = true;
+        }
+        if (coins.vout.size() <= key.n)
+            coins.vout.resize(key.n + 1);
+        coins.vout[key.n] = value.txout;
+    }
+    return fFound;
+}
+
+bool CCoinsViewDB::GetPendingCoins(const uint256 &txid, CCoins &coins) const {
+    boost::unique_lock<boost::mutex> lock(mutexPending);
+    if (!fPending)
+        return false;
+    CCoinsMap::const_iterator it = mapPending.find(txid);
+    if (it == mapPending.end())
+        return false;
+    coins = it->second.coins;
+    return true;
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+bool CCoinsViewDB::GetStoredCoins(const uint256 &txid, CCoins &coins) const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewReadIterator());
+    SeekCoinOutputs(pcursor.get(), txid);
+    if (ReadCoins(pcursor.get(), txid, coins))
+        return true;
+    return fUpgrading && db.Read(make_pair(DB_COINS, txid), coins);
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair('c', txid), coins);
+    // A transaction in the batch that is being written was read from here before, so the batch has all of it
+    if (GetPendingCoins(txid, coins))
+        return !coins.IsPruned();
+
+    // Outputs only move between the two formats while upgrading, writes don't have to be waited for
+    if (fUpgrading) {
+        LOCK(cs_upgrade);
+        return GetStoredCoins(txid, coins);
+    }
+    return GetStoredCoins(txid, coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair('c', txid));
+    CCoins coins;
+    return GetCoins(txid, coins);
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutexPending);
+        if (fPending && !hashBlockPending.IsNull())
+            return hashBlockPending;
+    }
+    return ReadBestBlock();
+}
+
+uint256 CCoinsViewDB::ReadBestBlock() const {
     uint256 hashBestChain;
-    if (!db.Read('B', hashBestChain))
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsNew) {
+    LOCK(cs_upgrade);
+
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    size_t outputs = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            const uint256& txid = it->first;
+            const CCoins& coins = it->second.coins;
+            const std::vector<bool>& vBaseUnspent = it->second.vBaseUnspent;
+            if (it->second.flags & CCoinsCacheEntry::FRESH) {
+                // Nothing stored yet
+                BatchWriteCoinOutputs(batch, txid, coins);
+                outputs += coins.vout.size();
+            } else if (fUpgrading && db.Exists(make_pair(DB_COINS, txid))) {
+                // Still in the old format, convert it along the way
+                batch.Erase(make_pair(DB_COINS, txid));
+                BatchWriteCoinOutputs(batch, txid, coins);
+                outputs += coins.vout.size();
+            } else {
+                // Only touch the outputs that were spent or added since the entry was read
+                size_t nSize = std::max(coins.vout.size(), vBaseUnspent.size());
+                for (unsigned int i = 0; i < nSize; i++) {
+                    bool fUnspent = i < coins.vout.size() && !coins.vout[i].IsNull();
+                    bool fBaseUnspent = i < vBaseUnspent.size() && vBaseUnspent[i];
+                    if (fUnspent && !fBaseUnspent) {
+                        batch.Write(CoinOutputKey(txid, i), CoinOutputValue(coins, i));
+                        outputs++;
+                    } else if (!fUnspent && fBaseUnspent) {
+                        batch.Erase(CoinOutputKey(txid, i));
+                        outputs++;
+                    }
+                }
+            }
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (!hashBlock.IsNull())
         BatchWriteHashBestChain(batch, hashBlock);
+    batch.Write(DB_COIN_STATS, statsNew);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transactions (%u outputs, out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)outputs, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::WritePending() {
+    AssertLockHeld(cs_write);
+    if (!fPending)
+        return true;
+
+    // The batch stays readable until it is stored, and stays pending if that fails
+    CCoinsStats statsNew = stats;
+    statsNew += statsPending;
+    if (!WriteCoins(mapPending, hashBlockPending, statsNew))
+        return false;
+
+    CCoinsMap mapWritten;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexPending);
+        stats = statsNew;
+        if (!hashBlockPending.IsNull())
+            stats.hashBlock = hashBlockPending;
+        mapWritten.swap(mapPending);
+        statsPending = CCoinsStats();
+        fPending = false;
+    }
+    // The copy is freed outside the lock
+    return true;
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta) {
+    LOCK(cs_write);
+    if (!WritePending())
+        return false;
+
+    CCoinsStats statsNew = stats;
+    statsNew += statsDelta;
+    if (!WriteCoins(mapCoins, hashBlock, statsNew))
+        return false;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexPending);
+        stats = statsNew;
+        if (!hashBlock.IsNull())
+            stats.hashBlock = hashBlock;
+    }
+    mapCoins.clear();
+    return true;
+}
+
+bool CCoinsViewDB::BatchWriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta) {
+    if (!fBackgroundWriter)
+        return BatchWrite(mapCoins, hashBlock, statsDelta);
+
+    LOCK(cs_write);
+    // A batch that is still waiting is written here first, so at most one is held in memory
+    if (!WritePending())
+        return false;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexPending);
+        mapPending.swap(mapCoins);
+        hashBlockPending = hashBlock;
+        statsPending = statsDelta;
+        fPending = true;
+    }
+    condPending.notify_one();
+    mapCoins.clear();
+    return true;
+}
+
+bool CCoinsViewDB::WaitAndWritePending() {
+    {
+        boost::unique_lock<boost::mutex> lock(mutexPending);
+        while (!fPending)
+            condPending.wait(lock);
+    }
+    LOCK(cs_write);
+    return WritePending();
+}
+
+bool CCoinsViewDB::UpgradeCoins(unsigned int nMaxTransactions) {
+    LOCK(cs_upgrade);
+    if (!fUpgrading)
+        return false;
+
+    // Converted records are erased, the cursor only saves skipping over their tombstones
+    uint256 hashCursor;
+    db.Read(DB_UPGRADE_CURSOR, hashCursor);
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_COINS, hashCursor);
+    pcursor->Seek(ssKeySet.str());
+
+    CLevelDBBatch batch;
+    unsigned int nConverted = 0;
+    for (; pcursor->Valid() && nConverted < nMaxTransactions; pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        ssKey >> chType;
+        if (chType != DB_COINS)
+            break;
+        ssKey >> hashCursor;
+
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        CCoins coins;
+        ssValue >> coins;
+
+        batch.Erase(make_pair(DB_COINS, hashCursor));
+        BatchWriteCoinOutputs(batch, hashCursor, coins);
+        nConverted++;
+    }
+
+    bool fDone = !pcursor->Valid() || pcursor->key().size() == 0 || pcursor->key()[0] != DB_COINS;
+    if (fDone)
+        batch.Erase(DB_UPGRADE_CURSOR);
+    else
+        batch.Write(DB_UPGRADE_CURSOR, hashCursor);
+    if (!db.WriteBatch(batch))
+        return error("%s : failed to write converted coins", __func__);
+
+    LogPrint("coindb", "Converted %u transactions to the per output coin format\n", nConverted);
+    if (fDone) {
+        fUpgrading = false;
+        LogPrintf("Coin database upgrade finished\n");
+    }
+    return !fDone;
+}
+
+void ThreadCoinsDBWriter(CCoinsViewDB* pcoinsdb)
+{
+    RenameThread("crown-coinswriter");
+    pcoinsdb->SetBackgroundWriter(true);
+    try {
+        while (pcoinsdb->WaitAndWritePending()) {}
+        LogPrintf("%s : failed to write coins, writing in the foreground from now on\n", __func__);
+        pcoinsdb->SetBackgroundWriter(false);
+    } catch (boost::thread_interrupted) {
+        pcoinsdb->SetBackgroundWriter(false);
+        throw;
+    }
+}
+
+void ThreadUpgradeCoinsDB(CCoinsViewDB* pcoinsdb)
+{
+    RenameThread("crown-coinsupgrade");
+    if (!pcoinsdb->IsUpgrading())
+        return;
+
+    LogPrintf("Upgrading the coin database to the per output format in the background\n");
+    int64_t nStart = GetTimeMillis();
+    while (pcoinsdb->UpgradeCoins(COINS_UPGRADE_BATCH_SIZE)) {
+        // Leave room for block validation between batches
+        MilliSleep(10);
+    }
+    LogPrintf("Coin database upgrade stopped after %dms\n", GetTimeMillis() - nStart);
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -95,60 +428,86 @@ bool CBlockTreeDB::ReadReindexing(bool &fReindexing) {
     return true;
 }
 
+bool CBlockTreeDB::WriteBlockIndexSnapshotId(const uint256 &id) {
+    if (id.IsNull())
+        return Erase('i', true);
+    else
+        return Write('i', id, true);
+}
+
+bool CBlockTreeDB::ReadBlockIndexSnapshotId(uint256 &id) {
+    return Read('i', id);
+}
+
 bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+static bool GetCursorTxid(leveldb::Iterator* pcursor, char chType, uint256& txid) {
+    if (!pcursor->Valid())
+        return false;
+    leveldb::Slice slKey = pcursor->key();
+    if (slKey.size() < 1 + txid.size() || slKey[0] != chType)
+        return false;
+    memcpy(txid.begin(), slKey.data() + 1, txid.size());
+    return true;
+}
+
+bool CCoinsViewDB::GetStats(CCoinsStats &statsOut) const {
+    boost::unique_lock<boost::mutex> lock(mutexPending);
+    statsOut = stats;
+    if (fPending) {
+        statsOut += statsPending;
+        if (!hashBlockPending.IsNull())
+            statsOut.hashBlock = hashBlockPending;
+    }
+    return true;
+}
+
+bool CCoinsViewDB::ComputeStats(CCoinsStats &statsOut) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+    boost::scoped_ptr<leveldb::Iterator> pcursorOld;
+    {
+        // Both cursors have to see the database between the same two upgrade steps
+        LOCK(cs_upgrade);
+        pcursor.reset(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+        pcursorOld.reset(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+        statsOut = CCoinsStats();
+        statsOut.hashBlock = ReadBestBlock();
+    }
+    pcursor->Seek(std::string(1, DB_COIN_OUTPUT));
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_COINS, uint256());
+    pcursorOld->Seek(ssKeySet.str());
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    while (true) {
         boost::this_thread::interruption_point();
         try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
+            uint256 txhash, txhashOld;
+            bool fNew = GetCursorTxid(pcursor.get(), DB_COIN_OUTPUT, txhash);
+            bool fOld = GetCursorTxid(pcursorOld.get(), DB_COINS, txhashOld);
+            if (!fNew && !fOld)
+                break;
+
+            // The same transaction can't be in both formats
+            CCoins coins;
+            if (fOld && (!fNew || txhashOld < txhash)) {
+                leveldb::Slice slValue = pcursorOld->value();
                 CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
                 ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fBlockReward ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                txhash = txhashOld;
+                pcursorOld->Next();
+            } else {
+                ReadCoins(pcursor.get(), txhash, coins);
             }
-            pcursor->Next();
+            statsOut.AddCoins(txhash, coins);
         } catch (std::exception &e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -163,6 +522,22 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadBudgetFeeTx(const uint256 &txid, CTransaction &tx, uint256 &hashBlock) {
+    std::pair<CTransaction, uint256> entry;
+    if (!Read(make_pair('p', txid), entry))
+        return false;
+    tx = entry.first;
+    hashBlock = entry.second;
+    return true;
+}
+
+bool CBlockTreeDB::WriteBudgetFeeTxs(const std::vector<CTransaction> &vtx, const uint256 &hashBlock) {
+    CLevelDBBatch batch;
+    for (std::vector<CTransaction>::const_iterator it=vtx.begin(); it!=vtx.end(); it++)
+        batch.Write(make_pair('p', it->GetHash()), make_pair(*it, hashBlock));
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
@@ -8,12 +8,17 @@
 
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "sync.h"
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
 class CCoins;
 class uint256;
 
@@ -32,21 +37,87 @@ static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+//! Transactions converted to the per output format in one step of the coin database upgrade
+static const unsigned int COINS_UPGRADE_BATCH_SIZE = 10000;
+
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/)
+ *
+ * Every unspent output is stored under its own key, so spending an output
+ * only erases that output and leaves the rest of the transaction alone.
+ * Older databases keep one record per transaction; those are converted in
+ * the background by UpgradeCoins() and read as they are until then.
+ *
+ * BatchWriteInBackground() hands a batch to the thread running
+ * ThreadCoinsDBWriter() and returns. Reads are answered from that batch until
+ * it is stored. Each batch is still written atomically together with its
+ * best block, and only one can wait at a time.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+
+    //! Serializes the upgrade with writes, and with reads that may have to look at both formats
+    mutable CCriticalSection cs_upgrade;
+    //! Whether records of the old per transaction format are left
+    std::atomic<bool> fUpgrading;
+
+    //! Held while writing, so batches are stored one at a time and in order
+    CCriticalSection cs_write;
+    //! Guards the pending batch and stats, which only change while cs_write is held as well
+    mutable boost::mutex mutexPending;
+    boost::condition_variable condPending;
+    //! Batch handed to the background writer and not stored yet
+    bool fPending;
+    CCoinsMap mapPending;
+    uint256 hashBlockPending;
+    CCoinsStats statsPending;
+    //! Whether a thread is running ThreadCoinsDBWriter()
+    std::atomic<bool> fBackgroundWriter;
+    //! Statistics of the stored outputs, written together with the best block
+    CCoinsStats stats;
+
+    //! Read the outputs of txid starting at the cursor
+    bool ReadCoins(leveldb::Iterator* pcursor, const uint256 &txid, CCoins &coins) const;
+    //! Read txid from the database itself
+    bool GetStoredCoins(const uint256 &txid, CCoins &coins) const;
+    //! Look txid up in the pending batch, true if it is there
+    bool GetPendingCoins(const uint256 &txid, CCoins &coins) const;
+    //! Best block of the stored outputs
+    uint256 ReadBestBlock() const;
+    //! Store coins and the statistics after them, mapCoins is left as it is
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsNew);
+    //! Store the pending batch if there is one, with cs_write held
+    bool WritePending();
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
-    bool GetStats(CCoinsStats &stats) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta);
+    bool BatchWriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsStats &statsDelta);
+    bool GetStats(CCoinsStats &statsOut) const;
+
+    void SetBackgroundWriter(bool fRunning) { fBackgroundWriter = fRunning; }
+    //! Wait for a batch from BatchWriteInBackground and store it, false if that failed
+    bool WaitAndWritePending();
+
+    //! Count the statistics from every stored output, which takes a while
+    bool ComputeStats(CCoinsStats &statsOut) const;
+
+    bool IsUpgrading() const { return fUpgrading; }
+    //! Convert up to nMaxTransactions old records to the per output format, returns false once none are left
+    bool UpgradeCoins(unsigned int nMaxTransactions);
 };
 
+/** Convert the coin database to the per output format in the background, a batch at a time */
+void ThreadUpgradeCoinsDB(CCoinsViewDB* pcoinsdb);
+
+/** Store the batches handed to the coin database by BatchWriteInBackground */
+void ThreadCoinsDBWriter(CCoinsViewDB* pcoinsdb);
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
 {
@@ -63,8 +134,14 @@ public:
     bool WriteLastBlockFile(int nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    //! Id of the block index snapshot written at shutdown, erased when id is null
+    bool WriteBlockIndexSnapshotId(const uint256 &id);
+    bool ReadBlockIndexSnapshotId(uint256 &id);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    //! Budget fee transactions with the hash of their block, readable after the block is pruned
+    bool ReadBudgetFeeTx(const uint256 &txid, CTransaction &tx, uint256 &hashBlock);
+    bool WriteBudgetFeeTxs(const std::vector<CTransaction> &vtx, const uint256 &hashBlock);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
@@ -1975,12 +1975,22 @@ uint256 CWallet::GenerateStakeModifier(const CBlockIndex* prewardBlockIndex) con
     if (!prewardBlockIndex)
         return uint256();
 
+    // A block's ancestors never change, neither does the modifier of a pointer into it
+    std::map<const CBlockIndex*, uint256>::const_iterator it = mapStakeModifierCache.find(prewardBlockIndex);
+    if (it != mapStakeModifierCache.end())
+        return it->second;
+
     const CBlockIndex* pstakeModBlockIndex = prewardBlockIndex->GetAncestor(prewardBlockIndex->nHeight - Params().KernelModifierOffset());
     if (!pstakeModBlockIndex) {
         LogPrintf("GenerateStakeModifier -- Failed retrieving block index for stake modifier\n");
         return uint256();
     }
 
+    // Only recent pointers are staked with, so it's enough to start over once in a while
+    if (mapStakeModifierCache.size() >= STAKE_MODIFIER_CACHE_SIZE)
+        mapStakeModifierCache.clear();
+    mapStakeModifierCache[prewardBlockIndex] = pstakeModBlockIndex->GetBlockHash();
+
     return pstakeModBlockIndex->GetBlockHash();
 }
 
@@ -2034,6 +2044,8 @@ bool CWallet::CreateCoinStake(const int nHeight, const uint32_t& nBits, const ui
     }
 
     //Create kernels for each valid stake pointer and see if any create a successful proof
+    std::vector<Kernel> vKernels;
+    std::vector<StakePointer> vKernelPointers;
     for (auto pointer : vStakePointers) {
         if (!mapBlockIndex.count(pointer.hashBlock))
             continue;
@@ -2054,32 +2066,37 @@ bool CWallet::CreateCoinStake(const int nHeight, const uint32_t& nBits, const ui
             continue;
 
         auto pOutpoint = std::make_pair(pointer.txid, pointer.nPos);
-        Kernel kernel(pOutpoint, nAmountMN, nStakeModifier, pindex->GetBlockTime(), nTxNewTime);
-        uint256 nTarget = ArithToUint256(arith_uint256().SetCompact(nBits));
-        nLastStakeAttempt = GetTime();
+        vKernels.emplace_back(Kernel(pOutpoint, nAmountMN, nStakeModifier, pindex->GetBlockTime(), nTxNewTime));
+        vKernelPointers.emplace_back(pointer);
+    }
 
-        if (!SearchTimeSpan(kernel, nTime, nTime + STAKE_SEARCH_INTERVAL, nTarget))
-            continue;
+    if (vKernels.empty())
+        return false;
 
-        LogPrintf("%s: Found valid kernel for mn/sn collateral %s\n", __func__, pvinActiveNode->prevout.ToString());
-        LogPrintf("%s: %s\n", __func__, kernel.ToString());
+    uint256 nTarget = ArithToUint256(arith_uint256().SetCompact(nBits));
+    nLastStakeAttempt = GetTime();
 
-        //Add stake payment to coinstake tx
-        CAmount nBlockReward = GetBlockValue(nHeight, 0); //Do not add fees until after they are packaged into the block
-        CScript scriptBlockReward = GetScriptForDestination(ppubkeyActiveNode->GetID());
-        CTxOut out(nBlockReward, scriptBlockReward);
-        txCoinStake.vout.emplace_back(out);
-        nTxNewTime = kernel.GetTime();
-        stakePointer = pointer;
+    int nFound = SearchStakeKernels(vKernels, nTime, nTime + STAKE_SEARCH_INTERVAL, nTarget);
+    if (nFound < 0)
+        return false;
 
-        CTxIn txin;
-        txin.scriptSig << OP_PROOFOFSTAKE;
-        txCoinStake.vin.emplace_back(txin);
+    Kernel& kernel = vKernels[nFound];
+    LogPrintf("%s: Found valid kernel for mn/sn collateral %s\n", __func__, pvinActiveNode->prevout.ToString());
+    LogPrintf("%s: %s\n", __func__, kernel.ToString());
 
-        return true;
-    }
+    //Add stake payment to coinstake tx
+    CAmount nBlockReward = GetBlockValue(nHeight, 0); //Do not add fees until after they are packaged into the block
+    CScript scriptBlockReward = GetScriptForDestination(ppubkeyActiveNode->GetID());
+    CTxOut out(nBlockReward, scriptBlockReward);
+    txCoinStake.vout.emplace_back(out);
+    nTxNewTime = kernel.GetTime();
+    stakePointer = vKernelPointers[nFound];
 
-    return false;
+    CTxIn txin;
+    txin.scriptSig << OP_PROOFOFSTAKE;
+    txCoinStake.vin.emplace_back(txin);
+
+    return true;
 }
 
 template<typename stakingnode>
@@ -53,6 +53,8 @@ static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 
 static const int MASTERNODE_COLLATERAL = 10000;
 static const int SYSTEMNODE_COLLATERAL = 500;
+//! Stake pointers whose stake modifier is remembered between staking rounds
+static const unsigned int STAKE_MODIFIER_CACHE_SIZE = 1000;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -167,6 +169,8 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    //! Stake modifiers by the block of the stake pointer, only used by the stake miner thread
+    mutable std::map<const CBlockIndex*, uint256> mapStakeModifierCache;
     uint256 GenerateStakeModifier(const CBlockIndex* prewardBlockIndex) const;
 
 public: